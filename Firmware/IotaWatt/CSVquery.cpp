@@ -1,8 +1,157 @@
 #include "IotaWatt.h"
 
+/*****************************************************************************************
+ * Query result cache
+ * 
+ * Dashboards repeat the same query each refresh with the window moved forward a little.
+ * Minute, hour and longer groups fall on the same boundaries after the first group, so 
+ * most of the groups in a refreshed query have already been computed.  
+ * 
+ * Each entry holds one contiguous run of completed groups for a signature (value columns 
+ * and grouping): the start of each group, its values and whether it had data.  A group's
+ * end is the next one's start (lastEnd for the last).  Groups still open at the end of 
+ * the log, or cut short by the query end, are never cached, so the run simply extends 
+ * each refresh.  Entries are reused least recently used first, and freed by queryCacheTrim
+ * when they haven't been used for QUERY_CACHE_IDLE_MS.
+ ****************************************************************************************/
+
+struct queryCacheEntry {
+      uint32_t    signature;
+      uint32_t    lastUse;                  // millis() of last use (LRU)
+      uint32_t    lastEnd;                  // End of last group
+      uint16_t    vectors;                  // Values per group
+      uint16_t    capacity;                 // Groups that fit
+      uint16_t    head;                     // Ring index of first group
+      uint16_t    count;                    // Groups held
+      uint32_t*   starts;
+      uint8_t*    missing;
+      double*     values;
+      queryCacheEntry()
+      :signature(0)
+      ,lastUse(0)
+      ,lastEnd(0)
+      ,vectors(0)
+      ,capacity(0)
+      ,head(0)
+      ,count(0)
+      ,starts(nullptr)
+      ,missing(nullptr)
+      ,values(nullptr)
+      {}
+      int         find(uint32_t start, uint32_t end);
+      void        add(uint32_t start, uint32_t end, bool missed, const double* block, int row);
+    };
+
+queryCacheEntry queryCache[QUERY_CACHE_ENTRIES];
+
+    // Get the entry for a signature, or take over the least recently used.
+
+queryCacheEntry* queryCacheClaim(uint32_t signature, uint16_t vectors){
+  queryCacheEntry* entry = queryCache;
+  for(int i=0; i<QUERY_CACHE_ENTRIES; i++){
+    if(queryCache[i].signature == signature && queryCache[i].vectors == vectors){
+      queryCache[i].lastUse = millis();
+      return queryCache + i;
+    }
+    if((millis() - queryCache[i].lastUse) > (millis() - entry->lastUse)){
+      entry = queryCache + i;
+    }
+  }
+  delete[] entry->starts;
+  delete[] entry->missing;
+  delete[] entry->values;
+  entry->signature = signature;
+  entry->vectors = vectors;
+  entry->capacity = QUERY_CACHE_BYTES / (sizeof(uint32_t) + 1 + vectors * sizeof(double));
+  entry->starts = new uint32_t[entry->capacity];
+  entry->missing = new uint8_t[entry->capacity];
+  entry->values = new double[entry->capacity * vectors];
+  entry->head = entry->count = 0;
+  entry->lastUse = millis();
+  return entry;
+}
+
+    // Free the entries that haven't been used for a while.  A query still holding one
+    // sees the signature change and stops using it.
+
+void queryCacheTrim(){
+  for(int i=0; i<QUERY_CACHE_ENTRIES; i++){
+    queryCacheEntry* entry = queryCache + i;
+    if(entry->starts && (millis() - entry->lastUse) > QUERY_CACHE_IDLE_MS){
+      delete[] entry->starts;
+      delete[] entry->missing;
+      delete[] entry->values;
+      entry->starts = nullptr;
+      entry->missing = nullptr;
+      entry->values = nullptr;
+      entry->signature = 0;
+      entry->vectors = 0;
+      entry->capacity = 0;
+      entry->head = entry->count = 0;
+    }
+  }
+}
+
+    // Returns ring index of the group or -1.
+
+int queryCacheEntry::find(uint32_t start, uint32_t end){
+  int low = 0;
+  int high = count - 1;
+  while(low <= high){
+    int mid = (low + high) / 2;
+    uint32_t midStart = starts[(head + mid) % capacity];
+    if(midStart < start){
+      low = mid + 1;
+    }
+    else if(midStart > start){
+      high = mid - 1;
+    }
+    else {
+      uint32_t midEnd = (mid + 1 < count) ? starts[(head + mid + 1) % capacity] : lastEnd;
+      return (midEnd == end) ? (head + mid) % capacity : -1;
+    }
+  }
+  return -1;
+}
+
+    // Add a group that follows the run, or start a new run if past it.
+
+void queryCacheEntry::add(uint32_t start, uint32_t end, bool missed, const double* block, int row){
+  if(count && start != lastEnd){
+    if(start < lastEnd){
+      return;
+    }
+    count = 0;
+  }
+  if( ! count){
+    head = 0;
+  }
+  if(count == capacity){
+    head = (head + 1) % capacity;
+    count--;
+  }
+  int ndx = (head + count++) % capacity;
+  starts[ndx] = start;
+  missing[ndx] = missed;
+  for(int i=0; i<vectors; i++){
+    values[ndx * vectors + i] = block[i * CSVQUERY_BLOCK + row];
+  }
+  lastEnd = end;
+}
+
 CSVquery::CSVquery()
     :_oldRec(nullptr)
     ,_newRec(nullptr)
+    ,_block(nullptr)
+    ,_blockValues(nullptr)
+    ,_blockRows(0)
+    ,_blockRow(0)
+    ,_blockNext(0)
+    ,_blockCached(false)
+    ,_cache(nullptr)
+    ,_cacheSignature(0)
+    ,_computeUs(0)
+    ,_startReads(0)
     ,_begin(0)
     ,_end(0)
     ,_format(formatJson)
@@ -15,14 +164,20 @@ CSVquery::CSVquery()
     ,_missingNull(true)
     ,_missingZero(false)
     ,_timeOnly(false)
+    ,_timeDelta(false)
+    ,_lastTime(0)
     ,_columns(nullptr)
     ,_intervals{5,10,15,20,30,60,120,300,600,1200,1800,3600,7200,14400,21600,28800}
     {}
 
 CSVquery::~CSVquery(){
     trace(T_CSVquery,1,0);
-    delete _oldRec;
-    delete _newRec;
+    if(_query == select){
+        perfQuery.record(_computeUs);
+        perfQueryReads += logReadIO() - _startReads;
+    }
+    delete[] _block;
+    delete[] _blockValues;
     trace(T_CSVquery,1,2);
     delete _columns;
     trace(T_CSVquery,1,3);
@@ -129,11 +284,23 @@ bool    CSVquery::setup(){
             else if(arg.equalsIgnoreCase("CSV")){
                 _format = formatCSV;
             }
+            else if(arg.equalsIgnoreCase("bin")){
+                _format = formatBinary;
+            }
             else {
                 _failReason = F("Invalid format");
                 return false;
             }
         }
+        if(server.hasArg(F("timestamps"))){
+            String arg = server.arg(F("timestamps"));
+            if(arg.equalsIgnoreCase("delta")) _timeDelta = true;
+            else if(arg.equalsIgnoreCase("absolute")) _timeDelta = false;
+            else {
+                _failReason = F("Invalid timestamps");
+                return false;
+            }
+        }
         
         trace(T_CSVquery,10);
 
@@ -333,16 +500,47 @@ bool    CSVquery::setup(){
         }
 
         trace(T_CSVquery,19);
-        if(_header){
+        if(_format == formatBinary){
+            buildBinaryHeader();
+        }
+        else if(_header){
             buildHeader();
         }
         if(_format == formatJson){
             _buffer.print('[');
         }
-        _oldRec = new IotaLogRecord;
-        _newRec = new IotaLogRecord;
-        _newRec->UNIXtime = _begin;
-        logReadKey(_newRec);
+        int vectors = 0;
+        col = _columns;
+        while(col){
+            if(col->source != 'T'){
+                col->vector = vectors++;
+            }
+            col = col->next;
+        }
+        _block = new IotaLogRecord[CSVQUERY_BLOCK + 1];
+        _blockValues = new double[vectors * CSVQUERY_BLOCK];
+        
+            // Signature of what determines the values of a group.
+
+        if(vectors && ! _timeOnly){
+            uint32_t hash = hashFNV(2166136261UL, &_groupUnits, sizeof(_groupUnits));
+            hash = hashFNV(hash, &_groupMult, sizeof(_groupMult));
+            col = _columns;
+            while(col){
+                if(col->source != 'T'){
+                    uint32_t scriptSig = col->script->signature();
+                    hash = hashFNV(hash, &scriptSig, sizeof(scriptSig));
+                    hash = hashFNV(hash, &col->unit, sizeof(col->unit));
+                }
+                col = col->next;
+            }
+            _cacheSignature = hash;
+            _cache = queryCacheClaim(hash, vectors);
+        }
+        _startReads = logReadIO();
+        _block->UNIXtime = _begin;
+        logReadKey(_block);
+        _newRec = _block;
         trace(T_CSVquery,20);
         _query = select;
         return true;
@@ -373,6 +571,58 @@ bool    CSVquery::isJson(){
 bool    CSVquery::isCSV(){
     return _format == formatCSV;
 }
+bool    CSVquery::isBinary(){
+    return _format == formatBinary;
+}
+
+//*****************************************************************************************
+//  etag - For a select that ends within the history log, the result can't change unless 
+//  the query, the configuration or the log that serves one of its keys changes.  Returns
+//  an ETag that covers all of that, or an empty String if the result isn't cacheable.
+//
+//  The logs' first keys move with every write once they have wrapped, so they aren't
+//  part of it.  Instead the group keys are walked as fillBlock would produce them, 
+//  hashing the interval of the log that logSelect routes each to.  That changes only 
+//  when a key of this query moves to another log (or falls off the start of them all).
+//*****************************************************************************************
+String  CSVquery::etag(){
+    if(_query != select || ! histLog.isOpen() || _end > histLog.lastKey()){
+        return String();
+    }
+    uint32_t hash = 2166136261;
+    for(int i=0; i<server.args(); i++){
+        hash = hashFNV(hash, server.argName(i).c_str(), server.argName(i).length());
+        hash = hashFNV(hash, server.arg(i).c_str(), server.arg(i).length());
+    }
+    uint32_t keys[2] = {_begin, _end};
+    hash = hashFNV(hash, keys, sizeof(keys));
+    uint32_t key = _begin;
+    int groups = 0;
+    while(true){
+        IotaLog* readLog = logSelect(key);
+        uint32_t route[2] = {readLog->interval(), key >= readLog->firstKey()};
+        hash = hashFNV(hash, route, sizeof(route));
+        if(key >= _end || ++groups > CSVQUERY_ETAG_GROUPS){
+            break;
+        }
+        uint32_t next = (uint32_t)nextGroup((time_t)key, _groupUnits, _groupMult);
+        if( ! _timeOnly){
+            next -= next % logSelect(next)->interval();
+        }
+        if(next <= key){
+            break;
+        }
+        key = next;
+    }
+    if(groups > CSVQUERY_ETAG_GROUPS){
+        return String();
+    }
+    hash = hashFNV(hash, configSHA256, 32);
+    hash = hashFNV(hash, IOTAWATT_VERSION, strlen(IOTAWATT_VERSION));
+    char etag[12];
+    snprintf_P(etag, sizeof(etag), PSTR("\"%08x\""), hash);
+    return String(etag);
+}
 
 String  CSVquery::failReason(){
     return _failReason.length() ? _failReason : "unspecified";
@@ -478,10 +728,7 @@ void CSVquery::buildLine(){
 
         else {
             trace(T_CSVquery,64);
-            double value = 0.0;
-            value = col->script->run(_oldRec, _newRec, elapsedHours, col->unit);
-            trace(T_CSVquery,65);
-            printValue(value, col->decimals);
+            printValue(_blockValues[col->vector * CSVQUERY_BLOCK + _blockRow], col->decimals);
         }
 
     col = col->next;
@@ -489,6 +736,94 @@ void CSVquery::buildLine(){
 
 }
 
+//*****************************************************************************************
+//                  Binary format
+//
+//  All fields little-endian (native to the ESP8266), no padding.
+//
+//  Header:
+//      char[4]     "IWQB"
+//      uint8       version (1)
+//      uint8       flags: bit 0 = timestamps are zigzag varint deltas
+//      uint8       number of value columns (time columns are implied by the row timestamp)
+//      uint8       reserved (0)
+//      uint32      begin (UTC)
+//      uint32      end (UTC)
+//      int32       local time offset at begin in seconds
+//      per value column:
+//          uint8   units (IotaScript units enum)
+//          int8    decimals
+//          uint8   name length
+//          char[]  name
+//
+//  Rows:
+//      timestamp   UTC start of group, uint32 or varint delta from previous (first from begin)
+//      float32     per value column, NaN for missing (zero when missing=zero)
+//*****************************************************************************************
+void CSVquery::buildBinaryHeader(){
+    uint8_t count = 0;
+    column* col = _columns;
+    while(col){
+        if(col->source != 'T') count++;
+        col = col->next;
+    }
+    uint8_t hdr[8] = {'I','W','Q','B',1, (uint8_t)(_timeDelta ? 1 : 0), count, 0};
+    _buffer.write(hdr, 8);
+    int32_t offset = UTC2Local(_begin) - _begin;
+    _buffer.write((uint8_t*)&_begin, 4);
+    _buffer.write((uint8_t*)&_end, 4);
+    _buffer.write((uint8_t*)&offset, 4);
+    col = _columns;
+    while(col){
+        if(col->source != 'T'){
+            const char* name = (col->source == 'I') ? inputChannel[col->input]->_name : col->script->name();
+            uint8_t desc[3] = {(uint8_t)col->unit, (uint8_t)col->decimals, (uint8_t)MIN(strlen(name), 255)};
+            _buffer.write(desc, 3);
+            _buffer.write((uint8_t*)name, desc[2]);
+        }
+        col = col->next;
+    }
+    _lastTime = _begin;
+}
+
+void CSVquery::buildBinaryLine(){
+    trace(T_CSVquery,66);
+    uint32_t Time = _oldRec->UNIXtime;
+    if(_timeDelta){
+        int32_t delta = Time - _lastTime;
+        uint32_t zigzag = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+        uint8_t varint[5];
+        int len = 0;
+        do {
+            varint[len] = zigzag & 0x7f;
+            zigzag >>= 7;
+            if(zigzag) varint[len] |= 0x80;
+            len++;
+        } while(zigzag);
+        _buffer.write(varint, len);
+    }
+    else {
+        _buffer.write((uint8_t*)&Time, 4);
+    }
+    _lastTime = Time;
+
+    double elapsedHours = _newRec->logHours - _oldRec->logHours;
+    column* col = _columns;
+    while(col){
+        if(col->source != 'T'){
+            float value = NAN;
+            if(elapsedHours != 0){
+                value = _blockValues[col->vector * CSVQUERY_BLOCK + _blockRow];
+            }
+            else if(_missingZero){
+                value = 0;
+            }
+            _buffer.write((uint8_t*)&value, 4);
+        }
+        col = col->next;
+    }
+}
+
 void CSVquery::printValue(const double value, const int8_t decimals){
     char str[12];
     snprintf(str,12,"%#.*f",decimals,value);
@@ -609,19 +944,16 @@ size_t  CSVquery::readResult(uint8_t* buf, int len){
                 else {
                     trace(T_CSVquery,50);
 
-                        // Age the log record
-                    
-                    IotaLogRecord* swapRec = _oldRec;
-                    _oldRec = _newRec;
-                    _newRec = swapRec;
+                        // Advance to the next group, 
+                        // reading and computing another block when needed.
 
-                        // Read group end record
-
-                    _newRec->UNIXtime = (uint32_t)nextGroup((time_t)_oldRec->UNIXtime, _groupUnits, _groupMult);
-                    if( ! _timeOnly){
+                    if(_blockNext >= _blockRows){
                         trace(T_CSVquery,51);
-                        logReadKey(_newRec);
+                        fillBlock();
                     }
+                    _blockRow = _blockNext++;
+                    _oldRec = _block + _blockRow;
+                    _newRec = _block + _blockRow + 1;
 
                         // Belt and suspenders,
                         // Make sure we are moving forward.
@@ -636,6 +968,14 @@ size_t  CSVquery::readResult(uint8_t* buf, int len){
 
                     if( _timeOnly || (! (_newRec->logHours == _oldRec->logHours && _missingSkip))){
                         trace(T_CSVquery,53);    
+                        if(_format == formatBinary){
+                            if(dispatchExpired()){
+                                dispatchCheckpoint();
+                            }
+                            buildBinaryLine();
+                            _firstLine = false;
+                            continue;
+                        }
                         if( ! _firstLine){
                             if(_format == formatJson){
                                 _buffer.print(',');
@@ -648,7 +988,10 @@ size_t  CSVquery::readResult(uint8_t* buf, int len){
                         if(_format == formatJson){
                             _buffer.print('[');
                         }
-                        trace(T_CSVquery,54);    
+                        trace(T_CSVquery,54);
+                        if(dispatchExpired()){
+                            dispatchCheckpoint();
+                        }    
                         buildLine();
                         trace(T_CSVquery,55);
 
@@ -665,6 +1008,134 @@ size_t  CSVquery::readResult(uint8_t* buf, int len){
     }
 }
 
+//*****************************************************************************************
+//                  fillBlock
+//
+//  Read the end records of the next block of groups with one batched logReadKeys, then
+//  run each value column's Script down the block into its value vector.  The lines
+//  are then just formatted from the vectors.  The last record carries over as the 
+//  start of the next block.
+//
+//  Groups found in the result cache are served as a block of their own without reading
+//  the log.  Their records carry only the time and a logHours that advances when the 
+//  group had data, which is all the line builders look at.
+//*****************************************************************************************
+void CSVquery::fillBlock(){
+    trace(T_CSVquery,57);
+    uint32_t startUs = micros();
+    if(_blockRows){
+        memcpy(_block, _block + _blockRows, sizeof(IotaLogRecord));
+    }
+
+        // Group keys as reading one at a time would produce them,
+        // each following from the (log interval aligned) key before.
+
+    uint32_t key = _block->UNIXtime;
+    _blockRows = 0;
+    while(_blockRows < CSVQUERY_BLOCK){
+        uint32_t next = (uint32_t)nextGroup((time_t)key, _groupUnits, _groupMult);
+        if( ! _timeOnly){
+            next -= next % logSelect(next)->interval();
+        }
+        _blockKeys[_blockRows++] = next;
+        if(next <= key || next >= _end){
+            break;
+        }
+        key = next;
+    }
+    if(_timeOnly){
+        for(int i=0; i<_blockRows; i++){
+            _block[i+1].UNIXtime = _blockKeys[i];
+        }
+        perfQueryGroups += _blockRows;
+        _blockNext = 0;
+        return;
+    }
+
+        // Serve a run of cached groups.
+
+    if(_cache && _cache->signature != _cacheSignature){
+        _cache = nullptr;
+    }
+    if(_cache){
+        int hits = 0;
+        int ndx;
+        while(hits < _blockRows && (ndx = _cache->find(_block[hits].UNIXtime, _blockKeys[hits])) >= 0){
+            trace(T_CSVquery,59);
+            _block[hits+1].UNIXtime = _blockKeys[hits];
+            _block[hits+1].logHours = _block[hits].logHours + (_cache->missing[ndx] ? 0 : 1);
+            for(int i=0; i<_cache->vectors; i++){
+                _blockValues[i * CSVQUERY_BLOCK + hits] = _cache->values[ndx * _cache->vectors + i];
+            }
+            hits++;
+        }
+        if(hits){
+            _cache->lastUse = millis();
+            _blockRows = hits;
+            _blockCached = true;
+            _blockNext = 0;
+            perfQueryGroups += hits;
+            perfQueryCached += hits;
+            _computeUs += micros() - startUs;
+            return;
+        }
+
+            // Compute up to the next cached group.
+
+        for(int i=1; i<_blockRows; i++){
+            if(_cache->find(_blockKeys[i-1], _blockKeys[i]) >= 0){
+                _blockRows = i;
+                break;
+            }
+        }
+    }
+
+        // Read the records.
+        // If the start came from the cache, read it for real.
+
+    if(_blockCached){
+        logReadKey(_block);
+        _blockCached = false;
+    }
+    logReadKeys(_blockKeys, _block + 1, _blockRows);
+
+        // Compute the block column by column.
+
+    trace(T_CSVquery,58);
+    column* col = _columns;
+    while(col){
+        if(col->source != 'T'){
+            double* vector = _blockValues + col->vector * CSVQUERY_BLOCK;
+            for(int i=0; i<_blockRows; i++){
+                double elapsedHours = _block[i+1].logHours - _block[i].logHours;
+                vector[i] = elapsedHours == 0 ? 0.0 : col->script->run(_block + i, _block + i + 1, elapsedHours, col->unit);
+            }
+            perfQueryRuns += _blockRows;
+            if(dispatchExpired()){
+                uint32_t yieldUs = micros();
+                dispatchCheckpoint();
+                startUs += micros() - yieldUs;          // Don't count sampling
+            }
+        }
+        col = col->next;
+    }
+
+        // Cache the completed groups.
+
+    if(_cache && _cache->signature == _cacheSignature){
+        for(int i=0; i<_blockRows; i++){
+            uint32_t end = _block[i+1].UNIXtime;
+            if(end >= _end || end > currLog.lastKey()){
+                break;
+            }
+            _cache->add(_block[i].UNIXtime, end, _block[i+1].logHours == _block[i].logHours, _blockValues, i);
+        }
+    }
+    perfQueryGroups += _blockRows;
+    _blockNext = 0;
+    _computeUs += micros() - startUs;
+}
+
 time_t  CSVquery::nextGroup(time_t time, tUnits units, int32_t inc){
     time_t result;
 
@@ -2,7 +2,26 @@
 
 #include "IotaWatt.h"
 
-class  CSVquery {
+#define CSVQUERY_BLOCK 8                        // Groups read and computed together
+#define CSVQUERY_ETAG_GROUPS 2000               // Max groups in a query given an ETag
+#define QUERY_CACHE_ENTRIES 2                   // Query result cache entries (LRU)
+#define QUERY_CACHE_BYTES 4096                  // Heap per cache entry
+#define QUERY_CACHE_IDLE_MS 300000              // Free a cache entry unused this long
+
+struct queryCacheEntry;
+void queryCacheTrim();
+
+        // queryResult is what queryService runs: a response produced a chunk at a time.
+        // readResult returns zero at the end.
+
+class  queryResult {
+
+    public:
+        virtual ~queryResult(){};
+        virtual size_t readResult(uint8_t* buf, int len) = 0;
+};
+
+class  CSVquery : public queryResult {
 
     public:
         CSVquery();
@@ -11,7 +30,9 @@ class  CSVquery {
         size_t  readResult(uint8_t* buf, int len);
         bool    isJson();
         bool    isCSV();
+        bool    isBinary();
         String  failReason();
+        String  etag();
 
     private:
 
@@ -37,13 +58,25 @@ class  CSVquery {
                             tUnitsYears};
 
         enum        format {formatJson,         // Output format
-                            formatCSV}; 
+                            formatCSV,
+                            formatBinary}; 
 
         enum        tformat {iso,
                              unix};
 
-        IotaLogRecord*  _oldRec;                // -> aged logRecord
-        IotaLogRecord*  _newRec;                // -> new logRecord
+        IotaLogRecord*  _oldRec;                // -> start of current group in _block
+        IotaLogRecord*  _newRec;                // -> end of current group in _block
+        IotaLogRecord*  _block;                 // [0] = end of last group, [1..n] = ends of groups in block
+        double*         _blockValues;           // Value vector (CSVQUERY_BLOCK) per value column
+        uint32_t        _blockKeys[CSVQUERY_BLOCK];
+        uint8_t         _blockRows;             // Groups in block
+        uint8_t         _blockRow;              // Group being output
+        uint8_t         _blockNext;             // Next group to output
+        bool            _blockCached;           // _block records past [0] came from cache (not read)
+        queryCacheEntry* _cache;                // Result cache entry for these columns and group
+        uint32_t        _cacheSignature;        // Signature of columns and group
+        uint32_t        _computeUs;             // Time spent reading and computing (perf)
+        uint32_t        _startReads;            // logReadIO() at start (perf)
         xbuf            _buffer;                // work buffer to build response lines
         String          _failReason;            // Error message from constructor
 
@@ -63,6 +96,8 @@ class  CSVquery {
         bool        _missingNull;               // Produce null values when no data
         bool        _missingZero;               // Produce zero values when no data
         bool        _timeOnly;                  // Query is for time only, no data needed    
+        bool        _timeDelta;                 // Binary timestamps as zigzag varint deltas
+        uint32_t    _lastTime;                  // Last binary timestamp (for deltas)
 
         struct column {                         // Output column descriptor - built lifo then made fifo    
                     column* next;               // -> next in chain
@@ -77,6 +112,7 @@ class  CSVquery {
                     bool    delta;              // Output change in value;
                     Script* script;             // -> Script
                     int32_t input;              // input number if source=='I'
+                    int16_t vector;             // Index of value vector in _blockValues
                     column()
                         :next(nullptr)
                         ,lastValue(0)
@@ -86,6 +122,7 @@ class  CSVquery {
                         ,script(nullptr)
                         ,decimals(1)
                         ,input(0)
+                        ,vector(0)
                         {}
                     ~column(){
                         if(source == 'I'){
@@ -100,7 +137,10 @@ class  CSVquery {
                 // Private functions
 
         void        buildHeader();
+        void        fillBlock();
         void        buildLine();
+        void        buildBinaryHeader();
+        void        buildBinaryLine();
         void        printValue(const double value, const int8_t decimals);
         time_t      nextGroup(time_t time, tUnits units, int32_t mult);
         time_t      parseTimeArg(String timeArg);
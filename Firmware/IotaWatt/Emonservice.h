@@ -3,6 +3,10 @@
 #include "IotaWatt.h"
 #include "xbuf.h"
 
+#define EMON_REQDATA_MIN 2500               // Initial and minimum batch size
+#define EMON_REQDATA_MAX 6000               // Maximum batch size (secure send grows it by a third)
+#define EMON_CHECKPOINT "/emon.ckp"         // SPIFFS upload checkpoint
+
 String bin2hex(const uint8_t* in, size_t len);
 String base64encode(const uint8_t* in, size_t len);
 void   base64encode(xbuf*);
@@ -21,6 +25,7 @@ extern char*    EmonUsername;
 extern uint16_t EmonPort;
 extern int16_t  EmonBulkSend;
 extern int32_t  EmonRevision;
+extern uint32_t EmonSignature;                    // Hash of config, identifies checkpoint
 extern uint32_t EmonBeginPosting;
 extern uint8_t  cryptoKey[16];
 enum    EmonSendMode {
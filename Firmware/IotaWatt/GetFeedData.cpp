@@ -48,6 +48,11 @@ uint32_t getFeedData(){ //(struct serviceBlock* _serviceBlock){
 
   static IotaLogRecord* logRecord = nullptr;
   static IotaLogRecord* lastRecord = nullptr;
+  static IotaLogRecord* batch = nullptr;      // Records read ahead with logReadKeys
+  static uint32_t batchKeys[8];
+  static size_t   batchSize = 8;
+  static size_t   batchPos = 0;
+  static size_t   batchCount = 0;
   static size_t   chunkSize = 1600;
   static char* buf = nullptr;
   static size_t bufPos = 0;
@@ -146,6 +151,8 @@ uint32_t getFeedData(){ //(struct serviceBlock* _serviceBlock){
           
       logRecord = new IotaLogRecord;
       lastRecord = new IotaLogRecord;
+      batch = new IotaLogRecord[batchSize];
+      batchPos = batchCount = 0;
      
       if(startUnixTime >= histLog.firstKey()){   
         lastRecord->UNIXtime = startUnixTime - intervalSeconds;
@@ -178,9 +185,16 @@ uint32_t getFeedData(){ //(struct serviceBlock* _serviceBlock){
           // Loop to generate entries
       
       while(UnixTime <= endUnixTime) {
-        int rtc;
-        logRecord->UNIXtime = UnixTime;
-        logReadKey(logRecord);
+        int rtc = 0;
+        if(batchPos >= batchCount){
+          batchCount = 0;
+          for(uint32_t key=UnixTime; batchCount < batchSize && key <= endUnixTime; key += intervalSeconds){
+            batchKeys[batchCount++] = key;
+          }
+          logReadKeys(batchKeys, batch, batchCount);
+          batchPos = 0;
+        }
+        memcpy(logRecord, batch + batchPos++, sizeof(IotaLogRecord));
         trace(T_GFD,2);
         *replyData += '[';  //  + String(UnixTime) + "000,";
         double elapsedHours = logRecord->logHours - lastRecord->logHours;
@@ -287,6 +301,8 @@ uint32_t getFeedData(){ //(struct serviceBlock* _serviceBlock){
       logRecord = nullptr;
       delete lastRecord;
       lastRecord = nullptr;
+      delete[] batch;
+      batch = nullptr;
       state = setup;
       serverAvailable = true;
       return 0;                                       // Done for now, return without scheduling.
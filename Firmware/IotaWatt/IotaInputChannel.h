@@ -44,6 +44,10 @@ class IotaInputChannel {
     float        _vphase;                     // Phase offset for 3-phase voltage reference
     float        _vmult;                      // Voltage multiplier (overides _double)
     float        _lastPhase; 
+    float        _wattsMean;                  // Damped mean of sampled watts
+    float        _wattsVar;                   // Damped variance of sampled watts
+    float        _thd;                        // Damped current THD, 3rd-7th, % of fundamental (powerquality)
+    float        _harmonic[3];                // Damped 3rd, 5th, 7th current harmonics, % of fundamental
     int16_t*     _p50;                        // -> 50Hz phase correction array
     int16_t*     _p60;                        // -> 60Hz phase correction array
     uint16_t     _turns;                      // Turns ratio of current type CT	
@@ -67,6 +71,10 @@ class IotaInputChannel {
     ,_phase(0)
     ,_vphase(0)
     ,_vmult(0)
+    ,_wattsMean(0)
+    ,_wattsVar(0)
+    ,_thd(0)
+    ,_harmonic{0,0,0}
     ,_p50(nullptr)
     ,_p60(nullptr)
     ,_turns(0)
@@ -89,13 +97,14 @@ class IotaInputChannel {
     void    setVoltage(float volts, float Hz);
     void    setVoltage(float volts);
     void    setHz(float Hz);
-    void    setPower(float watts, float VA);	
+    void    setPower(float watts, float VA, int cycles = 1);	
     bool    isActive(){return _active;}
     void    active(bool _active_){_active = _active_;}
     double  getVoltage(){return dataBucket.volts;}	
     double  getPower(){return dataBucket.watts;}
     double  getPf(){return dataBucket.watts / dataBucket.VA;}
     float   getPhase(float var);
+    uint8_t sampleWeight(uint8_t maxCycles);
     float   lookupPhase(int16_t* pArray, float var);
 	
   private:
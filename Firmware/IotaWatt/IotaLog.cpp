@@ -12,6 +12,8 @@ int IotaLog::begin (const char* path ){
   String logPath = String(path) + ".log";
 	_path = new char[logPath.length()+1];
 	strcpy(_path, logPath.c_str());
+	delete[] _metaPath;
+	_metaPath = charstar((String(path) + ".mta").c_str());
   if(!SD.exists(_path)){
 		if(logPath.lastIndexOf('/') > 0){
 			String  dir = logPath.substring(0,logPath.lastIndexOf('/'));
@@ -31,44 +33,70 @@ int IotaLog::begin (const char* path ){
 		return 2;
   }
   
+  if(_version != 1){
+		_maxFileSize = _maxFileSize / _recordSize * sizeof(IotaLogRecord);
+		_version = 1;
+		_recordSize = sizeof(IotaLogRecord);
+		_dataOffset = 0;
+		_columns = IOTALOG_CHANNELS;
+  }
   _fileSize = IotaFile.size();
 
+					// Determine the record format.
+					// A new log is created with the requested format.
+
+  if(_fileSize == 0 && _format == 2){
+		if( ! writeHeader()){
+			return 2;
+		}
+		_fileSize = IotaFile.size();
+  }
   if(_fileSize){
 		IotaFile.seek(0);
 		IotaFile.read((uint8_t*)&record, sizeof(record));
+		if(record.UNIXtime == IOTALOG_MAGIC && ! readHeader()){
+			log("IotaLog: invalid header %s", _path);
+			IotaFile.close();
+			return 2;
+		}
+		_fileSize -= _dataOffset;
+  }
+  if(_fileSize){
+		IotaFile.seek(_dataOffset);
+		IotaFile.read((uint8_t*)&record, sizeof(record));
 		_firstKey = record.UNIXtime;
 		_firstSerial = record.serial;
-		IotaFile.seek(_fileSize - sizeof(IotaLogRecord));
+		IotaFile.seek(_dataOffset + _fileSize - _recordSize);
 		IotaFile.read((uint8_t*)&record, sizeof(record));
 		_lastKey = record.UNIXtime;
 		_lastSerial = record.serial;
-		_entries = _fileSize / sizeof(IotaLogRecord);
+		_entries = _fileSize / _recordSize;
   }
 
 					// If there are trailing zero records at the end,
 					// try to adjust _filesize down to match logical end of file.
 
 	while(_fileSize && _lastSerial == 0){
-		IotaLogRecord* record = new IotaLogRecord;
-		_fileSize -= sizeof(IotaLogRecord);
-		IotaFile.seek(_fileSize - sizeof(IotaLogRecord));
-		IotaFile.read((uint8_t*)record, sizeof(IotaLogRecord));
-		_lastSerial = record->serial;
-		_lastKey = record->UNIXtime;
+		_fileSize -= _recordSize;
+		IotaFile.seek(_dataOffset + _fileSize - _recordSize);
+		IotaFile.read((uint8_t*)&record, sizeof(record));
+		_lastSerial = record.serial;
+		_lastKey = record.UNIXtime;
 		_entries--;	 
-		delete record;
 	}
-	if(_fileSize != IotaFile.size()){
+	if((_dataOffset + _fileSize) != IotaFile.size()){
 		Serial.printf("physical %d, logical %d\r\n", IotaFile.size(), _fileSize);
 	}
 	
   if(_firstKey > _lastKey){
-		_wrap = findWrap(0,_firstKey, _fileSize - sizeof(IotaLogRecord), _lastKey);
-		IotaFile.seek(_wrap);
+		if( ! readMeta()){
+			_wrap = findWrap(0,_firstKey, _fileSize - _recordSize, _lastKey);
+		}
+		IotaFile.seek(_dataOffset + _wrap);
 		IotaFile.read((uint8_t*)&record, sizeof(record));
 		_firstKey = record.UNIXtime;
 		_firstSerial = record.serial;
-		IotaFile.seek(_wrap - sizeof(IotaLogRecord));
+		IotaFile.seek(_dataOffset + _wrap - _recordSize);
 		IotaFile.read((uint8_t*)&record, sizeof(record));
 		_lastKey = record.UNIXtime;
 		_lastSerial = record.serial;
@@ -76,6 +104,10 @@ int IotaLog::begin (const char* path ){
 
   _lastReadKey = _firstKey;
   _lastReadSerial = _firstSerial;
+  _flushedSerial = _lastSerial;
+  _metaSerial = -1;																	// Refresh metadata with the first write
+  _writeCount = 0;
+  clearSectors();
   _maxFileSize = max(_fileSize, _maxFileSize);
   
   if(((int32_t) _lastSerial - _firstSerial + 1) != _entries){
@@ -85,6 +117,7 @@ int IotaLog::begin (const char* path ){
 		log("IotaLog: Deleting %s and restarting.\r\n", _path);	
 		IotaFile.close();
 		SD.remove(_path);
+		msglog.flush();
 		ESP.restart();
 	}
 	
@@ -93,21 +126,410 @@ int IotaLog::begin (const char* path ){
 		_cacheSerial[i] = _firstSerial;
 	}
 
+	if(_version == 2){
+		String keyPath(_path);
+		keyPath.remove(keyPath.lastIndexOf('.'));
+		keyPath += ".kfr";
+		delete[] _keyPath;
+		_keyPath = charstar(keyPath.c_str());
+		if(_entries == 0){
+			SD.remove(_keyPath);
+		}
+		KeyFile = SD.open(_keyPath, FILE_WRITE);
+		if( ! KeyFile){
+			log("IotaLog: keyframe file open failed %s", _keyPath);
+			IotaFile.close();
+			return 2;
+		}
+		if( ! _keyRecord){
+			_keyRecord = new IotaLogKeyFrame;
+		}
+		_keySlot = -1;
+		_keyGroup = -1;
+		_maxFileSize = max(_fileSize, min(_maxFileSize, keyFrameLimit()));
+	}
+
+	if( ! openIndex()){
+		log("IotaLog: index unavailable %s", _indexPath);
+	}
+	recoverRTC();
+
   return 0;
 }
 
+/*******************************************************************************************************
+ * Version 2 header.
+ * writeHeader sizes the record for the active channels and the keyframe ring for the log.
+ * buildColumns lists the active channels, then fills any room left in the record with the 
+ * remaining channels so they can be activated later.  It returns the channels (bitmap) listed.
+ ******************************************************************************************************/
+
+bool IotaLog::writeHeader(){
+	IotaLogHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = IOTALOG_MAGIC;
+	memcpy(header.id, "IotaLog", 7);
+	header.version = 2;
+	header.keyFrame = max(1, 3600 / _interval);
+	uint16_t channels = _formatChannels ? _formatChannels : 0xFFFF;
+	uint8_t columns = 0;
+	for(int i=0; i<IOTALOG_CHANNELS; i++){
+		if(channels & (1 << i)) columns++;
+	}
+	header.recordSize = 64;
+	while((16 + columns * 2 * sizeof(float)) > header.recordSize){
+		header.recordSize *= 2;
+	}
+	_columns = header.columns = min((uint32_t)IOTALOG_CHANNELS, (uint32_t)((header.recordSize - 16) / (2 * sizeof(float))));
+	buildColumns(header.channel);
+	header.keyGroups = (_maxFileSize / sizeof(IotaLogRecord)) / header.keyFrame + 2;
+	uint8_t* sector = new uint8_t[IOTALOG_HEADER_SIZE];
+	memset(sector, 0, IOTALOG_HEADER_SIZE);
+	memcpy(sector, &header, sizeof(header));
+	IotaFile.seek(0);
+	size_t written = IotaFile.write(sector, IOTALOG_HEADER_SIZE);
+	IotaFile.flush();
+	delete[] sector;
+	if(written != IOTALOG_HEADER_SIZE){
+		return false;
+	}
+	log("IotaLog: created compact log %s, %d byte records, %d channels", _path, header.recordSize, header.columns);
+	return true;
+}
+
+uint16_t IotaLog::buildColumns(uint8_t* channel){
+	uint16_t channels = _formatChannels ? _formatChannels : 0xFFFF;
+	uint16_t listed = 0;
+	int columns = 0;
+	for(int i=0; i<IOTALOG_CHANNELS && columns < _columns; i++){
+		if(channels & (1 << i)) channel[columns++] = i;
+	}
+	for(int i=0; i<IOTALOG_CHANNELS && columns < _columns; i++){
+		if( ! (channels & (1 << i))) channel[columns++] = i;
+	}
+	for(int i=0; i<columns; i++){
+		listed |= 1 << channel[i];
+	}
+	return listed;
+}
+
+				// Largest record area that the keyframe ring covers.
+
+uint32_t IotaLog::keyFrameLimit(){
+	return (_keyGroups - 2) * _keyFrame * _recordSize;
+}
+
+bool IotaLog::readHeader(){
+	IotaLogHeader header;
+	IotaFile.seek(0);
+	if(IotaFile.read((uint8_t*)&header, sizeof(header)) != sizeof(header) ||
+	   memcmp(header.id, "IotaLog", 7) != 0 ||
+	   header.version != 2 ||
+		 header.keyFrame == 0 ||
+		 header.keyGroups <= 2 ||
+		 header.columns > IOTALOG_CHANNELS ||
+		 header.recordSize == 0 ||
+	   (IOTALOG_SECTOR_SIZE % header.recordSize) != 0 ||
+	   (16 + header.columns * 2 * sizeof(float)) > header.recordSize){
+		return false;
+	}
+	_maxFileSize = _maxFileSize / _recordSize * header.recordSize;
+	_version = header.version;
+	_recordSize = header.recordSize;
+	_keyFrame = header.keyFrame;
+	_keyGroups = header.keyGroups;
+	_columns = header.columns;
+	_dataOffset = IOTALOG_HEADER_SIZE;
+	return true;
+}
+
+/*******************************************************************************************************
+ * Keyframes.
+ * The keyframe for a record is the full record written first in its group of _keyFrame serials,
+ * or the group's second keyframe when the record is flagged.  The group's pair of slots is at
+ * (serial / _keyFrame) % _keyGroups in the keyframe file.  A slot holds the keyframe of a group
+ * only if the serial of its record is in the group, so slots left from earlier laps are ignored.
+ ******************************************************************************************************/
+
+bool IotaLog::readKeyFrame(int32_t serial, bool second){
+	int32_t group = serial / _keyFrame;
+	int32_t slot = (group % _keyGroups) * 2 + (second ? 1 : 0);
+	if(_keySlot == slot && (_keyRecord->record.serial / _keyFrame) == group){
+		return true;
+	}
+	KeyFile.seek(slot * sizeof(IotaLogKeyFrame));
+	_readKeyIO++;
+	_keySlot = -1;
+	if(KeyFile.read((uint8_t*)_keyRecord, sizeof(IotaLogKeyFrame)) != sizeof(IotaLogKeyFrame) ||
+	   _keyRecord->record.serial < 0 || (_keyRecord->record.serial / _keyFrame) != group){
+		return false;
+	}
+	for(int i=0; i<_columns; i++){
+		if(_keyRecord->channel[i] >= IOTALOG_CHANNELS){
+			return false;
+		}
+	}
+	_keySlot = slot;
+	return true;
+}
+
+bool IotaLog::writeKeyFrame(IotaLogRecord* record, bool second){
+	int32_t slot = ((record->serial / _keyFrame) % _keyGroups) * 2 + (second ? 1 : 0);
+	memcpy(&_keyRecord->record, record, sizeof(IotaLogRecord));
+	memset(_keyRecord->channel, 0, IOTALOG_CHANNELS);
+	buildColumns(_keyRecord->channel);
+	_keyRecord->reserved = 0;
+	_keySlot = -1;
+	KeyFile.seek(slot * sizeof(IotaLogKeyFrame));
+	if(KeyFile.write((uint8_t*)_keyRecord, sizeof(IotaLogKeyFrame)) != sizeof(IotaLogKeyFrame)){
+		return false;
+	}
+	KeyFile.flush();
+	_keySlot = slot;
+	return true;
+}
+
+				// Make _keyRecord the keyframe for a record being written, writing one if 
+				// this is the first record of its group or the active channels have changed.
+				// After a restart, a second keyframe already written for the group is used.
+
+bool IotaLog::writerKeyFrame(IotaLogRecord* record){
+	int32_t group = record->serial / _keyFrame;
+	if(group != _keyGroup){
+		bool second = _keyGroup < 0 && readKeyFrame(record->serial, true);
+		if( ! second && ! readKeyFrame(record->serial, false) && ! writeKeyFrame(record, false)){
+			return false;
+		}
+		_keyGroup = group;
+		_keyForced = second;
+	}
+	else if( ! readKeyFrame(record->serial, _keyForced)){
+		return false;
+	}
+	if( ! _keyForced){
+		uint8_t channel[IOTALOG_CHANNELS];
+		uint16_t listed = 0;
+		for(int i=0; i<_columns; i++){
+			listed |= 1 << _keyRecord->channel[i];
+		}
+		if((buildColumns(channel) ^ listed) & _formatChannels){
+			if( ! writeKeyFrame(record, true)){
+				return readKeyFrame(record->serial, false);
+			}
+			_keyForced = true;
+		}
+	}
+	return true;
+}
+
+void IotaLog::setFormat(uint16_t version, uint16_t channels){
+	_format = version == 2 ? 2 : 1;
+	_formatChannels = channels;
+}
+
+uint16_t IotaLog::version(){return _version;}
+
+/*******************************************************************************************************
+ * Open the index file and verify it describes the log.  The last run in the index must be
+ * contiguous through the end of the log.  If not, rebuild it by bisecting the log for holes.
+ * That takes a few reads per hole.
+ *
+ * Once the log has wrapped, the leading entries are for runs that have been overwritten.
+ * They are skipped with _indexBase, and the file is rewritten without them when what's left
+ * is small.  While running, entries that fall off the start of the log are just ignored by
+ * indexSerial.
+ ******************************************************************************************************/
+
+bool IotaLog::openIndex(){
+	String indexPath(_path);
+	indexPath.remove(indexPath.lastIndexOf('.'));
+	indexPath += ".ndx";
+	delete[] _indexPath;
+	_indexPath = charstar(indexPath.c_str());
+	IndexFile.close();
+	_indexEntries = 0;
+	_indexBase = 0;
+	IndexFile = SD.open(_indexPath, FILE_WRITE);
+	if( ! IndexFile){
+		return false;
+	}
+	_indexEntries = IndexFile.size() / sizeof(IotaLogIndex);
+	if(_entries){
+		pruneIndex();
+	}
+	if(_entries == 0){
+		if(_indexEntries){
+			IndexFile.close();
+			SD.remove(_indexPath);
+			_indexEntries = 0;
+			IndexFile = SD.open(_indexPath, FILE_WRITE);
+		}
+		return (bool)IndexFile;
+	}
+
+	IotaLogIndex first;
+	IotaLogIndex last;
+	first.key = last.key = _firstKey;
+	first.serial = last.serial = _firstSerial;
+	if(_indexEntries){
+		readIndex(0, &first);
+		readIndex(_indexEntries - 1, &last);
+	}
+	if((_indexEntries && first.serial <= _firstSerial) ||
+	   last.serial > _lastSerial ||
+	   (_lastKey - last.key) != (uint32_t)(_lastSerial - last.serial) * _interval){
+		uint32_t startTime = millis();
+		IndexFile.close();
+		SD.remove(_indexPath);
+		IndexFile = SD.open(_indexPath, FILE_WRITE);
+		if( ! IndexFile){
+			return false;
+		}
+		_indexEntries = 0;
+		_indexBase = 0;
+		IotaLogRecord* record = new IotaLogRecord;
+		buildIndex(record, _firstSerial, _firstKey, _lastSerial, _lastKey);
+		delete record;
+		IndexFile.flush();
+		log("IotaLog: index built %s, %d runs, %dms", _indexPath, _indexEntries + 1, millis() - startTime);
+	}
+	return true;
+}
+
+void IotaLog::buildIndex(IotaLogRecord* record, const int32_t lowSerial, const uint32_t lowKey,
+                         const int32_t highSerial, const uint32_t highKey){
+	if((highKey - lowKey) == (uint32_t)(highSerial - lowSerial) * _interval){		// No holes
+		return;
+	}
+	if((highSerial - lowSerial) == 1){
+		writeIndex(highKey, highSerial);
+		return;
+	}
+	int32_t midSerial = (lowSerial + highSerial) / 2;
+	readSerial(record, midSerial);
+	uint32_t midKey = record->UNIXtime;
+	buildIndex(record, lowSerial, lowKey, midSerial, midKey);
+	buildIndex(record, midSerial, midKey, highSerial, highKey);
+}
+
+				// Skip the entries before the first serial.  If few are left, rewrite the file.
+
+void IotaLog::pruneIndex(){
+	int32_t low = -1;
+	int32_t high = _indexEntries;
+	IotaLogIndex index;
+	while((high - low) > 1){
+		int32_t mid = (low + high) / 2;
+		if( ! readIndex(mid, &index)){
+			return;
+		}
+		if(index.serial <= _firstSerial){
+			low = mid;
+		}
+		else {
+			high = mid;
+		}
+	}
+	if(high == 0){
+		return;
+	}
+	_indexBase = high;
+	_indexEntries -= high;
+	if(_indexEntries > IOTALOG_INDEX_PRUNE){
+		return;
+	}
+	IotaLogIndex* keep = new IotaLogIndex[_indexEntries + 1];
+	uint32_t count = 0;
+	while(count < _indexEntries && readIndex(count, keep + count)){
+		count++;
+	}
+	IndexFile.close();
+	SD.remove(_indexPath);
+	IndexFile = SD.open(_indexPath, FILE_WRITE);
+	_indexBase = 0;
+	_indexEntries = 0;
+	if(IndexFile && count){
+		if(IndexFile.write((uint8_t*)keep, count * sizeof(IotaLogIndex)) == count * sizeof(IotaLogIndex)){
+			_indexEntries = count;
+		}
+		IndexFile.flush();
+	}
+	delete[] keep;
+}
+
+bool IotaLog::readIndex(uint32_t entry, IotaLogIndex* index){
+	if(entry >= _indexEntries){
+		return false;
+	}
+	IndexFile.seek((_indexBase + entry) * sizeof(IotaLogIndex));
+	_readKeyIO++;
+	return IndexFile.read((uint8_t*)index, sizeof(IotaLogIndex)) == sizeof(IotaLogIndex);
+}
+
+void IotaLog::writeIndex(uint32_t key, int32_t serial){
+	if( ! IndexFile){
+		return;
+	}
+	IotaLogIndex index;
+	index.key = key;
+	index.serial = serial;
+	IndexFile.seek((_indexBase + _indexEntries) * sizeof(IotaLogIndex));
+	if(IndexFile.write((uint8_t*)&index, sizeof(IotaLogIndex)) == sizeof(IotaLogIndex)){
+		_indexEntries++;
+	}
+}
+
+/*******************************************************************************************************
+ * indexSerial - return the serial of the record with key, or the record before the hole
+ * containing key.  Returns -1 if there is no usable index.
+ ******************************************************************************************************/
+
+int32_t IotaLog::indexSerial(uint32_t key){
+	if( ! IndexFile){
+		return -1;
+	}
+	IotaLogIndex run;
+	run.key = _firstKey;
+	run.serial = _firstSerial;
+	int32_t nextSerial = _lastSerial + 1;
+	int32_t low = -1;													// Binary search for last run starting <= key
+	int32_t high = _indexEntries;
+	IotaLogIndex index;
+	while((high - low) > 1){
+		int32_t mid = (low + high) / 2;
+		if( ! readIndex(mid, &index)){
+			return -1;
+		}
+		if(index.key <= key){
+			low = mid;
+			if(index.serial > _firstSerial){
+				run = index;
+			}
+		}
+		else {
+			high = mid;
+			nextSerial = index.serial;
+		}
+	}
+	int32_t serial = run.serial + (key - run.key) / _interval;
+	if(serial >= nextSerial){												// In a hole
+		serial = nextSerial - 1;
+	}
+	return serial;
+}
+
 uint32_t IotaLog::findWrap(uint32_t highPos, uint32_t highKey, uint32_t lowPos, uint32_t lowKey){
   struct {
 	uint32_t UNIXtime;
 	uint32_t serial; 
   } record;
   
-  if((lowPos - highPos) == sizeof(IotaLogRecord)) {
+  if((lowPos - highPos) == _recordSize) {
 		return lowPos;
   }
   uint32_t midPos = (highPos + lowPos) / 2;
-  midPos += midPos % sizeof(IotaLogRecord);
-  IotaFile.seek(midPos);
+  midPos += midPos % _recordSize;
+  IotaFile.seek(_dataOffset + midPos);
   IotaFile.read((uint8_t*)&record, sizeof(record));
   uint32_t midKey = record.UNIXtime;
   if(midKey > highKey){
@@ -131,6 +553,25 @@ int IotaLog::readKey (IotaLogRecord* callerRecord){
 		if(key = _lastKey) return 0;
 		return 1;
 	}
+
+					// Compute the serial from the index of runs.
+					// If the record doesn't agree, fall back to searching.
+
+					// Accept it only if it's the record with the key, or the record before
+					// the hole that contains the key, which the next record confirms.
+
+	int32_t indexedSerial = indexSerial(key);
+	if(indexedSerial >= 0 && readSerial(callerRecord, indexedSerial) == 0 && callerRecord->UNIXtime <= key){
+		if(callerRecord->UNIXtime == key){
+			return 0;
+		}
+		if(indexedSerial < _lastSerial && readSerial(callerRecord, indexedSerial + 1) == 0 &&
+		   callerRecord->UNIXtime > key && readSerial(callerRecord, indexedSerial) == 0){
+			callerRecord->UNIXtime = key;
+			return 0;
+		}
+	}
+
 	//Serial.printf("search %d, highKey %d\r\n", key, _firstKey);
 	uint32_t lowKey = _firstKey;
 	int32_t lowSerial = _firstSerial;
@@ -164,6 +605,51 @@ int IotaLog::readKey (IotaLogRecord* callerRecord){
 	return 0;
 }
 
+/*******************************************************************************************************
+ * readKeys - read a list of ascending keys into an array of records.
+ * 
+ * Each key is located relative to the record found for the key before it.  Without a hole
+ * in between, that's a direct read of the adjacent serials, which the sector cache turns 
+ * into sequential reads.  When there is a hole, the previous record and the record read
+ * are the bounds for the search.  Returns zero or the last non-zero readKey return.
+ ******************************************************************************************************/
+
+int IotaLog::readKeys(const uint32_t* keys, IotaLogRecord* callerRecords, size_t count){
+	int rtc = 0;
+	int32_t prevSerial = -1;
+	uint32_t prevKey = 0;
+	for(size_t i=0; i<count; i++){
+		IotaLogRecord* callerRecord = callerRecords + i;
+		uint32_t key = keys[i] - (keys[i] % _interval);
+		bool found = false;
+		if(prevSerial >= 0 && key > prevKey && key < _lastKey){
+			int32_t serial = min(_lastSerial, prevSerial + (int32_t)((key - prevKey) / _interval));
+			if(readSerial(callerRecord, serial) == 0){
+				if(callerRecord->UNIXtime == key){
+					found = true;
+				}
+				else if(callerRecord->UNIXtime > key){
+					searchKey(callerRecord, key, prevKey, prevSerial, callerRecord->UNIXtime, callerRecord->serial);
+					found = true;
+				}
+			}
+		}
+		if(found){
+			callerRecord->UNIXtime = key;
+		}
+		else {
+			callerRecord->UNIXtime = key;
+			int readRtc = readKey(callerRecord);
+			if(readRtc){
+				rtc = readRtc;
+			}
+		}
+		prevSerial = _lastReadSerial;
+		prevKey = _lastReadKey;
+	}
+	return rtc;
+}
+
 void IotaLog::searchKey(IotaLogRecord* callerRecord, const uint32_t key, const uint32_t lowKey, const int32_t lowSerial, const uint32_t highKey, const int32_t highSerial){
 
   int32_t floorSerial = max(lowSerial, highSerial - (int32_t)((highKey - key) / _interval));
@@ -193,7 +679,6 @@ void IotaLog::searchKey(IotaLogRecord* callerRecord, const uint32_t key, const u
 		return;
   }
   readSerial(callerRecord, (lowSerial + highSerial) / 2);
-  _readKeyIO++;
   if(callerRecord->UNIXtime == key){
 		return;
   }
@@ -205,6 +690,52 @@ void IotaLog::searchKey(IotaLogRecord* callerRecord, const uint32_t key, const u
   return;
 }
 
+/*******************************************************************************************************
+ * IotaLogCursor::read - read the record for key, as readKey would.
+ ******************************************************************************************************/
+
+int IotaLogCursor::read(IotaLogRecord* callerRecord, uint32_t key){
+	uint32_t interval = _log->interval();
+	key -= key % interval;
+	bool positioned = _serial >= _log->firstSerial() && _serial <= _log->lastSerial();
+	if( ! positioned || key < _key || key >= _log->lastKey()){
+		callerRecord->UNIXtime = key;
+		int rtc = _log->readKey(callerRecord);
+		if(rtc == 0 && key < _log->lastKey()){
+			_serial = callerRecord->serial;
+			_key = key;
+			_recKey = key;
+			if(_log->readSerial(callerRecord, _serial) == 0){
+				_recKey = callerRecord->UNIXtime;
+			}
+			callerRecord->UNIXtime = key;
+		}
+		return rtc;
+	}
+
+					// Without a hole, the record is (key - recKey) / interval ahead.
+					// If that record is beyond the key, there's a hole in between, 
+					// so step forward to the last record at or before the key.
+
+	int32_t serial = min(_log->lastSerial(), _serial + (int32_t)((key - _recKey) / interval));
+	if(_log->readSerial(callerRecord, serial) != 0 || callerRecord->UNIXtime > key){
+		serial = _serial;
+		_log->readSerial(callerRecord, serial);
+		while(serial < _log->lastSerial()){
+			if(_log->readSerial(callerRecord, serial + 1) != 0 || callerRecord->UNIXtime > key){
+				break;
+			}
+			serial++;
+		}
+		_log->readSerial(callerRecord, serial);
+	}
+	_serial = serial;
+	_recKey = callerRecord->UNIXtime;
+	_key = key;
+	callerRecord->UNIXtime = key;
+	return 0;
+}
+
 int IotaLog::readNext(IotaLogRecord* callerRecord){
   if(!IotaFile) return 2;
   if(callerRecord->serial == _lastSerial) return 1;
@@ -212,7 +743,13 @@ int IotaLog::readNext(IotaLogRecord* callerRecord){
 }
 
 int IotaLog::end(){
+  flush();
+  _metaSerial = -1;
+  writeMeta(_wrap ? _wrap : _fileSize);
   IotaFile.close();
+  IndexFile.close();
+  KeyFile.close();
+  clearSectors();
   return 0;
 }
 
@@ -227,11 +764,15 @@ uint32_t IotaLog::lastKey(){return _lastKey;}
 int32_t IotaLog::lastSerial(){return _lastSerial;}
 uint32_t IotaLog::fileSize(){return _fileSize;}
 uint32_t IotaLog::readKeyIO(){return _readKeyIO;}
+uint32_t IotaLog::readKeyHits(){return _readKeyHits;}
 uint32_t IotaLog::interval(){return _interval;}
 
 uint32_t IotaLog::setDays(uint32_t days){
 	_maxFileSize = max(_fileSize, (uint32_t)(days * _recordSize * (86400UL / _interval)));
 	_maxFileSize = max(_maxFileSize, (uint32_t)(_recordSize * (3600UL / _interval)));
+	if(_version == 2){
+		_maxFileSize = max(_fileSize, min(_maxFileSize, keyFrameLimit()));
+	}
 	return _maxFileSize / (_recordSize * (86400 / _interval));
 }
   
@@ -239,14 +780,126 @@ int IotaLog::readSerial(IotaLogRecord* callerRecord, int32_t serial){
   if(serial < _firstSerial || serial > _lastSerial){
 		return 1;
   }
-  IotaFile.seek(((serial - _firstSerial) * sizeof(IotaLogRecord) + _wrap) % _fileSize);
-	IotaFile.read((uint8_t*)callerRecord, sizeof(IotaLogRecord));
+	uint8_t* data;
+	if(serial > _flushedSerial){
+		data = _writeBuf + (serial - _flushedSerial - 1) * _recordSize;		// Still in write-behind buffer
+	}
+	else {
+		uint32_t filePos = _dataOffset + ((serial - _firstSerial) * _recordSize + _wrap) % _fileSize;
+		IotaLogSector* sector = getSector(filePos - (filePos % IOTALOG_SECTOR_SIZE), serial == (_scanSerial + 1));
+		_scanSerial = serial;
+		if( ! sector){
+			return 2;
+		}
+		data = sector->data + (filePos % IOTALOG_SECTOR_SIZE);
+	}
+	if(_version == 1){
+		memcpy(callerRecord, data, sizeof(IotaLogRecord));
+	}
+	else {
+		IotaLogCompact* compact = (IotaLogCompact*)data;
+		if( ! readKeyFrame(compact->serial, compact->reserved & 1)){
+			return 2;
+		}
+		memcpy(callerRecord, &_keyRecord->record, sizeof(IotaLogRecord));
+		callerRecord->UNIXtime = compact->UNIXtime;
+		callerRecord->serial = compact->serial;
+		callerRecord->logHours += compact->logHours;
+		for(int i=0; i<_columns; i++){
+			uint8_t channel = _keyRecord->channel[i];
+			callerRecord->accum1[channel] += compact->accum[i][0];
+			callerRecord->accum2[channel] += compact->accum[i][1];
+		}
+	}
 	_cacheKey[_cacheWrap] = callerRecord->UNIXtime;
 	_cacheSerial[_cacheWrap++] = callerRecord->serial;
 	_cacheWrap %= _cacheSize;
-	_readKeyIO++;
+	_lastReadKey = callerRecord->UNIXtime;
+	_lastReadSerial = callerRecord->serial;
   return 0;
 };
+
+/*******************************************************************************************************
+ * Sector cache.
+ * getSector returns the cached sector at pos, reading it from the file on a miss.
+ * When readAhead is set, the following sectors are read into the cache with the same seek.
+ ******************************************************************************************************/
+
+IotaLogSector* IotaLog::getSector(uint32_t pos, bool readAhead){
+	IotaLogSector* sector = findSector(pos);
+	if(sector){
+		sector->used = ++_sectorSeq;
+		_readKeyHits++;
+		return sector;
+	}
+	if( ! _sectors){
+		_sectors = new IotaLogSector[_cacheSectors];
+	}
+	int count = readAhead ? min(IOTALOG_READ_AHEAD, (int)_cacheSectors) : 1;
+	uint32_t fileEnd = IotaFile.size();										// Excludes write-behind records
+	IotaFile.seek(pos);
+	for(int i=0; i<count; i++){
+		uint32_t readPos = pos + i * IOTALOG_SECTOR_SIZE;
+		if(readPos >= fileEnd || (i && findSector(readPos))){
+			break;
+		}
+		IotaLogSector* lru = _sectors;
+		for(int j=1; j<_cacheSectors; j++){
+			if(_sectors[j].used < lru->used) lru = &_sectors[j];
+		}
+		lru->pos = readPos;
+		lru->len = IotaFile.read(lru->data, min((uint32_t)IOTALOG_SECTOR_SIZE, fileEnd - readPos));
+		lru->used = ++_sectorSeq;
+		_readKeyIO++;
+		if(i == 0){
+			sector = lru;
+		}
+	}
+	if( ! sector){
+		return nullptr;
+	}
+	if(sector->len < min((uint32_t)IOTALOG_SECTOR_SIZE, fileEnd - pos)){		// Short read
+		sector->len = 0;
+		return nullptr;
+	}
+	return sector;
+}
+
+IotaLogSector* IotaLog::findSector(uint32_t pos){
+	if( ! _sectors){
+		return nullptr;
+	}
+	for(int i=0; i<_cacheSectors; i++){
+		if(_sectors[i].len && _sectors[i].pos == pos){
+			return &_sectors[i];
+		}
+	}
+	return nullptr;
+}
+
+				// Keep any cached copy of a sector current with data written to the file.
+
+void IotaLog::updateSector(uint32_t pos, const uint8_t* data, uint16_t len){
+	uint32_t offset = pos % IOTALOG_SECTOR_SIZE;
+	IotaLogSector* sector = findSector(pos - offset);
+	if(sector){
+		if(offset > sector->len){
+			sector->len = 0;
+			return;
+		}
+		memcpy(sector->data + offset, data, len);
+		sector->len = max(sector->len, (uint16_t)(offset + len));
+	}
+}
+
+void IotaLog::clearSectors(){
+	for(int i=0; _sectors && i<_cacheSectors; i++){
+		_sectors[i].len = 0;
+		_sectors[i].used = 0;
+	}
+	_sectorSeq = 0;
+	_scanSerial = -1;
+}
    
 int IotaLog::write (IotaLogRecord* callerRecord){
 
@@ -256,35 +909,287 @@ int IotaLog::write (IotaLogRecord* callerRecord){
   if(callerRecord->UNIXtime <= _lastKey) {
 		return 1;
   }
+  if(_lastKey && callerRecord->UNIXtime != _lastKey + _interval){		// Start of a new run
+		writeIndex(callerRecord->UNIXtime, _lastSerial + 1);
+		IndexFile.flush();
+  }
   callerRecord->serial = ++_lastSerial;
+
+					// Version 2 records are deltas from the keyframe.
+					// The first record written in a group becomes the keyframe.
+
+  uint8_t* data = (uint8_t*)callerRecord;
+  IotaLogCompact compact;
+  if(_version == 2){
+		if( ! writerKeyFrame(callerRecord)){
+			_lastSerial--;
+			return 2;
+		}
+		IotaLogRecord* key = &_keyRecord->record;
+		memset(&compact, 0, sizeof(compact));
+		compact.UNIXtime = callerRecord->UNIXtime;
+		compact.serial = callerRecord->serial;
+		compact.logHours = callerRecord->logHours - key->logHours;
+		compact.reserved = _keyForced ? 1 : 0;
+		for(int i=0; i<_columns; i++){
+			uint8_t channel = _keyRecord->channel[i];
+			compact.accum[i][0] = callerRecord->accum1[channel] - key->accum1[channel];
+			compact.accum[i][1] = callerRecord->accum2[channel] - key->accum2[channel];
+		}
+		data = (uint8_t*)&compact;
+  }
+
+  uint32_t writePos;
   if(_wrap || _fileSize >= _maxFileSize){
-		IotaFile.seek(_wrap);
-		_wrap = (_wrap + sizeof(IotaLogRecord)) % _fileSize;
+		writePos = _wrap;
+		_wrap = (_wrap + _recordSize) % _fileSize;
   }
   else {
-		IotaFile.seek(_fileSize);
-		_fileSize += sizeof(IotaLogRecord);
+		writePos = _fileSize;
+		_fileSize += _recordSize;
 		_entries++;
   }
-  IotaFile.write((char*)callerRecord, sizeof(IotaLogRecord));
-  IotaFile.flush();
+
+					// Write through, or add to the write-behind buffer.
+					// The buffer is written when full, when it would no longer be contiguous,
+					// or when at least half full and it ends on a sector boundary.
+
+  if(_writeMax == 0){
+		IotaFile.seek(_dataOffset + writePos);
+		IotaFile.write(data, _recordSize);
+		IotaFile.flush();
+		updateSector(_dataOffset + writePos, data, _recordSize);
+		_flushedSerial = callerRecord->serial;
+		writeMeta(writePos + _recordSize);
+  }
+  else {
+		if(_writeCount && writePos != (_writeStart + _writeCount * _recordSize)){
+			flush();
+		}
+		if(_writeCount == 0){
+			_writeStart = writePos;
+		}
+		memcpy(_writeBuf + _writeCount++ * _recordSize, data, _recordSize);
+		if((_writeCount % max(1, _writeMax / 2)) == 0){
+			saveRTC(callerRecord);
+		}
+		uint32_t endPos = _dataOffset + writePos + _recordSize;
+		if(_writeCount >= _writeMax || (_writeCount * 2 >= _writeMax && (endPos % IOTALOG_SECTOR_SIZE) == 0)){
+			flush();
+		}
+  }
   _lastKey = callerRecord->UNIXtime;
   _lastSerial = callerRecord->serial;
+
+					// After a wrap, the first record is the one now at _wrap.
+					// It's read through the sector cache, so successive wraps
+					// are satisfied from the read-ahead sectors.
+
   if(_firstKey == 0){
 		_firstKey = callerRecord->UNIXtime;
+		_firstSerial = callerRecord->serial;
   }
   else if(_wrap || _fileSize == _maxFileSize){
-		IotaFile.seek(_wrap);
-		IotaFile.read((uint8_t*)callerRecord,8);
-		_firstKey = callerRecord->UNIXtime;
-		_firstSerial = callerRecord->serial;
-		callerRecord->UNIXtime = _lastKey;
-		callerRecord->serial = _lastSerial;
+		uint32_t pos = _dataOffset + _wrap;
+		IotaLogSector* sector = getSector(pos - (pos % IOTALOG_SECTOR_SIZE), true);
+		if(sector){
+			IotaLogRecord* first = (IotaLogRecord*)(sector->data + (pos % IOTALOG_SECTOR_SIZE));
+			_firstKey = first->UNIXtime;
+			_firstSerial = first->serial;
+		}
+		else {
+			_firstKey += _interval;
+			_firstSerial++;
+		}
   }
   
   return 0;
 }
 
+/*******************************************************************************************************
+ * Write-behind buffer.
+ * flush writes the waiting records to the file as one batch and updates the sector cache.
+ ******************************************************************************************************/
+
+void IotaLog::setWriteBehind(uint8_t records, uint16_t rtcWord){
+	flush();
+	delete[] _writeBuf;
+	_writeBuf = nullptr;
+	_writeMax = records;
+	if(_writeMax){
+		_writeBuf = new uint8_t[_writeMax * sizeof(IotaLogRecord)];
+	}
+	_rtcWord = (rtcWord && (rtcWord + sizeof(IotaLogRecord) / 4) <= 96) ? rtcWord : 0;
+}
+
+int IotaLog::flush(){
+	if(_writeCount == 0){
+		return 0;
+	}
+	IotaFile.seek(_dataOffset + _writeStart);
+	size_t len = _writeCount * _recordSize;
+	size_t written = IotaFile.write(_writeBuf, len);
+	IotaFile.flush();
+	for(int i=0; i<_writeCount; i++){
+		updateSector(_dataOffset + _writeStart + i * _recordSize, _writeBuf + i * _recordSize, _recordSize);
+	}
+	_flushedSerial += _writeCount;
+	_writeCount = 0;
+	writeMeta(_writeStart + len);
+	if(_rtcWord){
+		WRITE_PERI_REG(RTC_USER_MEM + _rtcWord, 0);
+	}
+	if(written != len){
+		log("IotaLog: write failed %s", _path);
+		return 2;
+	}
+	return 0;
+}
+
+/*******************************************************************************************************
+ * Metadata.
+ * writeMeta records the end of the last physical write, which is the wrap once the file is full.
+ * readMeta confirms the wrap with the record before it, then moves it forward over any records
+ * written after the metadata, which follow in serial order.  That is normally less than
+ * IOTALOG_META_INTERVAL of records, so the end of them is found by bisecting that range, 
+ * a few reads.  If the whole range follows, the metadata is stale (not updated for a long 
+ * run without end), and findWrap is used instead.
+ ******************************************************************************************************/
+
+void IotaLog::writeMeta(uint32_t endPos){
+	if( ! _metaPath || ! (_wrap || _fileSize >= _maxFileSize)){
+		return;
+	}
+	if(_metaSerial >= 0 && (_flushedSerial - _metaSerial) < max(1, IOTALOG_META_INTERVAL / _interval)){
+		return;
+	}
+	IotaLogMeta meta;
+	meta.fileSize = _fileSize;
+	meta.wrap = endPos % _fileSize;
+	meta.lastSerial = _flushedSerial;
+	meta.recordSize = _recordSize;
+	meta.version = _version;
+	meta.checksum = metaChecksum(&meta);
+	File metaFile = SD.open(_metaPath, FILE_WRITE);
+	if(metaFile){
+		metaFile.seek(0);
+		metaFile.write((uint8_t*)&meta, sizeof(meta));
+		metaFile.close();
+		_metaSerial = _flushedSerial;
+	}
+}
+
+bool IotaLog::readMeta(){
+	struct {
+		uint32_t UNIXtime;
+		int32_t serial; 
+	} record;
+	IotaLogMeta meta;
+	File metaFile = SD.open(_metaPath, FILE_READ);
+	if( ! metaFile){
+		return false;
+	}
+	size_t len = metaFile.read((uint8_t*)&meta, sizeof(meta));
+	metaFile.close();
+	if(len != sizeof(meta) ||
+	   meta.checksum != metaChecksum(&meta) ||
+		 meta.fileSize != _fileSize ||
+		 meta.recordSize != _recordSize ||
+		 meta.version != _version ||
+		 (meta.wrap % _recordSize) != 0){
+		return false;
+	}
+	IotaFile.seek(_dataOffset + (meta.wrap + _fileSize - _recordSize) % _fileSize);
+	IotaFile.read((uint8_t*)&record, sizeof(record));
+	if(record.serial != meta.lastSerial){
+		return false;
+	}
+	uint32_t limit = MIN(IOTALOG_META_INTERVAL / _interval + IOTALOG_META_SLACK, _entries - 1);
+	if(metaFollows(meta.wrap, limit, meta.lastSerial)){			// Stale, findWrap is quicker
+		return false;
+	}
+	uint32_t low = 0;													// First record that may not follow
+	uint32_t high = limit;												// Known not to follow
+	while(low < high){
+		uint32_t mid = (low + high) / 2;
+		if(metaFollows(meta.wrap, mid, meta.lastSerial)){
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	uint32_t wrap = (meta.wrap + low * _recordSize) % _fileSize;
+	if(wrap == 0){													// Not wrapped after all
+		return false;
+	}
+	_wrap = wrap;
+	return true;
+}
+
+				// True if the record offset records after the metadata wrap was written 
+				// since, that is has the serial offset after the metadata's last.
+
+bool IotaLog::metaFollows(uint32_t wrap, uint32_t offset, int32_t serial){
+	struct {
+		uint32_t UNIXtime;
+		int32_t serial; 
+	} record;
+	IotaFile.seek(_dataOffset + (wrap + offset * _recordSize) % _fileSize);
+	IotaFile.read((uint8_t*)&record, sizeof(record));
+	return record.serial == serial + 1 + (int32_t)offset;
+}
+
+uint32_t IotaLog::metaChecksum(IotaLogMeta* meta){
+	uint32_t* word = (uint32_t*)meta;
+	uint32_t checksum = 0x10ca;
+	for(int i=0; i<(sizeof(IotaLogMeta) / 4 - 1); i++){
+		checksum = ((checksum << 5) | (checksum >> 27)) ^ word[i];
+	}
+	return checksum;
+}
+
+				// Keep a waiting record in RTC user memory for a warm restart.
+
+void IotaLog::saveRTC(IotaLogRecord* record){
+	if( ! _rtcWord){
+		return;
+	}
+	uint32_t* word = (uint32_t*)record;
+	for(int i=sizeof(IotaLogRecord)/4-1; i>=0; i--){				// UNIXtime (word 0) is last, marks valid
+		WRITE_PERI_REG(RTC_USER_MEM + _rtcWord + i, word[i]);
+	}
+}
+
+				// At begin, append a record from RTC memory that was never written to the file.
+				// It must be a plausible successor to the last record in the file.
+
+void IotaLog::recoverRTC(){
+	if( ! _rtcWord){
+		return;
+	}
+	IotaLogRecord* pending = new IotaLogRecord;
+	uint32_t* word = (uint32_t*)pending;
+	for(int i=0; i<sizeof(IotaLogRecord)/4; i++){
+		word[i] = READ_PERI_REG(RTC_USER_MEM + _rtcWord + i);
+	}
+	WRITE_PERI_REG(RTC_USER_MEM + _rtcWord, 0);
+	int32_t lost = pending->serial - _lastSerial;
+	if(pending->UNIXtime > _lastKey &&
+	   pending->UNIXtime <= UTCtime() &&
+	   (pending->UNIXtime % _interval) == 0 &&
+	   lost > 0 && lost <= _writeMax &&
+		 (pending->UNIXtime - _lastKey) >= (uint32_t)(lost * _interval) &&
+		 pending->logHours >= 0){
+		uint8_t writeMax = _writeMax;
+		_writeMax = 0;
+		if(write(pending) == 0){
+			log("IotaLog: recovered %s, %d unwritten intervals merged.", _path, lost);
+		}
+		_writeMax = writeMax;
+	}
+	delete pending;
+}
+
 void IotaLog::dumpFile(){
 	setLedCycle(LED_DUMPING_LOG);
 	char diagPath[] = "iotaWatt/logDiag.txt";
@@ -297,7 +1202,7 @@ void IotaLog::dumpFile(){
 		IotaFile.size(), _entries);
 		logDiag.close();
 	}
-	IotaFile.seek(0);
+	IotaFile.seek(_dataOffset);
 	IotaFile.read((uint8_t*)&record,sizeof(record));
   uint32_t begKey = record.UNIXtime;
   uint32_t begSerial = record.serial;
@@ -306,14 +1211,14 @@ void IotaLog::dumpFile(){
   uint32_t filePos = 0;
   do {
 		filePos += _recordSize;
-		IotaFile.seek(filePos);
+		IotaFile.seek(_dataOffset + filePos);
 		IotaFile.read((uint8_t*)&record,sizeof(record));
 		if(record.UNIXtime - endKey != _interval || record.serial - endSerial != 1 || filePos >= _fileSize){
 			Serial.printf_P(PSTR("%d,%d,%d,%d\r\n"), begKey, begSerial, endKey, endSerial);
 			logDiag = SD.open(diagPath, FILE_WRITE);
 			if(logDiag){
 				logDiag.printf_P(PSTR("%d,%d,%d,%d\r\n"), begKey, begSerial, endKey, endSerial);
-				if(filePos >= IotaFile.size()){
+				if((_dataOffset + filePos) >= IotaFile.size()){
 					logDiag.printf_P(PSTR("End of file\r\n"));
 				}
 				logDiag.close();
@@ -323,6 +1228,7 @@ void IotaLog::dumpFile(){
 		}
 		endKey = record.UNIXtime;
 		endSerial = record.serial;
-	} while(filePos < IotaFile.size());
+		dispatchCheckpoint();
+	} while((_dataOffset + filePos) < IotaFile.size());
 	endLedCycle();
 }
@@ -7,6 +7,9 @@
 #define IotaLog_h
 #include "SPI.h"
 #include "SD.h"
+#include "memPool.h"
+
+extern memPool logRecordPool;               // IotaLogRecords are allocated from this pool
 
 /*******************************************************************************************************
 ********************************************************************************************************
@@ -27,20 +30,162 @@ struct IotaLogRecord {
       :UNIXtime(0)
       ,serial(0)
       ,logHours(0){};
+      static void* operator new(size_t size){return logRecordPool.alloc(size);}
+      static void  operator delete(void* ptr){logRecordPool.free(ptr);}
     };    
 
+/*******************************************************************************************************
+ * Records are read through a small LRU cache of whole SD sectors.  Two records fit in a sector,
+ * and when readSerial sees a forward scan it reads ahead the following sectors with one seek.
+ * Writes update any cached copy of the sector so the cache never goes stale.
+ ******************************************************************************************************/
+
+#define IOTALOG_SECTOR_SIZE 512             // SD sector size
+#define IOTALOG_CACHE_SECTORS 3             // Default sectors in LRU cache
+#define IOTALOG_READ_AHEAD 2                // Sectors read on a forward scan miss
+
+struct IotaLogSector {
+      uint32_t pos;                         // File offset of sector
+      uint32_t used;                        // LRU sequence
+      uint16_t len;                         // Valid bytes (0 = empty)
+      uint8_t  data[IOTALOG_SECTOR_SIZE];
+      IotaLogSector()
+      :pos(0)
+      ,used(0)
+      ,len(0){};
+    };
+
+/*******************************************************************************************************
+ * Version 2 (compact) logs begin with a one sector header and hold a fixed number of channel
+ * columns.  Accumulators are stored as float deltas from a full keyframe record that is kept
+ * in a companion file (.kfr) for each hour (keyFrame records) of records.  Each keyframe also
+ * lists the channel in each column of the records that follow it, active channels first.
+ * readSerial expands compact records to the full IotaLogRecord, so callers don't know the
+ * difference.  Version 1 logs are the original full 256 byte records with no header.
+ *
+ * The keyframe file is a ring of keyGroups slot pairs, enough for every group of keyFrame
+ * serials the log can hold, so it wraps with the log.  The first slot of a pair is the 
+ * keyframe written at the start of the group.  When a channel becomes active that isn't in 
+ * its columns, a second keyframe with the new columns is written in the other slot, and 
+ * the rest of the group's records, flagged in reserved, are relative to that one.
+ ******************************************************************************************************/
+
+#define IOTALOG_MAGIC 0xFFFFFFFF            // First word of a versioned log (never a valid key)
+#define IOTALOG_HEADER_SIZE 512             // Header occupies first sector
+#define IOTALOG_CHANNELS 15                 // Channels in IotaLogRecord
+
+struct IotaLogHeader {
+      uint32_t magic;                       // IOTALOG_MAGIC
+      char     id[8];                       // "IotaLog"
+      uint16_t version;                     // Record format version
+      uint16_t recordSize;                  // Size of a record in the file
+      uint16_t keyFrame;                    // Records per keyframe
+      uint8_t  columns;                     // Number of channel columns in a record
+      uint8_t  channel[IOTALOG_CHANNELS];   // Channel in each column of first keyframe
+      uint32_t keyGroups;                   // Keyframe groups in keyframe file ring
+    };
+
+struct IotaLogCompact {
+      uint32_t UNIXtime;                    // Time period represented by this record
+      int32_t  serial;                      // record number in file
+      float    logHours;                    // logHours - keyframe logHours
+      uint32_t reserved;                    // 1 = relative to the group's second keyframe
+      float    accum[IOTALOG_CHANNELS][2];  // accum1, accum2 - keyframe for each column
+    };
+
+struct IotaLogKeyFrame {
+      IotaLogRecord record;                 // Full record
+      uint8_t  channel[IOTALOG_CHANNELS];   // Channel in each column of records relative to it
+      uint8_t  reserved;
+    };
+
+/*******************************************************************************************************
+ * The log can have holes where IoTaWatt was not running.  A companion index file (.ndx) holds
+ * the key and serial of the first record of each contiguous run after the first, so readKey
+ * can compute the serial of any key directly instead of searching.
+ ******************************************************************************************************/
+
+#define IOTALOG_INDEX_PRUNE 64              // Rewrite index without overwritten runs when this few remain
+
+struct IotaLogIndex {
+      uint32_t key;                         // Key of first record in run
+      int32_t  serial;                      // Serial of...
+    };
+
+/*******************************************************************************************************
+ * Write-behind.  setWriteBehind(n) holds up to n records in RAM and writes them to the file as
+ * one batch, ending on a sector boundary when possible, instead of a seek/write/flush per record.
+ * Records waiting to be written are read back from the buffer, so readers don't know the difference.
+ * When an rtcWord is given, a recent waiting record is also kept in RTC user memory, which
+ * survives a warm restart (exception, watchdog, ESP.restart) but not a loss of power, so it
+ * doesn't help after powerFailRestart.  It's saved once per half buffer, not at every write.
+ * begin() appends it if it is newer than the end of the file. Since the accumulators are
+ * running totals, only the resolution of the records in between is lost.
+ * RTC user memory words 0-31 belong to eboot and 96-127 to trace(), so words 32-95 are used.
+ ******************************************************************************************************/
+
+#define IOTALOG_RTC_WORD 32                 // RTC user memory word of pending record backup
+
+/*******************************************************************************************************
+ * Once the log has wrapped, a small metadata file (.mta) records where the wrap is, so begin()
+ * can confirm it with one read instead of a binary search of the whole file with findWrap.
+ * It's rewritten every IOTALOG_META_INTERVAL seconds of records and at end().  begin() finds
+ * the end of any records written since by bisection, and falls back to findWrap on any mismatch
+ * or when there are more of those than one interval and some slack.
+ ******************************************************************************************************/
+
+#define IOTALOG_META_INTERVAL 600           // Seconds of records between metadata updates
+#define IOTALOG_META_SLACK 64               // Records beyond an interval to roll forward before findWrap
+
+struct IotaLogMeta {
+      uint32_t fileSize;                    // Size of record area
+      uint32_t wrap;                        // Offset of logical record zero
+      int32_t  lastSerial;                  // Serial of record before wrap
+      uint16_t recordSize;                  // Size of a record
+      uint16_t version;                     // Record format version
+      uint32_t checksum;                    // Checksum of the above
+    };
+
 class IotaLog
 {
   public:
 
-	IotaLog(int interval=5, uint32_t days = 365) {
+	IotaLog(int interval=5, uint32_t days = 365, uint8_t cacheSectors = IOTALOG_CACHE_SECTORS) {
     _path = nullptr;
+    _indexPath = nullptr;
+    _keyPath = nullptr;
+    _metaPath = nullptr;
+    _metaSerial = 0;
+    _keyRecord = nullptr;
+    _format = 1;
+    _formatChannels = 0;
+    _version = 1;
+    _dataOffset = 0;
+    _keyFrame = 0;
+    _keyGroups = 0;
+    _keySlot = -1;
+    _keyGroup = -1;
+    _keyForced = false;
+    _columns = IOTALOG_CHANNELS;
+    _indexEntries = 0;
+    _indexBase = 0;
 		_interval = interval;
 		_recordSize = sizeof(IotaLogRecord);
     _fileSize = 0;
 		_lastReadKey = 0;
 		_lastReadSerial = 0;
 		_readKeyIO = 0;
+		_readKeyHits = 0;
+		_scanSerial = -1;
+		_sectorSeq = 0;
+		_cacheSectors = max((uint8_t)1, cacheSectors);
+		_sectors = nullptr;
+		_writeBuf = nullptr;
+		_writeMax = 0;
+		_writeCount = 0;
+		_writeStart = 0;
+		_flushedSerial = -1;
+		_rtcWord = 0;
 		_wrap = 0;
 		_firstKey = 0;
 		_firstSerial = 0;
@@ -56,16 +201,26 @@ class IotaLog
 	
 	~IotaLog(){
     IotaFile.close();
+    IndexFile.close();
+    KeyFile.close();
     delete[] _path;
+    delete[] _indexPath;
+    delete[] _keyPath;
+    delete[] _metaPath;
+    delete _keyRecord;
     delete[] _cacheKey;
     delete[] _cacheSerial;
+    delete[] _sectors;
+    delete[] _writeBuf;
 	}
 	      
     int begin (const char* /* filepath */);
     int write (IotaLogRecord* /* pointer to record to be written*/);
     int readKey (IotaLogRecord* /* pointer to caller's buffer */);
+    int readKeys(const uint32_t* keys, IotaLogRecord* callerRecords, size_t count);
     int readSerial(IotaLogRecord* callerRecord, int32_t serial); 
     int readNext(IotaLogRecord* /* pointer to caller's buffer */);
+    int flush();
     int end();
     
     boolean  isOpen();
@@ -75,16 +230,40 @@ class IotaLog
     int32_t  lastSerial();
     uint32_t fileSize();
     uint32_t readKeyIO();
+    uint32_t readKeyHits();
     uint32_t interval();
     uint32_t setDays(uint32_t); 
+    void     setFormat(uint16_t version, uint16_t channels);
+    void     setChannels(uint16_t channels){_formatChannels = channels;}
+    uint16_t version();
+    void     setWriteBehind(uint8_t records, uint16_t rtcWord = 0);
 	 	      
     void     dumpFile();
 
   private:
         
 	  File 	 IotaFile;
+    File     IndexFile;                     // Index of contiguous runs
+    File     KeyFile;                       // Keyframes of version 2 log
 
     char*    _path;                         // file pathname
+    char*    _indexPath;                    // index file pathname
+    uint32_t _indexEntries;                 // Number of entries in index file (after _indexBase)
+    uint32_t _indexBase;                    // Leading entries for runs no longer in the log
+    char*    _keyPath;                      // keyframe file pathname
+    char*    _metaPath;                     // metadata file pathname
+    int32_t  _metaSerial;                   // Last serial when metadata written
+    uint16_t _format;                       // Version to use when creating a new log
+    uint16_t _formatChannels;               // Active channels (bitmap), first in version 2 columns
+    uint16_t _version;                      // Record format version of this log
+    uint16_t _dataOffset;                   // Offset of first record (header size)
+    uint16_t _keyFrame;                     // Records per keyframe
+    uint8_t  _columns;                      // Channel columns in version 2 records
+    uint32_t _keyGroups;                    // Keyframe groups in keyframe file ring
+    IotaLogKeyFrame* _keyRecord;            // Current keyframe
+    int32_t  _keySlot;                      // Keyframe file slot of _keyRecord (-1 = none)
+    int32_t  _keyGroup;                     // Keyframe group being written (-1 = unknown)
+    bool     _keyForced;                    // Group being written has a second keyframe
     uint16_t _interval;	                    // Posting interval to log. Currently tested only using 5.
     uint16_t _recordSize;      	  		      // Size of a log record
     uint32_t _fileSize;                     // Size of file in bytes
@@ -101,15 +280,82 @@ class IotaLog
     uint32_t* _cacheKey;
     int32_t*  _cacheSerial;
   
-    uint32_t _lastReadKey;           	    // Key of last record read with readKey
+    uint32_t _lastReadKey;           	    // Key of last record read with readSerial
     int32_t  _lastReadSerial;         	    // Serial of last...
-    uint32_t _readKeyIO;              	    // Running count of I/Os for keyed reads
+    uint32_t _readKeyIO;              	    // Running count of SD sector reads (cache misses)
+    uint32_t _readKeyHits;                  // Running count of sector cache hits
+    int32_t  _scanSerial;                   // Serial of last readSerial, to detect forward scans
+
+    IotaLogSector* _sectors;                // Sector cache (allocated on first read)
+    uint8_t  _cacheSectors;                 // Sectors in cache
+    uint32_t _sectorSeq;                    // LRU sequence counter
+
+    uint8_t* _writeBuf;                     // Records waiting to be written (allocated by setWriteBehind)
+    uint8_t  _writeMax;                     // Records in write-behind buffer (0 = write through)
+    uint8_t  _writeCount;                   // Records waiting
+    uint32_t _writeStart;                   // File offset (less _dataOffset) of first waiting record
+    int32_t  _flushedSerial;                // Serial of last record written to the file
+    uint16_t _rtcWord;                      // RTC user memory word of pending record (0 = none)
     
     uint32_t  findWrap(uint32_t highPos, uint32_t highKey, uint32_t lowPos, uint32_t lowKey);
     void      searchKey(IotaLogRecord* callerRecord, const uint32_t key,
                         const uint32_t lowKey, const int32_t lowSerial, 
                         const uint32_t highKey, const int32_t highSerial);
+    IotaLogSector* getSector(uint32_t pos, bool readAhead);
+    IotaLogSector* findSector(uint32_t pos);
+    void      updateSector(uint32_t pos, const uint8_t* data, uint16_t len);
+    void      clearSectors();
+    bool      readMeta();
+    bool      metaFollows(uint32_t wrap, uint32_t offset, int32_t serial);
+    void      writeMeta(uint32_t endPos);
+    uint32_t  metaChecksum(IotaLogMeta* meta);
+    void      saveRTC(IotaLogRecord* record);
+    void      recoverRTC();
+    bool      openIndex();
+    void      buildIndex(IotaLogRecord* record, const int32_t lowSerial, const uint32_t lowKey,
+                         const int32_t highSerial, const uint32_t highKey);
+    bool      readIndex(uint32_t entry, IotaLogIndex* index);
+    void      pruneIndex();
+    void      writeIndex(uint32_t key, int32_t serial);
+    int32_t   indexSerial(uint32_t key);
+    bool      readHeader();
+    bool      writeHeader();
+    bool      readKeyFrame(int32_t serial, bool second);
+    bool      writeKeyFrame(IotaLogRecord* record, bool second);
+    bool      writerKeyFrame(IotaLogRecord* record);
+    uint16_t  buildColumns(uint8_t* channel);
+    uint32_t  keyFrameLimit();
       
 };
 
+/*******************************************************************************************************
+ * An IotaLogCursor remembers the serial and key of the last record it read, so a service stepping
+ * forward through the log (an uploader catching up) reads the next key by computing its serial
+ * from the last one instead of looking it up.  When there is a hole, the records up to the key 
+ * are stepped through in order, which the sector cache and read-ahead make sequential reads.
+ * Reading backward, past the end of the log, or after the log has wrapped over the position
+ * falls back to readKey and repositions the cursor there.
+ ******************************************************************************************************/
+
+class IotaLogCursor
+{
+  public:
+    IotaLogCursor(IotaLog* log)
+    :_log(log)
+    ,_key(0)
+    ,_recKey(0)
+    ,_serial(-1)
+    {};
+
+    int      read(IotaLogRecord* callerRecord, uint32_t key);   // Same result as readKey
+    int      next(IotaLogRecord* callerRecord, uint32_t interval){return read(callerRecord, _key + interval);}
+    void     reset(){_serial = -1;}
+
+  private:
+    IotaLog* _log;
+    uint32_t _key;                          // Last key read
+    uint32_t _recKey;                       // Actual key of record at _serial
+    int32_t  _serial;                       // Serial of last record read (-1 = not positioned)
+};
+
 #endif
\ No newline at end of file
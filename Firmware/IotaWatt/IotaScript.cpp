@@ -30,6 +30,10 @@ Script::Script(JsonObject& JsonScript)
       ,_name(nullptr)
       ,_constants(nullptr)
       ,_tokens(nullptr)
+      ,_program(nullptr)
+      ,_stack(nullptr)
+      ,_depth(0)
+      ,_signature(0)
       ,_units(Watts)
       
     {
@@ -60,6 +64,10 @@ Script::Script(const char* name, const char* unit, const char* script)
       ,_name(nullptr)
       ,_constants(nullptr)
       ,_tokens(nullptr)
+      ,_program(nullptr)
+      ,_stack(nullptr)
+      ,_depth(0)
+      ,_signature(0)
       ,_units(Watts)
        
     {
@@ -77,6 +85,8 @@ Script::Script(const char* name, const char* unit, const char* script)
 Script::~Script() {
       delete[] _name;
       delete[] _tokens;
+      delete[] _program;
+      delete[] _stack;
       delete[] _constants;
     }
 
@@ -88,6 +98,10 @@ const char*   Script::getUnits() {return unitstr[_units];};
 
 int           Script::precision(){return unitsPrecision[_units];};
 
+uint32_t      Script::signature(){return (_signature ^ _units) * 16777619;}
+
+ScriptDeltas  Script::_deltas = {nullptr, nullptr, 0, 0, -1, -1, -1.0, -1.0};
+
 size_t        ScriptSet::count() {return _count;}
 
 Script*       ScriptSet::first() {return _listHead;}  
@@ -127,6 +141,7 @@ bool    Script::encodeScript(const char* script){
           if(script[i] == '#')constCount++;
           if((!isDigit(script[i])) && (script[i] != '.')) tokenCount++;
         }
+        consts = constCount;
         _tokens = new uint8_t[tokenCount + 1];
         _constants = new float[constCount];
         int j = 0;
@@ -149,6 +164,105 @@ bool    Script::encodeScript(const char* script){
           }
         }
         _tokens[i] = 0;
+
+            // Compile the tokens to a postfix program.
+            // Each token produces at most two instructions, plus two to close each group.
+
+        uint8_t* program = new uint8_t[(i + 1) * 4];
+        uint8_t* token = _tokens;
+        int pc = 0;
+        int sp = 0;
+        int maxsp = 0;
+        if(compile(&token, program, &pc, &sp, &maxsp) && maxsp <= 255){
+          program[pc++] = 0;
+          _program = new uint8_t[pc];
+          memcpy(_program, program, pc);
+          _depth = max(1, maxsp);
+          _stack = new double[_depth * 2];
+          _signature = 2166136261;                    // FNV-1a of program and constants
+          for(int k=0; k<pc; k++){
+            _signature = (_signature ^ _program[k]) * 16777619;
+          }
+          for(int k=0; k<consts; k++){
+            uint8_t* bytes = (uint8_t*)&_constants[k];
+            for(int b=0; b<sizeof(float); b++){
+              _signature = (_signature ^ bytes[b]) * 16777619;
+            }
+          }
+        }
+        else {
+          log("Script: %s too complex.", _name ? _name : "");
+        }
+        delete[] program;
+        return _program != nullptr;
+}
+
+/*******************************************************************************************************
+ * Script tokens are evaluated strictly left to right, with parentheses for grouping.  compile
+ * emits each group as operand, operand, operator... leaving the group's value on the stack.
+ * As in the original evaluator, an operator with no operand following uses 0, or 1 for * and /,
+ * a second operand replaces the first, and | takes the absolute value of the preceding operand.
+ ******************************************************************************************************/
+
+bool    Script::compile(uint8_t** tokens, uint8_t* program, int* pc, int* sp, int* maxsp){
+        uint8_t* token = *tokens;
+        uint8_t pendingOp = opAdd;
+        uint8_t defaultOperand = opZero;
+        bool haveResult = false;
+        bool haveOperand = false;
+        while(true){
+          if(*token & (getInputOp | getConstOp)){
+            if(haveOperand){
+              program[(*pc)++] = opDrop;
+              (*sp)--;
+            }
+            program[(*pc)++] = *token;
+            if(++(*sp) > *maxsp) *maxsp = *sp;
+            haveOperand = true;
+          }
+          else if(*token == opPush){
+            if(haveOperand){
+              program[(*pc)++] = opDrop;
+              (*sp)--;
+            }
+            token++;
+            if( ! compile(&token, program, pc, sp, maxsp)){
+              return false;
+            }
+            haveOperand = true;
+            if(*token == opEq){						// Unbalanced, end of script
+              continue;
+            }
+          }
+          else if(*token == opAbs || (*token >= opAdd && *token <= opMax) || *token == opPop || *token == opEq){
+            if( ! haveOperand){
+              program[(*pc)++] = defaultOperand;
+              if(++(*sp) > *maxsp) *maxsp = *sp;
+              haveOperand = true;
+            }
+            if(*token == opAbs){
+              program[(*pc)++] = opAbs;
+            }
+            else {
+              if(haveResult){						// First operand is added to zero
+                program[(*pc)++] = pendingOp;
+                (*sp)--;
+              }
+              haveResult = true;
+              if(*token == opPop || *token == opEq){
+                *tokens = token;
+                return true;
+              }
+              pendingOp = *token;
+              defaultOperand = (pendingOp == opMult || pendingOp == opDiv) ? opOne : opZero;
+              haveOperand = false;
+            }
+          }
+          else {
+            return false;
+          }
+          token++;
+        }
 }
 
 double  Script::run(IotaLogRecord* oldRec, IotaLogRecord* newRec, double elapsedHours, const char* overideUnits){
@@ -169,41 +283,42 @@ double  Script::run(IotaLogRecord* oldRec, IotaLogRecord* newRec, double elapsed
 }
 
 double  Script::run(IotaLogRecord* oldRec, IotaLogRecord* newRec, double elapsedHours){
-        uint8_t* tokens = _tokens;
-        double result, var, watts;
+        double result = 0.0;
+        double var, watts;
+        setDeltas(oldRec, newRec);
         switch(_units) {
 
           case Watts:
           case Volts:
-            result = runRecursive(&tokens, oldRec, newRec, elapsedHours, '1'); 
+            exec(elapsedHours, '1', &result); 
             break;
 
           case Wh:
-            result = runRecursive(&tokens, oldRec, newRec, 1.0, '1'); 
+            exec(1.0, '1', &result); 
             break;
 
           case kWh:
-            result = runRecursive(&tokens, oldRec, newRec, 1000.0, '1'); 
+            exec(1000.0, '1', &result); 
             break;
             
           case Amps:
-            result = runRecursive(&tokens, oldRec, newRec, elapsedHours, 'A'); 
+            exec(elapsedHours, 'A', &result); 
             break;
 
           case VA:
-            var = runRecursive(&tokens, oldRec, newRec, elapsedHours, 'R');
-            watts = runRecursive(&tokens, oldRec, newRec, elapsedHours, '1');
-            result = sqrt(watts*watts + var*var); 
+            if(exec(elapsedHours, '1', &watts, 'R', &var)){
+              result = sqrt(watts*watts + var*var);
+            } 
             break;
 
           case Hz:
-            result = runRecursive(&tokens, oldRec, newRec, elapsedHours, 'H'); 
+            exec(elapsedHours, 'H', &result); 
             break;
 
           case PF:
-            watts = runRecursive(&tokens, oldRec, newRec, elapsedHours, '1');
-            var = runRecursive(&tokens, oldRec, newRec, elapsedHours, 'R');
-            result = watts / sqrt(watts*watts + var*var); 
+            if(exec(elapsedHours, '1', &watts, 'R', &var)){
+              result = watts / sqrt(watts*watts + var*var);
+            } 
             break;
         }
         
@@ -212,80 +327,132 @@ double  Script::run(IotaLogRecord* oldRec, IotaLogRecord* newRec, double elapsed
                 
 }
 
-double  Script::runRecursive(uint8_t** tokens, IotaLogRecord* oldRec, IotaLogRecord* newRec, double elapsedHours, char type){
-        double result = 0.0;
-        double operand = 0.0;
-        uint8_t pendingOp = opAdd;
-        uint8_t* token = *tokens;
-        do {
-          //Serial.printf("token %d, result %f, operand %f, pendingop %d\r\n", *token, result, operand, pendingOp);
-          if(*token >= opAdd && *token <= opMax){
-            result = evaluate(result, pendingOp, operand);
-            pendingOp = *token;
-            operand = 0;
-            if(*token == opDiv || *token == opMult) operand = 1;
-          }
-          else if(*token == opAbs){
-            if(operand < 0) operand = 0 - operand;
-          }       
-          else if(*token == opPush){
-            token++;
-            operand = runRecursive(&token, oldRec, newRec, elapsedHours, type);
+        // Compute the accumulator deltas, unless already done for these records.
+        // Without an old record, the new one may be a live record like statRecord
+        // that changes without a new key, so it is never reused.
+
+void    Script::setDeltas(IotaLogRecord* oldRec, IotaLogRecord* newRec){
+        if(oldRec &&
+           _deltas.newRec == newRec && 
+           _deltas.newKey == newRec->UNIXtime &&
+           _deltas.newSerial == newRec->serial &&
+           _deltas.newHours == newRec->logHours &&
+           _deltas.oldRec == oldRec &&
+           _deltas.oldKey == oldRec->UNIXtime &&
+           _deltas.oldSerial == oldRec->serial &&
+           _deltas.oldHours == oldRec->logHours){
+          return;
+        }
+        _deltas.newRec = newRec;
+        _deltas.newKey = newRec->UNIXtime;
+        _deltas.newSerial = newRec->serial;
+        _deltas.newHours = newRec->logHours;
+        _deltas.oldRec = oldRec;
+        if(oldRec){
+          _deltas.oldKey = oldRec->UNIXtime;
+          _deltas.oldSerial = oldRec->serial;
+          _deltas.oldHours = oldRec->logHours;
+        }
+        for(int i=0; i<IOTALOG_CHANNELS; i++){
+          _deltas.accum1[i] = newRec->accum1[i] - (oldRec ? oldRec->accum1[i] : 0.0);
+          _deltas.accum2[i] = newRec->accum2[i] - (oldRec ? oldRec->accum2[i] : 0.0);
+        }
+}
+
+        // Run the program for one or two operand types in a single pass.
+        // Returns false if an operand can't be computed (result is zero).
+
+bool    Script::exec(double elapsedHours, char typeA, double* resultA, char typeB, double* resultB){
+        double* stack[2] = {_stack, _stack + _depth};
+        char type[2] = {typeA, typeB};
+        int lanes = resultB ? 2 : 1;
+        int sp = -1;
+        *resultA = 0.0;
+        if(resultB) *resultB = 0.0;
+        if( ! _program){
+          return false;
+        }
+        for(uint8_t* op = _program; *op; op++){
+          if(*op & getInputOp){
+            sp++;
+            for(int lane=0; lane<lanes; lane++){
+              if( ! operand(*op % 32, type[lane], elapsedHours, &stack[lane][sp])){
+                return false;
+              }
+            }
           }
-          else if(*token == opPop){ 
-            *tokens = token;
-            return evaluate(result, pendingOp, operand);
+          else if(*op & getConstOp){
+            sp++;
+            stack[0][sp] = stack[1][sp] = _constants[*op % 32];
           }
-          else if(*token == opEq){
-            return evaluate(result, pendingOp, operand);
+          else if(*op == opZero || *op == opOne){
+            sp++;
+            stack[0][sp] = stack[1][sp] = (*op == opOne) ? 1.0 : 0.0;
           }
-          if(*token & getConstOp){
-            operand = _constants[*token % 32];
+          else if(*op == opDrop){
+            sp--;
           }
-
-              // Fetch input operand.
-              // accum1 is Wh, Vh
-              // accum2 is VAh, Hzh
-              // Type 1 retieves accum1
-              // Type 2 retrieves accum2
-              // Type R computes var as sqrt(VA^2 - W^2)
-              // Type A computes Amps as VA / V
-              // Type H retrieves Hz for associated voltage channel
-
-          if(*token & getInputOp){
-            if(type == '1'){
-              operand = (newRec->accum1[*token % 32] - (oldRec ? oldRec->accum1[*token % 32] : 0.0)) / elapsedHours;
-            }
-            else if(type == '2'){
-              operand = (newRec->accum2[*token % 32] - (oldRec ? oldRec->accum2[*token % 32] : 0.0)) / elapsedHours;
+          else if(*op == opAbs){
+            for(int lane=0; lane<lanes; lane++){
+              if(stack[lane][sp] < 0) stack[lane][sp] = 0 - stack[lane][sp];
             }
-            else if(type == 'R'){
-              double _VA = (newRec->accum2[*token % 32] - (oldRec ? oldRec->accum2[*token % 32] : 0.0)) / elapsedHours;
-              double W = (newRec->accum1[*token % 32] - (oldRec ? oldRec->accum1[*token % 32] : 0.0)) / elapsedHours;
-              operand = sqrt(_VA*_VA - W*W);
-            }
-            else if(type == 'A'){
-              if(*token % 32 >= maxInputs) return 0.0;
-              double _VA = (newRec->accum2[*token % 32] - (oldRec ? oldRec->accum2[*token % 32] : 0.0)) / elapsedHours;
-              int vchannel = inputChannel[*token % 32]->_vchannel;
-              operand = ((newRec->accum1[vchannel] - (oldRec ? oldRec->accum1[vchannel] : 0.0)) / elapsedHours);
-              if(operand != 0.0){
-                operand = _VA / operand;
-              }
-              if(inputChannel[*token % 32]->_double){
-                operand /= 2.0;
-              }
-            }
-            else if(type == 'H'){
-              if(*token % 32 >= maxInputs) return 0.0;
-              int vchannel = inputChannel[*token % 32]->_vchannel;
-              operand = (newRec->accum2[vchannel] - (oldRec ? oldRec->accum2[vchannel] : 0.0)) / elapsedHours;
+          }
+          else {
+            sp--;
+            for(int lane=0; lane<lanes; lane++){
+              stack[lane][sp] = evaluate(stack[lane][sp], *op, stack[lane][sp+1]);
             }
-            else operand = 0.0;
-            if(operand != operand) operand = 0;
           }
+        }
+        *resultA = stack[0][0];
+        if(resultB) *resultB = stack[1][0];
+        return true;
+}
+
+        // Fetch input operand.
+        // accum1 is Wh, Vh
+        // accum2 is VAh, Hzh
+        // Type 1 retieves accum1
+        // Type 2 retrieves accum2
+        // Type R computes var as sqrt(VA^2 - W^2)
+        // Type A computes Amps as VA / V
+        // Type H retrieves Hz for associated voltage channel
 
-        } while(token++);
+bool    Script::operand(uint8_t input, char type, double elapsedHours, double* value){
+        *value = 0.0;
+        if(input >= IOTALOG_CHANNELS){
+          return type != 'A' && type != 'H';
+        }
+        if(type == '1'){
+          *value = _deltas.accum1[input] / elapsedHours;
+        }
+        else if(type == '2'){
+          *value = _deltas.accum2[input] / elapsedHours;
+        }
+        else if(type == 'R'){
+          double _VA = _deltas.accum2[input] / elapsedHours;
+          double W = _deltas.accum1[input] / elapsedHours;
+          *value = sqrt(_VA*_VA - W*W);
+        }
+        else if(type == 'A'){
+          if(input >= maxInputs) return false;
+          double _VA = _deltas.accum2[input] / elapsedHours;
+          int vchannel = inputChannel[input]->_vchannel;
+          *value = _deltas.accum1[vchannel] / elapsedHours;
+          if(*value != 0.0){
+            *value = _VA / *value;
+          }
+          if(inputChannel[input]->_double){
+            *value /= 2.0;
+          }
+        }
+        else if(type == 'H'){
+          if(input >= maxInputs) return false;
+          int vchannel = inputChannel[input]->_vchannel;
+          *value = _deltas.accum2[vchannel] / elapsedHours;
+        }
+        if(*value != *value) *value = 0.0;
+        return true;
 }
 
 double    Script::evaluate(double result, uint8_t token, double operand){
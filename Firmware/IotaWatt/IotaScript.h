@@ -17,6 +17,26 @@ enum        units {    // Square one
             unitsNone = 8
             };         // Units to be computed   
 
+/*******************************************************************************************************
+ * Scripts are compiled to a flat postfix program evaluated with a stack sized, when it's compiled,
+ * to the deepest the program goes, so there is no limit on nesting.  Operands
+ * are computed from the accumulator deltas between the two records, which are computed once
+ * and shared by every Script run against the same pair of records.
+ ******************************************************************************************************/
+
+struct ScriptDeltas {
+      const IotaLogRecord* oldRec;          // Records the deltas were computed from
+      const IotaLogRecord* newRec;
+      uint32_t oldKey;                      // and their identity when computed
+      uint32_t newKey;
+      int32_t  oldSerial;
+      int32_t  newSerial;
+      double   oldHours;
+      double   newHours;
+      double   accum1[IOTALOG_CHANNELS];    // newRec - oldRec
+      double   accum2[IOTALOG_CHANNELS];
+    };
+
 class Script {
 
   friend class ScriptSet;
@@ -38,6 +58,7 @@ class Script {
 
     void    print();
     int     precision();
+    uint32_t signature();   // Hash of program, constants and units
 
   private:
 
@@ -45,6 +66,10 @@ class Script {
     char*       _name;      // name associated with this Script
     float*      _constants; // Constant values referenced in Script
     uint8_t*    _tokens;    // Script tokens
+    uint8_t*    _program;   // Compiled postfix program
+    double*     _stack;     // Evaluation stack, two lanes of _depth
+    uint8_t     _depth;     // Deepest the program's stack goes
+    uint32_t    _signature; // Hash of program and constants
     units       _units;     // Units to be computed              
     uint8_t     _accum;               // Accumulators to use in fetching operands
     const byte  getInputOp = 32;
@@ -59,12 +84,20 @@ class Script {
                 opMax   = 6,
                 opAbs   = 7,
                 opPush  = 8,
-                opPop   = 9};
+                opPop   = 9,
+                opZero  = 10,           // Program only: push 0
+                opOne   = 11,           //               push 1
+                opDrop  = 12};          //               discard top of stack
     const char* opChars = "=+-*/<>|()";
 
-    double    runRecursive(uint8_t**, IotaLogRecord* oldRec, IotaLogRecord* newRec, double elapsedHours, char type);
+    static ScriptDeltas _deltas;
+
+    bool      exec(double elapsedHours, char typeA, double* resultA, char typeB = 0, double* resultB = nullptr);
+    bool      operand(uint8_t input, char type, double elapsedHours, double* value);
+    void      setDeltas(IotaLogRecord* oldRec, IotaLogRecord* newRec);
     double    evaluate(double, byte, double);
     bool      encodeScript(const char* script);
+    bool      compile(uint8_t** tokens, uint8_t* program, int* pc, int* sp, int* maxsp);
 
 };
 
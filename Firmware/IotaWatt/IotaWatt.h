@@ -47,6 +47,7 @@
 #include <math.h>
 #include <Ticker.h>
 
+#include "memPool.h"
 #include "IotaLog.h"
 #include "IotaInputChannel.h"
 #include "IotaScript.h"
@@ -59,9 +60,11 @@
 
 #include "messageLog.h"
 #include "utilities.h"
+#include "jsonStream.h"
 #include "webServer.h"
 #include "updater.h"
 #include "samplePower.h"
+#include "uploadControl.h"
 #include "influxDB.h"
 #include "Emonservice.h"
 #include "auth.h"
@@ -69,6 +72,8 @@
 #include "timeServices.h"
 #include "PVoutput.h"
 #include "CSVquery.h"
+#include "fileExport.h"
+#include "intervalFrame.h"
 
 
       // Declare instances of major classes
@@ -79,6 +84,17 @@ extern ESP8266WebServer server;
 extern DNSServer dnsServer;
 extern IotaLog currLog;
 extern IotaLog histLog;
+extern memPool logRecordPool;                    // IotaLogRecord allocations
+extern memPool workBufPool;                      // Small work buffers (message log)
+
+struct rollupTier {                         // Rollup log built from a finer resolution log
+  IotaLog*    log;                          // The rollup log
+  IotaLog*    source;                       // Log it is built from
+  const char* path;                         // File path (w/o extension)
+  const char* name;                         // Name used in status
+};
+extern rollupTier rollupTiers[];            // Rollup logs, finest first
+extern const int rollupTierCount;
 extern RTC_PCF8523 rtc;
 extern Ticker ticker;
 extern Ticker logWDT;
@@ -170,6 +186,9 @@ struct EEprom {
 #define T_samplePhase 23   // Sample phase (within samplePower) 
 #define T_RTCWDT 24        // Dead man pedal service
 #define T_CSVquery 25      // CSVquery            
+#define T_rollup 26        // rollupLog service
+#define T_msglog 27        // messageLog service
+#define T_events 28        // eventService (server-sent events)
 
       // LED codes
 
@@ -188,20 +207,55 @@ struct EEprom {
 #define ADC_RANGE 4096      // 2^12
 
 extern uint32_t lastCrossMs;           // Timestamp at last zero crossing (ms) (set in samplePower)
+extern uint32_t sampleCrossUs;         // micros() at first zero crossing of last sampleCycle
+extern uint32_t sampleCycleUs;         // Duration of last sampleCycle, first to last crossing (us)
 extern uint32_t nextCrossMs;           // Time just before next zero crossing (ms) (computed in Loop)
 
 enum priorities: byte {priorityLow=3, priorityMed=2, priorityHigh=1};
 
-struct serviceBlock {                  // Scheduler/Dispatcher list item (see comments in Loop)
-  serviceBlock* next;                  // Next serviceBlock in list
+struct serviceBlock {                  // Scheduler/Dispatcher heap item (see comments in Loop)
   uint32_t callTime;                   // Time (in NTP seconds) to dispatch
+  uint32_t readyMs;                    // millis() after which dispatch is allowed (0 = not delayed)
+  uint32_t seq;                        // Order queued, keeps equal entries FIFO
   uint32_t (*service)(serviceBlock*);  // the SERVICE
+  uint16_t  delayMs;                   // Set by SERVICE to delay next dispatch by milliseconds
   priorities priority;                 // All things equal tie breaker
   uint8_t   taskID;
-  serviceBlock(){next=NULL; callTime=0; priority=priorityMed; service=NULL; taskID=0;}
+  serviceBlock(){callTime=0; readyMs=0; seq=0; delayMs=0; priority=priorityMed; service=NULL; taskID=0;}
+};
+
+#define SERVICE_DISPATCH_MAX 8         // Most services dispatched in one pass of loop
+
+extern serviceBlock** serviceHeap;     // Binary heap of services in order of dispatch
+extern uint16_t serviceCount;          // Services in heap
+extern uint16_t serviceHeapSize;       // Allocated size of heap
+
+      // Loop profiler (see Loop.cpp).
+      // Execution times in microseconds with a log2 histogram for percentiles.
+
+#define PERF_TASKS 32                  // Service taskIDs profiled
+#define PERF_BUCKETS 24                // Histogram buckets, bucket n holds times < 2^n us
+
+struct perfStat {
+  uint32_t  count;                     // Times recorded
+  uint32_t  minUs;                     // Shortest
+  uint32_t  maxUs;                     // Longest
+  uint64_t  totalUs;                   // Sum of recorded times
+  uint16_t  hist[PERF_BUCKETS];        // log2 histogram
+  perfStat(){count=0; minUs=0xFFFFFFFF; maxUs=0; totalUs=0; memset(hist, 0, sizeof(hist));}
+  void      record(uint32_t us);
+  uint32_t  percentile(uint8_t pct);
 };
 
-extern serviceBlock* serviceQueue;     // Head of ordered list of services
+extern perfStat* perfService[PERF_TASKS]; // Service dispatch times by taskID (allocated on first use) 
+extern perfStat  perfWeb;              // Web handler times
+extern perfStat  perfSampleLate;       // Time from expected sample start to actual
+extern uint32_t  perfMissedCycles;     // Sampling started a full cycle or more late
+extern perfStat  perfQuery;            // Compute time per /query select
+extern uint32_t  perfQueryGroups;      // Groups produced by /query
+extern uint32_t  perfQueryCached;      // Groups served from the query cache
+extern uint32_t  perfQueryRuns;        // Script evaluations by /query
+extern uint32_t  perfQueryReads;       // SD sector reads during /query
 
       // Define maximum number of input channels.
       // Create pointer for array of pointers to incidences of input channels
@@ -229,6 +283,9 @@ extern float   frequency;                             // Split the difference to
 extern float   configFrequency;                       // Frequency at last config (phase corrrection basis)         
 extern float   samplesPerCycle;                       // Here as well
 extern float   cycleSampleRate;
+extern uint8_t sampleMaxCycles;                      // Most consecutive cycles sampled on a variable load (1 = off)
+extern uint16_t sampleCycles[];                      // Cycles sampled per channel since last statService
+extern float   sampleCoverage[];                     // Cycles sampled per minute for each channel
 extern int16_t cycleSamples;
 extern float   heapMs;
 extern uint32_t heapMsPeriod;
@@ -248,7 +305,7 @@ extern boolean  serverAvailable;          // Set false when asynchronous handler
 extern boolean  wifiConnected;
 extern uint8_t  configSHA256[32];         // Hash of config file
 
-#define HTTPrequestMax 2                  // Maximum number of concurrent HTTP requests  
+#define HTTPrequestMax 4                  // Maximum number of concurrent HTTP requests (including query jobs)  
 extern int16_t  HTTPrequestFree;          // Request semaphore
 extern uint32_t HTTPrequestStart[HTTPrequestMax]; // request start time tokens
 extern uint16_t HTTPrequestId[HTTPrequestMax];    // Module ID of requestor
@@ -256,7 +313,7 @@ extern uint32_t HTTPlock;                 // start time token of locking request
 
 extern uint8_t*   adminH1;                // H1 digest md5("admin":"admin":password) 
 extern uint8_t*   userH1;                 // H1 digest md5("user":"user":password) 
-extern authSession* authSessions;         // authSessions list head; 
+extern authSession* authSessions[AUTH_SESSION_BUCKETS]; // authSessions hash table;
 extern uint16_t   authTimeout;            // Timeout interval of authSession in seconds;   
 
       // ****************************** Timing and time data *************************
@@ -264,6 +321,8 @@ extern uint16_t   authTimeout;            // Timeout interval of authSession in
 extern int32_t  localTimeDiff;                 // Local time Difference in minutes
 extern tzRule*  timezoneRule;                  // Rule for DST 
 extern uint32_t programStartTime;;             // Time program started (UnixTime)
+#define GZIP_DIR "/gzip"                       // Gzip compressed copies of web assets, same names
+extern uint32_t SDfileEpoch;                   // Count of SD file changes through the web server (for ETags)
 extern uint32_t timeRefNTP;                    // Last time from NTP server (NTPtime)
 extern uint32_t timeRefMs;                     // Internal MS clock corresponding to timeRefNTP
 extern uint32_t timeSynchInterval;             // Interval (sec) to roll NTP forward and try to refresh
@@ -293,6 +352,7 @@ extern const char     base64codes_P[];
       // ************************ ADC sample pairs ************************************
 
 #define MAX_SAMPLES 1000
+#define SAMPLE_BUDGET_MS 70                       // Most time spent sampling consecutive cycles of a channel
 
 extern uint32_t sumVsq;                           // sampleCycle will compute these while collecting samples    
 extern uint32_t sumIsq;
@@ -300,6 +360,11 @@ extern int32_t  sumVI;
 extern int16_t  samples;                          // Number of samples taken in last sampling
 extern int16_t  Vsample [MAX_SAMPLES];            // voltage/current pairs during sampling
 extern int16_t  Isample [MAX_SAMPLES];
+extern int16_t* I2sample;                         // Second current samples when sampling pairs (else nullptr)
+extern uint32_t sumI2sq;
+extern bool     samplePairs;                      // Sample adjacent power channels with the same V together
+extern bool     powerQuality;                     // Compute current harmonics while computing power
+extern uint16_t realtimeChannels;                 // Channels recorded in the realtime ring (bit per channel)
 
       // ************************ Declare global functions
 void      setup();
@@ -309,9 +374,23 @@ void      logTrace(void);
 
 void      NewService(uint32_t (*serviceFunction)(struct serviceBlock*), const uint8_t taskID=0);
 void      AddService(struct serviceBlock*);
+void      sampleNext();
+int32_t   dispatchRemainingUs();
+bool      dispatchExpired();
+void      dispatchCheckpoint();
+serviceBlock* nextService();
+bool      serviceReady();
+bool      serviceFits(serviceBlock*);
 uint32_t  dataLog(struct serviceBlock*);
 void      datalogWDT();
 uint32_t  historyLog(struct serviceBlock*);
+uint32_t  rollupLog(struct serviceBlock*);
+uint32_t  queryService(struct serviceBlock*);
+bool      queryStart(queryResult* query);
+void      queryBusy();
+void      eventPublish();
+void      realtimeBegin(uint16_t channels);
+void      realtimeRecord(uint8_t channel, float value);
 uint32_t  statService(struct serviceBlock*);
 uint32_t  EmonService(struct serviceBlock*);
 uint32_t  influxService(struct serviceBlock*);
@@ -321,6 +400,9 @@ uint32_t  WiFiService(struct serviceBlock*);
 uint32_t  getFeedData(); //(struct serviceBlock*);
 
 uint32_t  logReadKey(IotaLogRecord* callerRecord);
+uint32_t  logReadKeys(const uint32_t* keys, IotaLogRecord* callerRecords, size_t count);
+IotaLog*  logSelect(uint32_t key);
+uint32_t  logReadIO();
 
 void      setLedCycle(const char*);
 void      endLedCycle();
@@ -333,10 +415,12 @@ void      dropDead(const char*);
 boolean   getConfig(const char* configPath);
 
 size_t    sendChunk(char* buf, size_t bufPos);
+size_t    chunkFrame(char* buf, size_t bufPos);
 
 uint32_t  HTTPreserve(uint16_t id, bool lock = false);
 void      HTTPrelease(uint32_t HTTPtoken);
 
 void      getSamples();
+void      getWaveform(int channel, int cycles);
 
 #endif
@@ -6,7 +6,7 @@ void loop()
  * The main loop is very simple:
  *  Sample a power channel.
  *  Yield to the OS and Wifi Server.
- *  Run next dispatchable service if there is one
+ *  Run dispatchable services while there is time
  *  Yield to the OS and Wifi Server.
  *  Go back, Jack, and do it again.
  ******************************************************************************/
@@ -14,21 +14,8 @@ void loop()
   setLedState();
 
   // ------- If AC zero crossing approaching, go sample a channel.
-  static int lastChannel = 0;
-  if(maxInputs && (uint32_t)(millis() - lastCrossMs) >= (430 / int(frequency))){
-    trace(T_LOOP,1,lastChannel);
-    int nextChannel = (lastChannel + 1) % maxInputs;
-    while( (! inputChannel[nextChannel]->isActive()) && nextChannel != lastChannel){
-      nextChannel = ++nextChannel % maxInputs;
-    }
-    ESP.wdtFeed();
-    trace(T_LOOP,2,nextChannel);
-    samplePower(nextChannel, 0);
-    trace(T_LOOP,2);
-    nextCrossMs = lastCrossMs + 490 / int(frequency);
-    if(nextChannel <= lastChannel) sampling = true;
-    lastChannel = nextChannel;
-  }
+
+  sampleNext();
 
   // --------- Give web server a shout out.
   //           serverAvailable will be false if there is a request being serviced by
@@ -44,15 +31,26 @@ void loop()
   }
   
 
-// ---------- If the head of the service queue is dispatchable
+// ---------- While the head of the service heap is dispatchable
 //            call the SERVICE.
+//            After the first, only if it is expected to finish before the next crossing.
 
-  if(serviceQueue != NULL && UTCtime() >= serviceQueue->callTime){
-    serviceBlock* thisBlock = serviceQueue;
-    serviceQueue = thisBlock->next;
+  for(int dispatched=0; dispatched<SERVICE_DISPATCH_MAX && serviceReady(); dispatched++){
+    if(dispatched && ! serviceFits(serviceHeap[0])){
+      break;
+    }
+    serviceBlock* thisBlock = nextService();
     ESP.wdtFeed();
     trace(T_LOOP,5,thisBlock->taskID);
+    uint32_t startUs = micros();
     thisBlock->callTime = thisBlock->service(thisBlock);
+    uint32_t elapsedUs = micros() - startUs;
+    if(thisBlock->taskID < PERF_TASKS){
+      if( ! perfService[thisBlock->taskID]){
+        perfService[thisBlock->taskID] = new perfStat;
+      }
+      perfService[thisBlock->taskID]->record(elapsedUs);
+    }
     yield();
     trace(T_LOOP,6);
     if(thisBlock->callTime > 0){
@@ -63,6 +61,82 @@ void loop()
   } 
 }
 
+/*****************************************************************************************************
+ * sampleNext samples the next active channel if the AC zero crossing is approaching.
+ * It's called from loop, and from long running operations via dispatchCheckpoint.
+ *****************************************************************************************************/
+
+void sampleNext(){
+  static int lastChannel = 0;
+  if(maxInputs && (uint32_t)(millis() - lastCrossMs) >= (430 / int(frequency))){
+    trace(T_LOOP,1,lastChannel);
+    uint32_t sinceCross = millis() - lastCrossMs;
+    if(lastCrossMs && sampling){
+      perfSampleLate.record((sinceCross - 430 / int(frequency)) * 1000);
+      if(sinceCross >= (1000 / int(frequency))){
+        perfMissedCycles++;
+      }
+    }
+    int nextChannel = (lastChannel + 1) % maxInputs;
+    while( (! inputChannel[nextChannel]->isActive()) && nextChannel != lastChannel){
+      nextChannel = ++nextChannel % maxInputs;
+    }
+
+
+        // When sampling pairs, a power channel is paired with the next active channel
+        // if it's a power channel with the same voltage channel.
+
+    int pair = -1;
+    uint8_t weight = inputChannel[nextChannel]->sampleWeight(sampleMaxCycles);
+    if(samplePairs && I2sample && inputChannel[nextChannel]->_type == channelTypePower){
+      for(int i=nextChannel+1; i<maxInputs; i++){
+        if(inputChannel[i]->isActive()){
+          if(inputChannel[i]->_type == channelTypePower && 
+             inputChannel[i]->_vchannel == inputChannel[nextChannel]->_vchannel){
+            pair = i;
+            weight = max(weight, inputChannel[i]->sampleWeight(sampleMaxCycles));
+          }
+          break;
+        }
+      }
+    }
+    ESP.wdtFeed();
+    trace(T_LOOP,2,nextChannel);
+    int cycles = samplePower(nextChannel, weight, pair);
+    sampleCycles[nextChannel] += cycles;
+    trace(T_LOOP,2);
+    if(pair >= 0){
+      sampleCycles[pair] += cycles;
+      nextChannel = pair;
+    }
+    nextCrossMs = lastCrossMs + 490 / int(frequency);
+    if(nextChannel <= lastChannel) sampling = true;
+    lastChannel = nextChannel;
+  }
+}
+
+/*****************************************************************************************************
+ * Dispatch budget.
+ * Services and long running operations can check the time left before the next crossing
+ * with dispatchRemainingUs, and return or checkpoint when it runs out.  dispatchCheckpoint
+ * samples a channel if one is due, so a loop that calls it regularly doesn't delay sampling.
+ *****************************************************************************************************/
+
+int32_t dispatchRemainingUs(){
+  return (int32_t)(nextCrossMs - millis()) * 1000;
+}
+
+bool dispatchExpired(){
+  return dispatchRemainingUs() <= 0;
+}
+
+void dispatchCheckpoint(){
+  if(sampling){
+    sampleNext();
+  }
+  yield();
+}
+
 /*****************************************************************************************************
 
                                     End of main Loop
@@ -94,8 +168,15 @@ void loop()
  * for the next available opportunity, just return 1.  If a service returns zero, it's service block will
  * be deleted.  To reschedule, AddService would have to be called to create a new serviceBlock.
  * 
- * The schedule itself is kept as an ordered list of control blocks in ascending order of time + priority.
- * Loop simply invokes the service currently at the beginning of the list.
+ * The schedule itself is kept as a binary heap of control blocks ordered by time, ready time, priority,
+ * and the order they were queued.  Loop invokes the service at the top of the heap, and then any others
+ * that are due, as long as their average run time (from the profiler) fits before the next AC 
+ * crossing.  So a service catching up by returning 1 can run several times between samples.
+ * A service can ask for finer than one second resolution by setting delayMs in its serviceBlock
+ * before returning. It will be dispatched no sooner than that many milliseconds later.  Within a second,
+ * delayed services follow those that aren't, in order of their ready time, so a delayed service
+ * at the top of the heap never holds back one that is ready.  The delay is meant to be under a 
+ * second; a longer one can still hold back services scheduled for the following seconds.
  * 
  * The WiFi server is not one of these services.  It is invoked each time through the loop because it
  * polls for activity.
@@ -108,26 +189,122 @@ void NewService(uint32_t (*serviceFunction)(struct serviceBlock*), const uint8_t
     AddService (newBlock);
   }
 
+      // Heap order: earlier callTime, then not delayed, then earlier ready, then higher priority, then FIFO.
+
+static bool serviceBefore(serviceBlock* a, serviceBlock* b){
+  if(a->callTime != b->callTime) return a->callTime < b->callTime;
+  if((a->readyMs == 0) != (b->readyMs == 0)) return a->readyMs == 0;
+  if(a->readyMs != b->readyMs) return (int32_t)(a->readyMs - b->readyMs) < 0;
+  if(a->priority != b->priority) return a->priority < b->priority;
+  return (int32_t)(a->seq - b->seq) < 0;
+}
+
 void AddService(struct serviceBlock* newBlock){
+  static uint32_t serviceSeq = 0;
   if(newBlock->callTime < UTCtime()) newBlock->callTime = UTCtime();
-  if(serviceQueue == NULL ||
-    (newBlock->callTime < serviceQueue->callTime) ||
-    (newBlock->callTime == serviceQueue->callTime && newBlock->priority < serviceQueue->priority)){
-    newBlock->next = serviceQueue;
-    serviceQueue = newBlock;
-  }
-  else {
-    serviceBlock* link = serviceQueue;
-    while(link->next != NULL){
-      if((newBlock->callTime < link->next->callTime) ||
-        (newBlock->callTime == link->next->callTime && newBlock->priority < link->next->priority)){
-        break;
-      }        
-      link = link->next;
-    } 
-    newBlock->next = link->next;
-    link->next = newBlock;
+  newBlock->readyMs = newBlock->delayMs ? (millis() + newBlock->delayMs) | 1 : 0;
+  newBlock->delayMs = 0;
+  newBlock->seq = ++serviceSeq;
+  if(serviceCount == serviceHeapSize){
+    serviceHeapSize = serviceHeapSize ? serviceHeapSize * 2 : 16;
+    serviceBlock** newHeap = new serviceBlock*[serviceHeapSize];
+    for(int i=0; i<serviceCount; i++){
+      newHeap[i] = serviceHeap[i];
+    }
+    delete[] serviceHeap;
+    serviceHeap = newHeap;
+  }
+  int i = serviceCount++;
+  while(i > 0 && serviceBefore(newBlock, serviceHeap[(i - 1) / 2])){
+    serviceHeap[i] = serviceHeap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  serviceHeap[i] = newBlock;
+}
+
+serviceBlock* nextService(){
+  if(serviceCount == 0){
+    return nullptr;
+  }
+  serviceBlock* top = serviceHeap[0];
+  serviceBlock* last = serviceHeap[--serviceCount];
+  int i = 0;
+  while(true){
+    int child = i * 2 + 1;
+    if(child >= serviceCount) break;
+    if(child + 1 < serviceCount && serviceBefore(serviceHeap[child + 1], serviceHeap[child])){
+      child++;
+    }
+    if( ! serviceBefore(serviceHeap[child], last)) break;
+    serviceHeap[i] = serviceHeap[child];
+    i = child;
+  }
+  if(serviceCount){
+    serviceHeap[i] = last;
+  }
+  return top;
+}
+
+bool serviceReady(){
+  return serviceCount &&
+         UTCtime() >= serviceHeap[0]->callTime &&
+         (serviceHeap[0]->readyMs == 0 || (int32_t)(millis() - serviceHeap[0]->readyMs) >= 0);
+}
+
+      // True if the service's average run time fits before the next crossing.
+      // Services not yet profiled are assumed to take a millisecond.
+
+bool serviceFits(serviceBlock* block){
+  int32_t remainingMs = nextCrossMs - millis();
+  if(remainingMs <= 0){
+    return false;
+  }
+  uint32_t expectUs = 1000;
+  if(block->taskID < PERF_TASKS && perfService[block->taskID] && perfService[block->taskID]->count){
+    expectUs = perfService[block->taskID]->totalUs / perfService[block->taskID]->count;
+  }
+  return expectUs < (uint32_t)remainingMs * 1000;
+}
+
+/************************************************************************************************
+ *  Profiler.
+ *  
+ *  Loop records the execution time of each service dispatch by taskID, serverOn records the
+ *  web handlers, and the lateness of each sampling start is recorded along with a count of 
+ *  missed cycles.  Percentiles come from a log2 histogram, so they are an upper bound within
+ *  a factor of two.  When a histogram bucket fills, all buckets are halved so recent times
+ *  keep their weight.  Results are reported by /status?perf.
+ *************************************************************************************************/
+void perfStat::record(uint32_t us){
+  count++;
+  totalUs += us;
+  if(us < minUs) minUs = us;
+  if(us > maxUs) maxUs = us;
+  int bucket = 0;
+  while(bucket < (PERF_BUCKETS - 1) && (us >> bucket)){
+    bucket++;
+  }
+  if(++hist[bucket] == 0xFFFF){
+    for(int i=0; i<PERF_BUCKETS; i++){
+      hist[i] /= 2;
+    }
+  }
+}
+
+uint32_t perfStat::percentile(uint8_t pct){
+  uint32_t total = 0;
+  for(int i=0; i<PERF_BUCKETS; i++){
+    total += hist[i];
+  }
+  uint32_t target = (total * pct + 99) / 100;
+  uint32_t sum = 0;
+  for(int i=0; i<PERF_BUCKETS; i++){
+    sum += hist[i];
+    if(sum >= target && sum){
+      return min(maxUs, (uint32_t)(1 << i));
+    }
   }
+  return maxUs;
 }
 
 /************************************************************************************************
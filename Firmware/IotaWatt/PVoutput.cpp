@@ -60,9 +60,9 @@ void PVoutput::end(){
 
         // Get the current status as a Json object.
 
-void PVoutput::getStatusJson(JsonObject& status){
-    status.set(F("running"), (_started && _state != stopped));
-    status.set(F("lastpost"),local2UTC(_lastPostTime));
+void PVoutput::getStatusJson(jsonStream& json){
+    json.set(F("running"), (_started && _state != stopped));
+    json.set(F("lastpost"),local2UTC(_lastPostTime));
 }
 
 //********************************************************************************************************************
@@ -262,13 +262,16 @@ uint32_t PVoutput::tickUploadStatus(){
     
             // Insure base energy values for the current day are set.
 
+            // Local midnight is on an hour (or quarter hour) boundary in UTC, 
+            // so logReadKey gets it directly from a rollup log.
+
     if(_baseTime != (_lastReqTime - _lastReqTime % UNIX_DAY)){
         trace(T_PVoutput,83);
         if( ! oldRecord){
             oldRecord = new IotaLogRecord;
         }
         oldRecord->UNIXtime = local2UTC(_lastReqTime - _lastReqTime % UNIX_DAY);
-        histLog.readKey(oldRecord);
+        logReadKey(oldRecord);
         Script* script = _outputs->first();
         while(script){
             if(strcmp(script->name(),"generation") == 0){
@@ -507,20 +510,20 @@ uint32_t PVoutput::tickHTTPPost(){
     if( ! WiFi.isConnected()){
         return UTCtime() + 1;
     }
-    _HTTPtoken = HTTPreserve(T_influx);
+    _HTTPtoken = HTTPreserve(T_PVoutput);
     if( ! _HTTPtoken){
         return 1;
     }
     if( ! request){
         request = new asyncHTTPrequest;
     }
-    request->setTimeout(3);
+    request->setTimeout(_upload.timeout());
     request->setDebug(false);
     char URL[128];
     size_t len = sprintf_P(URL, PSTR("HTTP://pvoutput.org/service/r2/%s"), _POSTrequest->URI);
     if( ! request->open("POST", URL)){
         HTTPrelease(_HTTPtoken);
-        return UTCtime() + 10;
+        return _upload.failure();
     }
     request->setReqHeader(FPSTR(reqHeaderApikey), _apiKey);
     request->setReqHeader(FPSTR(reqHeaderSystemId), _systemID);
@@ -533,6 +536,7 @@ uint32_t PVoutput::tickHTTPPost(){
     } else {
         request->send();
     }
+    _upload.sent();
     _state = HTTPwait;
     return 1;
 }
@@ -568,8 +572,9 @@ uint32_t PVoutput::tickHTTPWait(){
     trace(T_PVoutput,120);
     if(request->responseHTTPcode() < 0){
         _HTTPresponse = HTTP_FAILURE;
-        return UTCtime() + 3;
+        return _upload.failure();
     }
+    _upload.success();
     trace(T_PVoutput,122);
 
             // Capture response.
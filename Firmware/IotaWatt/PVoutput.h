@@ -88,6 +88,7 @@ public:
         ,_POSTrequest(nullptr)
         ,_rateLimitReset(0)
         ,_baseTime(0)
+        ,_upload(0, 0)
         {};
 
     ~PVoutput(){
@@ -106,7 +107,7 @@ public:
     void stop();                                        // stop the state machine ASAP
     void end();                                         // Destroy this instance of the class ASAP
     void restart();                                     // Force a restart of the state machine ASAP
-    void getStatusJson(JsonObject&);                    // Add status objects to the supplied Json object
+    void getStatusJson(jsonStream&);                    // Add status members to the open Json object
     uint32_t tick(struct serviceBlock* serviceBlock);   // Invoke state machine execution
 
 private:
@@ -201,6 +202,7 @@ private:
     double      _baseConsumption;           // Energy consumption at start of current reporting day
     double      _baseGeneration;            // Energy generation at start of current reporting day
     uint32_t    _baseTime;                  // Local date (UNIXtime 00:00:00) of above base values
+    uploadControl _upload;                  // Timeout and backoff (batch size is set by PVoutput limits)
 
 };
 
@@ -234,7 +234,7 @@ if(spiffsBegin()){
 
   server.on(F("/edit"), HTTP_POST, returnOK, handleFileUpload);
   server.onNotFound(handleRequest);
-  const char * headerkeys[] = {"X-configSHA256"};
+  const char * headerkeys[] = {"X-configSHA256", "If-None-Match", "Accept-Encoding", "Range"};
   size_t headerkeyssize = sizeof(headerkeys)/sizeof(char*);
   server.collectHeaders(headerkeys, headerkeyssize );
   server.begin();
@@ -249,6 +249,8 @@ if(spiffsBegin()){
   NewService(updater, T_UPDATE);
   NewService(dataLog, T_datalog);
   NewService(historyLog, T_history);
+  NewService(rollupLog, T_rollup);
+  NewService(messageLogService, T_msglog);
 
   if(! validConfig){
     setLedCycle(LED_BAD_CONFIG);
@@ -34,6 +34,7 @@ uint32_t WiFiService(struct serviceBlock* _serviceBlock) {
     else if((millis() - lastDisconnect) >= (60000UL * restartInterval)){
       log("WiFi disconnected more than %d minutes, restarting.", restartInterval);
       delay(500);
+      msglog.flush();
       ESP.restart();
     }
   }
@@ -45,18 +46,21 @@ uint32_t WiFiService(struct serviceBlock* _serviceBlock) {
     trace(T_WiFi,10);
     log("Heap memory has degraded below safe minimum, restarting.");
     delay(500);
+    msglog.flush();
     ESP.restart();
   }
 
       // Check for expired HTTP request.
+      // Query jobs can legitimately run longer and time out on their own.
 
   trace(T_WiFi,20);
   for(int i=0; i<HTTPrequestMax; i++){
     trace(T_WiFi,21,i);
-    if(HTTPrequestStart[i] && (millis() - HTTPrequestStart[i]) > 900000UL){
+    if(HTTPrequestStart[i] && HTTPrequestId[i] != T_CSVquery && (millis() - HTTPrequestStart[i]) > 900000UL){
       trace(T_WiFi,22,i);
       log("Incomplete HTTP request detected, id %d, restarting.", HTTPrequestId[i]);
       delay(500);
+      msglog.flush();
       ESP.restart();
     }
   }    
@@ -89,6 +93,15 @@ uint32_t WiFiService(struct serviceBlock* _serviceBlock) {
 uint32_t HTTPreserve(uint16_t id, bool lock){
   trace(T_WiFi,100);
   if(HTTPrequestFree == 0 || HTTPlock) return 0;
+
+      // Keep the last free slot for a module that doesn't already have one,
+      // so one service waiting on a slow server can't starve the others.
+
+  if(HTTPrequestFree == 1){
+    for(int i=0; i<HTTPrequestMax; i++){
+      if(HTTPrequestStart[i] && HTTPrequestId[i] == id) return 0;
+    }
+  }
   HTTPrequestFree--;
   for(int i=0; i<HTTPrequestMax; i++){
     trace(T_WiFi,101,i);
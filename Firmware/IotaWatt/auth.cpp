@@ -9,6 +9,10 @@ static const char qop_authquote[] PROGMEM = "qop=\"auth\"";
 static const char WWW_Authenticate[] PROGMEM = "WWW-Authenticate";
 static bool       authDebug = false;
 
+      // Digest parameters recognized in the Authorization header, in authParamIndex order.
+
+static const char authParamNames[] PROGMEM = "username\0realm\0nonce\0uri\0response\0nc\0cnonce\0qop\0";
+
 bool auth(authLevel level){
 
   if(authDebug) Serial.printf_P(PSTR("\nAuth: authenticate %s\n"), level==authAdmin ? "admin" : "user");
@@ -29,99 +33,103 @@ bool auth(authLevel level){
         // Authorization is required and there is an authorization header.
 
   String authReq = server.header(FPSTR(AUTHORIZATION_HEADER));
-  //authReq.toLowerCase();
   if(authDebug) Serial.printf_P(PSTR("Auth: header %s\n"),authReq.c_str());
 
         // If authorization is not digest, return false;
 
-  if( ! authReq.startsWith(F("Digest"))) {
+  if(strncmp_P(authReq.c_str(), PSTR("Digest "), 7) != 0) {
     if(authDebug) Serial.printf_P(PSTR("Auth: not digest.\r"));
     return false;
   }
-
-  authReq = authReq.substring(7);
         
-        // extract required parameters for RFC 2069 simpler Digest
+        // Locate the parameters for RFC 2069 simpler Digest in place, one pass.
 
-  String _username = extractParam(authReq, F("username="));
-  String _realm    = extractParam(authReq, F("realm="));
-  String _nonce    = extractParam(authReq, F("nonce="));
-  String _uri      = extractParam(authReq, F("uri="));
-  String _response = extractParam(authReq, F("response="));
-  String _nc       = extractParam(authReq, F("nc="));
-  String _cnonce   = extractParam(authReq, F("cnonce="));
-  String _qop      = extractParam(authReq, F("qop="));
+  authParam param[authParamCount];
+  authParseHeader(authReq.c_str() + 7, param);
 
         // Validate required parameters present
 
-  if((!_realm.length()) || (!_nonce.length()) || (!_uri.length()) || (!_response.length()) || (!_cnonce.length())) {
+  if(( ! param[authRealm].len) || ( ! param[authNonce].len) || ( ! param[authUri].len) ||
+     ( ! param[authResponse].len) || ( ! param[authCnonce].len)) {
     if(authDebug) Serial.printf_P(PSTR("Auth: required parameters missing.\n"));
     return false;
   }
 
         // If admin level required, validate auth is for admin.
 
-  if(level == authAdmin && (!_username.equals("admin"))){
+  bool user = param[authUsername].equals("user");
+  if(level == authAdmin && ( ! param[authUsername].equals("admin"))){
       if(authDebug) Serial.printf_P(PSTR("Auth: admin level required.\n"));
       return false;
   }
+  if(user && ! userH1){
+    return false;
+  }
 
         // See if there is an active session for this user,
         // Return false if not (caller will request authorization)
 
-  authSession* session = getAuthSession(_nonce.c_str(), _nc.c_str());
+  authSession* session = getAuthSession(param[authNonce].value, param[authNonce].len, 
+                                        param[authNc].len ? strtoul(param[authNc].value, nullptr, 16) : 0);
   if(! session){
       if(authDebug) Serial.printf_P(PSTR("Auth: no active auth session.\n"));
       return false;
   }
   if(authDebug){
-    Serial.printf_P(PSTR("Auth: active session nonce=%s, nc=%d, lastUsed=%d\n"), bin2hex(session->nonce,16).c_str(), session->nc, session->lastUsed);
+    Serial.printf_P(PSTR("Auth: active session nc=%d, lastUsed=%d\n"), session->nc, session->lastUsed);
   }
 
-        // Get H1 for specified password
-
-  String _H1 = bin2hex(adminH1, 16); 
-  if(_username.equals("user")){
-      _H1 = bin2hex(userH1, 16);
+        // Check the digest.  The pieces are added to the MD5 directly
+        // from the header, so there are no String copies.
+        
+  char H1[33];
+  char H2[33];
+  char responseCheck[33];
+  const uint8_t* H1bin = user ? userH1 : adminH1;
+  for(int i=0; i<16; i++){
+    sprintf_P(H1 + i*2, PSTR("%02x"), H1bin[i]);
   }
 
-        // Check the digest 
-        
   MD5Builder md5;
   md5.begin();
-  if(server.method() == HTTP_GET){
-    md5.add(String(F("GET:")) + _uri);
-  }else if(server.method() == HTTP_POST){
-    md5.add(String(F("POST:")) + _uri);
+  if(server.method() == HTTP_POST){
+    md5.add("POST:");
   }else if(server.method() == HTTP_PUT){
-    md5.add(String(F("PUT:")) + _uri);
+    md5.add("PUT:");
   }else if(server.method() == HTTP_DELETE){
-    md5.add(String(F("DELETE:")) + _uri);
+    md5.add("DELETE:");
   }else{
-    md5.add(String(F("GET:")) + _uri);
+    md5.add("GET:");
   }
+  param[authUri].addTo(md5);
   md5.calculate();
-  String _H2 = md5.toString(); 
+  md5.getChars(H2);
 
         // complete the digest depending on qop specification.
   
   md5.begin();
-  if(_qop.equals("auth")){
-    md5.add(_H1 + ':' + _nonce + ':' + _nc + ':' + _cnonce + F(":auth:") + _H2);
-  } else {
-    md5.add(_H1 + ':' + _nonce + ':' + _H2);
+  md5.add((const uint8_t*)H1, 32);
+  md5.add(":");
+  param[authNonce].addTo(md5);
+  md5.add(":");
+  if(param[authQop].equals("auth")){
+    param[authNc].addTo(md5);
+    md5.add(":");
+    param[authCnonce].addTo(md5);
+    md5.add(":auth:");
   }
+  md5.add((const uint8_t*)H2, 32);
 
         // Calculate authorized response
   
   md5.calculate();
-  String _responsecheck = md5.toString();
+  md5.getChars(responseCheck);
 
         // If authorized response matches caller response,
         // authorize return true
         // Otherwise return false
 
-  if(_response == _responsecheck){
+  if(param[authResponse].equals(responseCheck)){
     session->lastUsed = UTCtime();  
     return true;
   } else {
@@ -142,32 +150,68 @@ void requestAuth() {
   if(authDebug) Serial.printf_P(PSTR("Auth: requestAuth %s\n"),authHeader);
 }
 
-        // extract a parameter from authorization header String
+        // Locate the parameters in an authorization header.
+        // Values are left in place: each param points into the header
+        // with its length, without the quotes.  Unknown names are skipped.
 
-String extractParam(String& authReq, const String& param, const char delimit){
-  int _begin = authReq.indexOf(param);
-  if (_begin == -1) return "";
-  _begin = _begin + param.length();
-  char delim = authReq[_begin];
-  if(delim == '\"'){
-    _begin++;
-  } else {
-    delim = ',';
+void authParseHeader(const char* header, authParam* param){
+  for(int i=0; i<authParamCount; i++){
+    param[i].value = nullptr;
+    param[i].len = 0;
+  }
+  const char* ptr = header;
+  while(*ptr){
+    while(*ptr == ' ' || *ptr == ','){
+      ptr++;
+    }
+    const char* name = ptr;
+    while(*ptr && *ptr != '='){
+      ptr++;
+    }
+    size_t nameLen = ptr - name;
+    if( ! *ptr++){
+      break;
+    }
+    char delim = ',';
+    if(*ptr == '"'){
+      delim = '"';
+      ptr++;
+    }
+    const char* value = ptr;
+    while(*ptr && *ptr != delim){
+      ptr++;
+    }
+    size_t valueLen = ptr - value;
+    if(*ptr){
+      ptr++;
+    }
+    PGM_P known = authParamNames;
+    for(int i=0; i<authParamCount; i++){
+      size_t knownLen = strlen_P(known);
+      if(knownLen == nameLen && strncmp_P(name, known, nameLen) == 0){
+        param[i].value = value;
+        param[i].len = valueLen;
+        break;
+      }
+      known += knownLen + 1;
+    }
   }
-  int _end = authReq.indexOf(delim, _begin);
-  if(_end == -1 && delim == ','){
-    _end = authReq.length();
-  }  
-  String result = authReq.substring(_begin, _end);
-  //if(authDebug) Serial.printf_P(PSTR("Auth: %s:%s\n"),param.c_str(), result.c_str());
-  return result;
+}
+
+        // Sessions are kept in a small hash table keyed by the first byte of the
+        // (random) nonce, so a lookup only walks the few sessions in one bucket.
+
+static authSession** authBucket(const uint8_t* nonce){
+  return &authSessions[nonce[0] % AUTH_SESSION_BUCKETS];
 }
 
         // Create a new authorization session
 
 authSession* newAuthSession(){
-  authSession* session = (authSession*) &authSessions;
-  while(session->next){
+  purgeAuthSessions();
+  for(int i=0; i<AUTH_SESSION_BUCKETS; i++){
+    authSession* session = (authSession*) &authSessions[i];
+    while(session->next){
       if(session->next->IP == server.client().remoteIP() && 
           session->next->nc > 0 ){
           authSession* oldSession = session->next;
@@ -176,39 +220,46 @@ authSession* newAuthSession(){
       } else {
           session = session->next;
       }
+    }
   }
-  session->next = new authSession;
-  session = session->next;
+  authSession* session = new authSession;
   session->IP = server.client().remoteIP();
   session->lastUsed = UTCtime();
   getNonce(session->nonce);
-    return session;
+  authSession** bucket = authBucket(session->nonce);
+  session->next = *bucket;
+  *bucket = session;
+  return session;
 }
 
         // Get existing authorization session if it exists.
 
-authSession* getAuthSession(const char* nonce, const char* nc){
-    if(!authSessions || strlen(nonce) != 32 || strlen(nc) == 0) return nullptr;
-    purgeAuthSessions();
+authSession* getAuthSession(const char* nonce, size_t len, uint32_t nc){
+    if(len != 32 || nc == 0) return nullptr;
     uint8_t _nonce[16];
-    uint32_t _nc;
     hex2bin(_nonce, nonce, 16);
-    _nc = strtol(nc, nullptr, 16);
-    authSession* session = authSessions;
-    while(session){
-        if(memcmp(session->nonce, _nonce, 16) == 0  && session->nc < _nc){
-            session->nc = _nc;
-            return session;
+    authSession* session = (authSession*) authBucket(_nonce);
+    while(session->next){
+        authSession* next = session->next;
+        if((next->lastUsed + authTimeout) < UTCtime()){
+            session->next = next->next;
+            delete next;
+            continue;
         }
-        session = session->next;
+        if(memcmp(next->nonce, _nonce, 16) == 0  && next->nc < nc){
+            next->nc = nc;
+            return next;
+        }
+        session = next;
     }
     return nullptr;
 }
 
 void  purgeAuthSessions(){
-    authSession* session = (authSession*)&authSessions;
+  for(int i=0; i<AUTH_SESSION_BUCKETS; i++){
+    authSession* session = (authSession*)&authSessions[i];
     while(session->next){
-        if((session->next->lastUsed + 600) < UTCtime()){
+        if((session->next->lastUsed + authTimeout) < UTCtime()){
             authSession* expSession = session->next;
             session->next = expSession->next;
             delete expSession;
@@ -216,6 +267,7 @@ void  purgeAuthSessions(){
             session = session->next;
         }
     }
+  }
 }
 
 void  getNonce(uint8_t* nonce){
@@ -284,10 +336,12 @@ void authLoadPwds(){
 
 int     authCount(){
   int count = 0;
-  authSession* session = (authSession*)&authSessions;
-  while(session->next){
-    count++;
-    session = session->next;
+  for(int i=0; i<AUTH_SESSION_BUCKETS; i++){
+    authSession* session = authSessions[i];
+    while(session){
+      count++;
+      session = session->next;
+    }
   }
   return count;     
 }
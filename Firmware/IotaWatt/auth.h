@@ -1,5 +1,7 @@
 #pragma once
 
+#include <MD5Builder.h>
+
 struct authSession {
     authSession*    next;
     IPAddress       IP;
@@ -13,13 +15,26 @@ struct authSession {
     {}
 };
 
+#define AUTH_SESSION_BUCKETS 8              // Session hash table size
+
 enum authLevel {authAdmin, authUser, authNone};
 
+enum authParamIndex {authUsername, authRealm, authNonce, authUri, authResponse, authNc, authCnonce, authQop, authParamCount};
+
+        // A digest parameter located in the Authorization header (not NUL terminated).
+
+struct authParam {
+    const char*     value;
+    uint16_t        len;
+    bool equals(const char* str) const {return strlen(str) == len && memcmp(value, str, len) == 0;}
+    void addTo(MD5Builder& md5) const {md5.add((const uint8_t*)value, len);}
+};
+
 bool auth(authLevel);
 void requestAuth();
-String extractParam(String& authReq,const String& param,const char delimit = '"');
+void authParseHeader(const char* header, authParam* param);
 authSession* newAuthSession();
-authSession* getAuthSession(const char* nonce, const char* nc);
+authSession* getAuthSession(const char* nonce, size_t len, uint32_t nc);
 void  purgeAuthSessions();
 void  getNonce(uint8_t* nonce);
 String calcH1(const char* username, const char* realm, const char* password);
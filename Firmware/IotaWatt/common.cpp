@@ -105,7 +105,12 @@
 WiFiClient WifiClient;
 DNSServer dnsServer;    
 IotaLog currLog(5,365);                     // current data log  (1 year) 
+memPool logRecordPool("logrecord", sizeof(IotaLogRecord), 4, 4);    // Up to 16 records pooled
+memPool workBufPool("workbuf", 64, 4, 2);                           // Up to 8 small buffers pooled
 IotaLog histLog(60,3652);                   // history data log  (10 years)  
+IotaLog roll15mLog(900,36525,1);            // 15 minute rollup log (100 years)
+IotaLog roll1hLog(3600,36525,1);            // hourly rollup log
+IotaLog roll1dLog(86400,36525,1);           // daily rollup log
 RTC_PCF8523 rtc;                            // Instance of RTC_PCF8523
 Ticker ticker;
 Ticker logWDT;
@@ -117,6 +122,13 @@ char* deviceName;
 const char* IotaLogFile = "iotawatt/iotalog";
 const char* historyLogFile = "iotawatt/histLog";
 const char* IotaMsgLog = "iotawatt/iotamsgs.txt";
+
+      // Rollup logs, each built from the one before.
+
+rollupTier rollupTiers[] = {{&roll15mLog, &histLog,    "iotawatt/roll15m", "roll15m"},
+                            {&roll1hLog,  &roll15mLog, "iotawatt/roll1h",  "roll1h"},
+                            {&roll1dLog,  &roll1hLog,  "iotawatt/roll1d",  "roll1d"}};
+const int rollupTierCount = sizeof(rollupTiers) / sizeof(rollupTier);
                        
 uint8_t ADC_selectPin[2] = {pin_CS_ADC0,    // indexable reference for ADC select pins
                             pin_CS_ADC1};  
@@ -135,11 +147,15 @@ traceUnion traceEntry;
        **************************************************************************************************/
        
 uint32_t lastCrossMs = 0;             // Timestamp at last zero crossing (ms) (set in samplePower)
+uint32_t sampleCrossUs = 0;           // micros() at first zero crossing of last sampleCycle
+uint32_t sampleCycleUs = 0;           // Duration of last sampleCycle, first to last crossing (us)
 uint32_t nextCrossMs = 0;             // Time just before next zero crossing (ms) (computed in Loop)
 
       // Various queues and lists of resources.
 
-serviceBlock* serviceQueue;           // Head of active services list in order of dispatch time.       
+serviceBlock** serviceHeap = nullptr; // Binary heap of active services in order of dispatch time.
+uint16_t serviceCount = 0;            // Services in heap
+uint16_t serviceHeapSize = 0;         // Allocated size of heap
 IotaInputChannel* *inputChannel = nullptr; // -->s to incidences of input channels (maxInputs entries) 
 uint8_t maxInputs = 0;                // channel limit based on configured hardware (set in Config)      
 ScriptSet* outputs;                   // -> scriptSet for output channels
@@ -158,6 +174,19 @@ float   frequency = 55;                  // Split the difference to start
 float   configFrequency;                 // Frequency at last config (phase corrrection basis)    
 float   samplesPerCycle = 550;           // Here as well
 float   cycleSampleRate = 0;
+uint8_t sampleMaxCycles = 1;          // Most consecutive cycles sampled on a variable load (1 = off)
+uint16_t sampleCycles[MAXINPUTS];     // Cycles sampled per channel since last statService
+float   sampleCoverage[MAXINPUTS];    // Cycles sampled per minute for each channel
+
+perfStat* perfService[PERF_TASKS] = {nullptr}; // Service dispatch times by taskID
+perfStat  perfWeb;                    // Web handler times
+perfStat  perfSampleLate;             // Time from expected sample start to actual
+uint32_t  perfMissedCycles = 0;       // Sampling started a full cycle or more late
+perfStat  perfQuery;                  // Compute time per /query select
+uint32_t  perfQueryGroups = 0;        // Groups produced by /query
+uint32_t  perfQueryCached = 0;        // Groups served from the query cache
+uint32_t  perfQueryRuns = 0;          // Script evaluations by /query
+uint32_t  perfQueryReads = 0;         // SD sector reads during /query
 int16_t cycleSamples = 0;
 float    heapMs = 0;                      // heap size * milliseconds for weighted average heap
 uint32_t heapMsPeriod = 0;                // total ms measured above.
@@ -176,7 +205,7 @@ uint8_t configSHA256[32];         // Hash of config file last time read or writt
 
 uint8_t*          adminH1 = nullptr;      // H1 digest md5("admin":"admin":password) 
 uint8_t*          userH1 = nullptr;       // H1 digest md5("user":"user":password)
-authSession*      authSessions = nullptr; // authSessions list head;
+authSession*      authSessions[AUTH_SESSION_BUCKETS] = {nullptr}; // authSessions hash table;
 uint16_t          authTimeout = 600;      // Timeout interval of authSession in seconds;   
  
 
@@ -192,6 +221,7 @@ uint32_t HTTPlock = 0;                      // Time(ms) HTTP was locked (no new
 int32_t  localTimeDiff = 0;                  // Hours from UTC 
 tzRule*  timezoneRule = nullptr;             // Rule for DST 
 uint32_t programStartTime = 0;               // Time program started (UnixTime)
+uint32_t SDfileEpoch = 0;                    // Count of SD file changes through the web server (for ETags)
 uint32_t timeRefNTP = SEVENTY_YEAR_SECONDS;  // Last time from NTP server (NTPtime)
 uint32_t timeRefMs = 0;                      // Internal MS clock corresponding to timeRefNTP
 uint32_t timeSynchInterval = 3600;           // Interval (sec) to roll NTP forward and try to refresh
@@ -233,3 +263,8 @@ int32_t   sumVI;
 int16_t   samples = 0;                              // Number of samples taken in last sampling
 int16_t   Vsample [MAX_SAMPLES];                    // voltage/current pairs during sampling
 int16_t   Isample [MAX_SAMPLES];
+int16_t*  I2sample = nullptr;                       // Second current samples when sampling pairs
+uint32_t  sumI2sq;
+bool      samplePairs = false;                      // Sample adjacent power channels with the same V together
+bool      powerQuality = false;                     // Compute current harmonics while computing power
+uint16_t  realtimeChannels = 0;                     // Channels recorded in the realtime ring (bit per channel)
@@ -41,7 +41,9 @@
       log("dataLog: service started.");
 
       // Initialize the IotaLog class
+      // Hold 30 seconds of records for each write, backed up in RTC memory.
       
+      currLog.setWriteBehind(30 / currLog.interval(), IOTALOG_RTC_WORD);
       if(int rtc = currLog.begin(IotaLogFile)){
         log("dataLog: Log file open failed. %d", rtc);
         dropDead();
@@ -174,6 +176,7 @@
 
 void datalogWDT(){
         log("dataLog: datalog WDT - restarting");
+        msglog.flush();
         ESP.restart();
 }
 /******************************************************************************
@@ -207,27 +210,72 @@ void datalogWDT(){
  * if the key is between the end of the history log and the start of the currLog,
  * return the last record in the history log with requested key.
  * 
+ * Before any of that, if the key is a multiple of the interval of a rollup log
+ * and contained in it, use the coarsest such rollup log.
+ * 
  * ***************************************************************************/
 
 uint32_t logReadKey(IotaLogRecord* callerRecord) {
-  uint32_t key = callerRecord->UNIXtime;
+  return logSelect(callerRecord->UNIXtime)->readKey(callerRecord);
+}
+
+IotaLog* logSelect(uint32_t key) {
+  for(int i=rollupTierCount-1; i>=0; i--){
+    IotaLog* rollLog = rollupTiers[i].log;
+    if(rollLog->isOpen() && (key % rollLog->interval()) == 0 &&
+       key >= rollLog->firstKey() && key <= rollLog->lastKey() && rollLog->fileSize()){
+      return rollLog;
+    }
+  }
   if( ! histLog.isOpen()){
-    return currLog.readKey(callerRecord);
+    return &currLog;
   }
   if(key % histLog.interval()){               // not multiple of histLog interval
     if(key >= currLog.firstKey() || key < histLog.firstKey()){   // in iotaLog
-      return currLog.readKey(callerRecord);
+      return &currLog;
     }
-    return histLog.readKey(callerRecord);     // in histLog
+    return &histLog;                          // in histLog
   }
-  else {                                      // multiple of histLog interval
-    if(key >= histLog.firstKey() && key <= histLog.lastKey()){   // in histLog
-      return histLog.readKey(callerRecord);
+  if(key >= histLog.firstKey() && key <= histLog.lastKey()){     // in histLog
+    return &histLog;
+  }
+  return &currLog;                            // in IotaLog
+}
+
+/******************************************************************************
+ * logReadKeys(keys, iotaLogRecords, count) - read a list of ascending keys
+ * 
+ * Batched version of logReadKey.  Consecutive keys that are serviced by the
+ * same log are passed to that log's readKeys together, so adjacent records
+ * are read sequentially and each search starts from the previous record.
+ * 
+ * ***************************************************************************/
+
+uint32_t logReadKeys(const uint32_t* keys, IotaLogRecord* callerRecords, size_t count) {
+  uint32_t rtc = 0;
+  size_t begin = 0;
+  while(begin < count){
+    IotaLog* readLog = logSelect(keys[begin]);
+    size_t end = begin + 1;
+    while(end < count && logSelect(keys[end]) == readLog){
+      end++;
     }
-    return currLog.readKey(callerRecord);     // in IotaLog
+    if(uint32_t readRtc = readLog->readKeys(keys + begin, callerRecords + begin, end - begin)){
+      rtc = readRtc;
+    }
+    begin = end;
+  }
+  return rtc;
+}
+
+/******************************************************************************
+ * logReadIO() - total SD sector reads by all of the logs
+ * ***************************************************************************/
+
+uint32_t logReadIO() {
+  uint32_t reads = currLog.readKeyIO() + histLog.readKeyIO();
+  for(int i=0; i<rollupTierCount; i++){
+    reads += rollupTiers[i].log->readKeyIO();
   }
-  callerRecord->UNIXtime = histLog.lastKey(); // between the two logs (rare)
-  histLog.readKey(callerRecord);
-  callerRecord->UNIXtime = key;
-  return 0;
+  return reads;
 }
@@ -15,6 +15,7 @@ char*     EmonUsername = nullptr;
 uint16_t  EmonPort = 80;
 int16_t   EmonBulkSend = 1;
 int32_t   EmonRevision = -1;
+uint32_t  EmonSignature = 0;                        // Hash of config, identifies checkpoint
 uint32_t  EmonBeginPosting = 0;
 uint8_t   cryptoKey[16];
 EmonSendMode EmonSend = EmonSendPOSTsecure;
@@ -50,17 +51,17 @@ uint32_t EmonService(struct serviceBlock* _serviceBlock){
                 sendSecure,                     // Send the data to Emoncms using encrypted protocol
                 waitSecure};                    // Wait for acknowledgement
   static states state = initialize;
-  static IotaLogRecord* logRecord = nullptr;
-  static IotaLogRecord* oldRecord = nullptr;
   static uint32_t lastRequestTime = 0;          // Time of last measurement in last or current request
   static uint32_t UnixNextPost = 0;             // Next measurement to be posted
+  static IotaLogCursor cursor(&currLog);        // Position in log of last measurement
+  static IotaLogRecord* logRecord = nullptr;    // Scratch record to position and skip gaps
   static xbuf reqData;
   static uint32_t reqUnixtime = 0;              // First measurement in current reqData
   static int  reqEntries = 0;                   // Number of measurement intervals in current reqData
   static int32_t retryCount = 0;
   static asyncHTTPrequest* request = nullptr;
-  static char* base64Sha = nullptr;
-  const  size_t reqDataLimit = 2500;            // Transaction yellow light size
+  static char base64Sha[45];                    // Expected response to secure post
+  static uploadControl control(EMON_REQDATA_MIN, EMON_REQDATA_MAX);  // Batch size, timeout and backoff
   static uint32_t HTTPtoken = 0;
           
   trace(T_Emon,0);
@@ -86,6 +87,16 @@ uint32_t EmonService(struct serviceBlock* _serviceBlock){
       log("EmonService: started. url=%s:%d%s, node=%s, interval=%d%s", EmonURL, EmonPort, EmonURI, 
            emonNode, EmonCMSInterval, (EmonSend == EmonSendGET ? "" : ", encrypted"));
       retryCount = 0;
+
+          // If there's a checkpoint for this configuration, start from it.
+
+      control.checkpoint(EMON_CHECKPOINT, EmonSignature);
+      EmonLastPost = control.resume();
+      if(EmonLastPost >= currLog.firstKey() && EmonLastPost <= currLog.lastKey()){
+        log("EmonService: Resume posting at %s", localDateString(EmonLastPost + EmonCMSInterval).c_str());
+        state = getLastRecord;
+        return 1;
+      }
       EmonLastPost = EmonBeginPosting;
       state = queryLastGet;
       return 1; 
@@ -169,18 +180,19 @@ uint32_t EmonService(struct serviceBlock* _serviceBlock){
 
             // Get the last record in the log.
             // Posting will begin with the next log entry after this one,
+            // and the cursor is positioned there to read forward.
 
-      if( ! oldRecord){
-        oldRecord = new IotaLogRecord;
+      if( ! logRecord){
+        logRecord = new IotaLogRecord;
       }
       trace(T_Emon,5);
-      oldRecord->UNIXtime = EmonLastPost;      
-      currLog.readKey(oldRecord);
+      cursor.reset();
+      cursor.read(logRecord, EmonLastPost);
 
             // Assume that record was posted (not important).
             // Plan to start posting one interval later
         
-      EmonLastPost = oldRecord->UNIXtime;
+      EmonLastPost = logRecord->UNIXtime;
       UnixNextPost = EmonLastPost + EmonCMSInterval - (EmonLastPost % EmonCMSInterval);
         
             // Advance state.
@@ -203,8 +215,6 @@ uint32_t EmonService(struct serviceBlock* _serviceBlock){
         EmonStarted = false;
         EmonStop = false;
         state = initialize;
-        delete oldRecord;
-        oldRecord = nullptr;
         delete logRecord;
         logRecord = nullptr;
         delete request;
@@ -234,22 +244,21 @@ uint32_t EmonService(struct serviceBlock* _serviceBlock){
           // If buffer isn't full,
           // add another measurement.
 
-      if(reqData.available() < reqDataLimit && UnixNextPost <= currLog.lastKey()){  
+      if(reqData.available() < control.batchLimit() && UnixNextPost <= currLog.lastKey()){  
  
-            // Read the next log record.
+            // Get the shared frame for this interval.
             
         trace(T_Emon,6);
-        if( ! logRecord){
-          logRecord = new IotaLogRecord;
-        }
-        logRecord->UNIXtime = UnixNextPost;
-        currLog.readKey(logRecord);    
+        intervalFrame* frame = getIntervalFrame(UnixNextPost, EmonCMSInterval, &cursor);
+        IotaLogRecord* oldRecord = frame->oldRec;
+        IotaLogRecord* newRecord = frame->newRec;
       
             // Compute the time difference between log entries.
             // If zero, read ahead to skip over a potentially lengthy gap.
             
-        double elapsedHours = logRecord->logHours - oldRecord->logHours;
+        double elapsedHours = frame->elapsedHours;
         if(elapsedHours == 0 || elapsedHours != elapsedHours){
+          logRecord->serial = newRecord->serial;
           if(currLog.readNext(logRecord) == 0) {
             UnixNextPost = logRecord->UNIXtime - (logRecord->UNIXtime % EmonCMSInterval);
           }
@@ -280,7 +289,7 @@ uint32_t EmonService(struct serviceBlock* _serviceBlock){
         if( ! emonOutputs){  
           for (int i = 0; i < maxInputs; i++) {
             IotaInputChannel *_input = inputChannel[i];
-            value1 = (logRecord->accum1[i] - oldRecord->accum1[i]) / elapsedHours;
+            value1 = (newRecord->accum1[i] - oldRecord->accum1[i]) / elapsedHours;
             if( ! _input || value1 != value1){
               reqData.write(",null");
             }
@@ -301,7 +310,7 @@ uint32_t EmonService(struct serviceBlock* _serviceBlock){
           int index=1;
           while(script){
             while(index++ < String(script->name()).toInt()) reqData.write(",null");
-            value1 = script->run(oldRecord, logRecord, elapsedHours);
+            value1 = frame->run(script);
             if(value1 == value1){
               reqData.printf(",%.*f", script->precision(), value1);
             } else {
@@ -313,16 +322,13 @@ uint32_t EmonService(struct serviceBlock* _serviceBlock){
         trace(T_Emon,6);
         reqData.write(']');
         reqEntries++;
-        delete oldRecord;
-        oldRecord = logRecord;
-        logRecord = nullptr;
         UnixNextPost +=  EmonCMSInterval - (UnixNextPost % EmonCMSInterval);
       }
 
             // If buffer not full and there is a data backlog,
             // return to fill buffer.
 
-      if(reqData.available() < reqDataLimit && UnixNextPost < currLog.lastKey()){
+      if(reqData.available() < control.batchLimit() && UnixNextPost < currLog.lastKey()){
         return 1;
       }
 
@@ -347,7 +353,7 @@ uint32_t EmonService(struct serviceBlock* _serviceBlock){
       }
       String URL(EmonURL);
       URL += ":" + String(EmonPort) + EmonURI + "/input/bulk";
-      request->setTimeout(2);
+      request->setTimeout(control.timeout());
       request->setDebug(false);
       if(request->debug()){
         Serial.println(datef(localTime(),"hh:mm:ss"));
@@ -360,6 +366,7 @@ uint32_t EmonService(struct serviceBlock* _serviceBlock){
       request->setReqHeader("Content-Type","application/x-www-form-urlencoded");
       trace(T_Emon,7);
       request->send(&reqData, reqData.available());
+      control.sent();
       state = waitPost;
       return 1;
     } 
@@ -393,20 +400,26 @@ case sendSecure:{
       cypher->setIV(iv, 16);
       cypher->setKey(cryptoKey, 16);
 
-        // Process payload while
-        // updating SHAs and encrypting. 
+        // Process payload in one pass while updating SHAs, encrypting 
+        // and base64 encoding.  Plaintext is read from the front of reqData 
+        // and the encoded IV+cyphertext written to the back, so the only 
+        // copy is the encoded result replacing the plaintext as it's consumed.
+        // Cyphertext is staged in groups of 48 (a multiple of both the 
+        // AES block and the base64 group) so only the end needs padding.
 
       trace(T_Emon,9);    
-      uint8_t* temp = new uint8_t[64+16];
+      uint8_t* temp = new uint8_t[48+16];
+      uint8_t* stage = new uint8_t[48];
+      memcpy(stage, iv, 16);
+      size_t staged = 16;
       size_t supply = reqData.available();
-      reqData.write(iv, 16);
       while(supply){
-        size_t len = supply < 64 ? supply : 64;
+        size_t len = supply < 48 ? supply : 48;
         reqData.read(temp, len);
         supply -= len;
         sha256->update(temp, len);
         shaHMAC->update(temp, len);
-        if(len < 64 || supply == 0){
+        if(len < 48 || supply == 0){
           size_t padlen = 16 - (len % 16);
           for(int i=0; i<padlen; i++){
             temp[len+i] = padlen;
@@ -414,9 +427,20 @@ case sendSecure:{
           len += padlen;
         }
         cypher->encrypt(temp, temp, len);
-        reqData.write(temp, len);
+        for(size_t i=0; i<len;){
+          size_t take = MIN(len - i, 48 - staged);
+          memcpy(stage + staged, temp + i, take);
+          staged += take;
+          i += take;
+          if(staged == 48){
+            base64encode(stage, 48, &reqData);
+            staged = 0;
+          }
+        }
       }
+      base64encode(stage, staged, &reqData);
       trace(T_Emon,9);
+      delete[] stage;
       delete[] temp;
       delete cypher;
       
@@ -425,19 +449,22 @@ case sendSecure:{
       trace(T_Emon,9);
       uint8_t value[32];
       sha256->finalize(value, 32);
-      delete[] base64Sha;
-      base64Sha = charstar(base64encode(value, 32).c_str());
+      {
+        xbuf sha;
+        base64encode(value, 32, &sha);
+        sha.read((uint8_t*)base64Sha, 44);
+        base64Sha[44] = 0;
+      }
       shaHMAC->finalizeHMAC(cryptoKey, 16, value, 32);
       delete sha256;
       delete shaHMAC;
 
-        // Now base64 encode and send
+        // Now send
 
-      base64encode(&reqData); 
       trace(T_Emon,10);
       String URL(EmonURL);
       URL += ":" + String(EmonPort) + EmonURI + "/input/bulk";
-      request->setTimeout(2);
+      request->setTimeout(control.timeout());
       request->setDebug(false);
       trace(T_Emon,10); 
       String auth(EmonUsername);
@@ -456,6 +483,7 @@ case sendSecure:{
       request->setReqHeader("Authorization", auth.c_str());
       trace(T_Emon,10);
       request->send(&reqData, reqData.available());
+      control.sent();
       reqData.flush();
       state = waitPost;
       return 1;
@@ -470,32 +498,35 @@ case sendSecure:{
       reqData.flush();
       trace(T_Emon,11);
       if(request->responseHTTPcode() != 200){
-        if(++retryCount == 30){
+        uint32_t retryTime = control.failure();
+        if(control.failures() == 10){
             log("EmonService: HTTP response %d, retrying.", request->responseHTTPcode());
         }
         state = getLastRecord;
-        return UTCtime() + (retryCount < 30 ? 1 : retryCount / 10);
+        return retryTime;
       }
       trace(T_Emon,11);
       String response = request->responseText();
       if((EmonSend == EmonSendGET && ! response.startsWith("ok")) ||
         (EmonSend == EmonSendPOSTsecure && ! response.startsWith(base64Sha))){
-        if(++retryCount == 30){
+        uint32_t retryTime = control.failure();
+        if(control.failures() == 10){
           log("EmonService: Invalid response, retrying.");
         }
-        if(retryCount % 30){
+        if(control.failures() % 30){
           EmonLastPost = reqUnixtime;
         }
         state = getLastRecord;
-        return UTCtime() + retryCount / 30;
+        return retryTime;
       }
       trace(T_Emon,11);
-      if(retryCount >= 30){
-        log("EmonService: Retry successful after %d attempts.", retryCount);
+      if(control.failures() >= 10){
+        log("EmonService: Retry successful after %d attempts.", control.failures());
       }
-      retryCount = 0;
+      control.success();
       reqEntries = 0;
       EmonLastPost = lastRequestTime;     
+      control.posted(EmonLastPost);
       state = post;
       return UnixNextPost + EmonBulkSend ? 1 : 0;
     }
@@ -526,6 +557,7 @@ bool EmonConfig(const char* configObj){
     return true;
   }
   EmonRevision = revision;
+  EmonSignature = hashFNV(2166136261UL, configObj, strlen(configObj));
   EmonStop = config["stop"].as<bool>();
   String URL = config["url"].as<String>();
   URL = config["url"].as<String>();
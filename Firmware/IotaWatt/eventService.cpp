@@ -0,0 +1,221 @@
+/**********************************************************************************************
+ * eventService pushes live values to /events subscribers as server-sent events, so dashboards
+ * don't have to poll /status?inputs&outputs.
+ *
+ * handleEvents sends the text/event-stream headers and keeps the connection.  Each time
+ * statService updates statRecord it calls eventPublish, which evaluates the inputs and
+ * outputs once, serializes one message and writes it to every subscriber.  The cost is
+ * the same for one subscriber or several.
+ *
+ * Messages are deltas: only inputs and outputs whose value changed at its reported
+ * precision are included.  A full snapshot ("full":true) is sent when a subscriber joins,
+ * when the outputs are reconfigured, periodically, and after any subscriber couldn't take
+ * a message, so a client that missed a delta is back in sync within EVENT_FULL_SEC.
+ *
+ * Subscribers don't hold HTTPreserve tokens, as they would starve the uploaders, but are
+ * limited to EVENT_SUBSCRIBERS.
+ **********************************************************************************************/
+#include "IotaWatt.h"
+
+#define EVENT_SUBSCRIBERS 4                 // Max concurrent subscribers
+#define EVENT_FULL_SEC 60                   // Max interval between full snapshots
+#define EVENT_KEEPALIVE_SEC 15              // Comment sent when nothing has changed
+#define EVENT_STALL_MS 30000                // Drop subscriber that doesn't take data
+
+struct eventSubscriber {
+      eventSubscriber*  next;
+      WiFiClient        client;             // Keeps the connection after the handler returns
+      uint32_t          lastWrite;          // millis() of last message written
+      eventSubscriber(WiFiClient& client)
+      :next(nullptr)
+      ,client(client)
+      ,lastWrite(millis())
+      {}
+      ~eventSubscriber(){
+        client.stop();
+      }
+    };
+
+eventSubscriber* eventSubscribers = nullptr;
+
+static float*     eventLast = nullptr;        // Last published values, two per input then outputs
+static size_t     eventLastCount = 0;
+static bool       eventFull = true;           // Next message is a full snapshot
+static uint32_t   eventFullTime = 0;          // UTCtime of last full snapshot
+static uint32_t   eventSentTime = 0;          // UTCtime of last message or keepalive
+
+void handleEvents(){
+  trace(T_events,0);
+  int count = 0;
+  for(eventSubscriber* sub=eventSubscribers; sub; sub=sub->next){
+    count++;
+  }
+  if(count >= EVENT_SUBSCRIBERS){
+    server.send(503, txtPlain_P, F("Too many event subscribers."));
+    return;
+  }
+  server.sendHeader(F("Cache-Control"), F("no-cache"));
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/event-stream", "");
+  WiFiClient client = server.client();
+  eventSubscriber* sub = new eventSubscriber(client);
+  sub->next = eventSubscribers;
+  eventSubscribers = sub;
+  eventFull = true;
+}
+
+    // Round value to the reported decimals and compare with the last published.
+    // Records the new value and returns true if it will be published.
+
+static bool eventChanged(size_t slot, double value, int decimals){
+  float rounded = isnan(value) ? NAN : round(value * pow(10, decimals)) / pow(10, decimals);
+  float last = eventLast[slot];
+  eventLast[slot] = rounded;
+  if(eventFull){
+    return true;
+  }
+  if(isnan(rounded) || isnan(last)){
+    return isnan(rounded) != isnan(last);
+  }
+  return rounded != last;
+}
+
+static void eventValue(xbuf& msg, double value, int decimals){
+  if(isnan(value) || isinf(value)){
+    msg.write("null");
+  }
+  else {
+    msg.printf_P(PSTR("%.*f"), decimals, value);
+  }
+}
+
+void eventPublish(){
+  if( ! eventSubscribers){
+    return;
+  }
+  trace(T_events,1);
+
+      // Drop subscribers that have gone away or stopped reading.
+
+  eventSubscriber** link = &eventSubscribers;
+  while(*link){
+    eventSubscriber* sub = *link;
+    if( ! sub->client.connected() || (millis() - sub->lastWrite) > EVENT_STALL_MS){
+      trace(T_events,2);
+      *link = sub->next;
+      delete sub;
+      continue;
+    }
+    link = &sub->next;
+  }
+  if( ! eventSubscribers){
+    delete[] eventLast;
+    eventLast = nullptr;
+    eventLastCount = 0;
+    return;
+  }
+
+  size_t count = maxInputs * 2;
+  for(Script* script=outputs ? outputs->first() : nullptr; script; script=script->next()){
+    count++;
+  }
+  if(count != eventLastCount){
+    delete[] eventLast;
+    eventLast = new float[count];
+    eventLastCount = count;
+    eventFull = true;
+  }
+  uint32_t now = UTCtime();
+  if((now - eventFullTime) >= EVENT_FULL_SEC){
+    eventFull = true;
+  }
+
+      // Serialize the changed values once for all subscribers.
+
+  trace(T_events,3);
+  xbuf msg;
+  bool changed = false;
+  msg.printf_P(PSTR("data: {\"time\":%lu"), (unsigned long)now);
+  if(eventFull){
+    msg.write(",\"full\":true");
+  }
+  msg.write(",\"inputs\":{");
+  for(int i=0; i<maxInputs; i++){
+    IotaInputChannel* channel = inputChannel[i];
+    if(channel->isActive() && channel->_type == channelTypeVoltage){
+      if(eventChanged(i*2, statRecord.accum1[i], 1) | eventChanged(i*2+1, statRecord.accum2[i], 2)){
+        msg.printf_P(PSTR("%s\"%d\":{\"Vrms\":"), changed ? "," : "", i);
+        eventValue(msg, statRecord.accum1[i], 1);
+        msg.write(",\"Hz\":");
+        eventValue(msg, statRecord.accum2[i], 2);
+        msg.write('}');
+        changed = true;
+      }
+    }
+    else if(channel->isActive() && channel->_type == channelTypePower){
+      double watts = statRecord.accum1[i];
+      if(watts > -2 && watts < 2) watts = 0;
+      double pf = statRecord.accum2[i];
+      if(pf != 0){
+        pf = statRecord.accum1[i] / pf;
+      }
+      if(eventChanged(i*2, watts, 0) | eventChanged(i*2+1, pf, 2)){
+        msg.printf_P(PSTR("%s\"%d\":{\"Watts\":"), changed ? "," : "", i);
+        eventValue(msg, watts, 0);
+        msg.write(",\"Pf\":");
+        eventValue(msg, pf, 2);
+        msg.write('}');
+        changed = true;
+      }
+    }
+  }
+  msg.write("},\"outputs\":{");
+  size_t slot = maxInputs * 2;
+  bool first = true;
+  for(Script* script=outputs ? outputs->first() : nullptr; script; script=script->next()){
+    double value = script->run((IotaLogRecord*)nullptr, &statRecord, 1.0);
+    if(eventChanged(slot++, value, script->precision())){
+      msg.printf_P(PSTR("%s\"%s\":"), first ? "" : ",", script->name());
+      eventValue(msg, value, script->precision());
+      first = false;
+      changed = true;
+    }
+  }
+  msg.write("}}\n\n");
+
+      // Nothing changed: just keep the connections alive.
+
+  if( ! changed && (now - eventSentTime) < EVENT_KEEPALIVE_SEC){
+    return;
+  }
+
+      // Frame as an HTTP chunk and fan out.  A subscriber that can't take
+      // the whole message skips it and gets a full snapshot next time.
+
+  trace(T_events,4);
+  size_t len = changed ? msg.available() : 3;
+  char* buf = new char[len + 8];
+  if(changed){
+    msg.read((uint8_t*)buf + 6, len);
+  }
+  else {
+    memcpy(buf + 6, ":\n\n", 3);
+  }
+  size_t framed = chunkFrame(buf, len + 6);
+  bool missed = false;
+  for(eventSubscriber* sub=eventSubscribers; sub; sub=sub->next){
+    if(sub->client.availableForWrite() >= framed){
+      sub->client.write((const uint8_t*)buf, framed);
+      sub->lastWrite = millis();
+    }
+    else {
+      missed = true;
+    }
+  }
+  delete[] buf;
+  if(eventFull){
+    eventFullTime = now;
+  }
+  eventFull = missed;
+  eventSentTime = now;
+}
@@ -0,0 +1,170 @@
+#include "IotaWatt.h"
+
+/*******************************************************************************************
+ * sendFileRange - If the request has a Range header, send the range (206), 416 if it
+ * can't be satisfied or 503 if too many jobs are queued, and return true.  The file then 
+ * belongs to the job.  Only a single range is supported, which is all download managers 
+ * and backup tools ask for.
+ * Returns false if there is no (usable) Range header, to send the whole file.
+ ******************************************************************************************/
+
+bool sendFileRange(File& file, const String& dataType){
+  if( ! server.hasHeader(F("Range"))){
+    return false;
+  }
+  String range = server.header(F("Range"));
+  if( ! range.startsWith(F("bytes=")) || range.indexOf(',') >= 0){
+    return false;
+  }
+  uint32_t size = file.size();
+  const char* spec = range.c_str() + 6;
+  char* end;
+  uint32_t first;
+  uint32_t last = size - 1;
+  if(*spec == '-'){
+    uint32_t suffix = strtoul(spec + 1, nullptr, 10);
+    first = (suffix >= size) ? 0 : size - suffix;
+  }
+  else {
+    first = strtoul(spec, &end, 10);
+    if(*end != '-'){
+      return false;
+    }
+    if(isdigit(*(end + 1))){
+      last = MIN(strtoul(end + 1, nullptr, 10), size - 1);
+    }
+  }
+  char contentRange[40];
+  if(size == 0 || first > last){
+    snprintf_P(contentRange, sizeof(contentRange), PSTR("bytes */%u"), size);
+    server.sendHeader(F("Content-Range"), contentRange);
+    server.send(416, txtPlain_P, "");
+    file.close();
+    return true;
+  }
+  trace(T_WEB,80);
+  fileRange* job = new fileRange(file, first, last - first + 1);
+  if( ! queryStart(job)){
+    delete job;
+    queryBusy();
+    return true;
+  }
+  snprintf_P(contentRange, sizeof(contentRange), PSTR("bytes %u-%u/%u"), first, last, size);
+  server.sendHeader(F("Content-Range"), contentRange);
+  server.sendHeader(F("Accept-Ranges"), F("bytes"));
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(206, dataType, "");
+  return true;
+}
+
+fileRange::fileRange(File file, uint32_t begin, uint32_t length)
+  :_file(file)
+  ,_remaining(length)
+  {
+    _file.seek(begin);
+  }
+
+fileRange::~fileRange(){
+  _file.close();
+}
+
+size_t fileRange::readResult(uint8_t* buf, int len){
+  if( ! _remaining){
+    return 0;
+  }
+  int read = _file.read(buf, MIN((uint32_t)len, _remaining));
+  if(read <= 0){
+    _remaining = 0;
+    return 0;
+  }
+  _remaining -= read;
+  return read;
+}
+
+/*******************************************************************************************
+ * handleLogExport - /logexport?log=current|history[&serial=n|&key=unixtime][&count=n]
+ * 
+ * Sends the records from serial n, or from the record at or before key, to the end of 
+ * the log (or count records) as raw IotaLogRecords, application/octet-stream.  The 
+ * response headers give the record size and serial range, so a backup can resume from 
+ * the serial after the last record it has.
+ ******************************************************************************************/
+
+void handleLogExport(){
+  trace(T_WEB,82);
+  IotaLog* log = &currLog;
+  if(server.hasArg(F("log")) && server.arg(F("log")) == "history"){
+    log = &histLog;
+  }
+  if( ! log->isOpen()){
+    server.send(400, txtPlain_P, F("Log not open."));
+    return;
+  }
+  int32_t serial = log->firstSerial();
+  if(server.hasArg(F("serial"))){
+    serial = MAX(server.arg(F("serial")).toInt(), log->firstSerial());
+  }
+  else if(server.hasArg(F("key"))){
+    uint32_t key = strtoul(server.arg(F("key")).c_str(), nullptr, 10);
+    if(key > log->lastKey()){
+      serial = log->lastSerial() + 1;
+    }
+    else if(key > log->firstKey()){
+      IotaLogRecord* record = new IotaLogRecord;
+      record->UNIXtime = key;
+      if(log->readKey(record) == 0){
+        serial = record->serial;
+      }
+      delete record;
+    }
+  }
+  int32_t endSerial = log->lastSerial();
+  if(server.hasArg(F("count"))){
+    endSerial = MIN(endSerial, serial + server.arg(F("count")).toInt() - 1);
+  }
+
+  logExport* job = new logExport(log, serial, endSerial);
+  if( ! queryStart(job)){
+    delete job;
+    queryBusy();
+    return;
+  }
+  char header[12];
+  snprintf_P(header, sizeof(header), PSTR("%u"), sizeof(IotaLogRecord));
+  server.sendHeader(F("X-IotaLog-RecordSize"), header);
+  snprintf_P(header, sizeof(header), PSTR("%d"), serial);
+  server.sendHeader(F("X-IotaLog-FirstSerial"), header);
+  snprintf_P(header, sizeof(header), PSTR("%d"), endSerial);
+  server.sendHeader(F("X-IotaLog-LastSerial"), header);
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "application/octet-stream", "");
+  trace(T_WEB,83);
+}
+
+logExport::logExport(IotaLog* log, int32_t serial, int32_t endSerial)
+  :_log(log)
+  ,_serial(serial)
+  ,_endSerial(endSerial)
+  {
+    _record = new IotaLogRecord;
+  }
+
+logExport::~logExport(){
+  delete _record;
+}
+
+    // Whole records only, so each chunk holds len / 256 of them.
+
+size_t logExport::readResult(uint8_t* buf, int len){
+  size_t size = 0;
+  while(_serial <= _endSerial && (len - size) >= sizeof(IotaLogRecord)){
+    if(_log->readSerial(_record, _serial) != 0){
+      _endSerial = _serial - 1;
+      break;
+    }
+    memcpy(buf + size, _record, sizeof(IotaLogRecord));
+    size += sizeof(IotaLogRecord);
+    _serial++;
+  }
+  return size;
+}
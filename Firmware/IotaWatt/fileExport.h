@@ -0,0 +1,42 @@
+#pragma once
+
+#include "IotaWatt.h"
+
+/*******************************************************************************************************
+ * Responses for backing up the SD, run by queryService like a query so they don't hold up the
+ * web server:
+ * 
+ * fileRange sends part of a file, for HTTP Range requests.
+ * 
+ * logExport sends IotaLogRecords of currLog or histLog in serial order.  The log handles the
+ * wrap, and compact (version 2) records are expanded, so the export is always full records.
+ ******************************************************************************************************/
+
+class fileRange : public queryResult {
+
+    public:
+        fileRange(File file, uint32_t begin, uint32_t length);
+        ~fileRange();
+        size_t  readResult(uint8_t* buf, int len);
+
+    private:
+        File        _file;
+        uint32_t    _remaining;             // Bytes yet to send
+};
+
+class logExport : public queryResult {
+
+    public:
+        logExport(IotaLog* log, int32_t serial, int32_t endSerial);
+        ~logExport();
+        size_t  readResult(uint8_t* buf, int len);
+
+    private:
+        IotaLog*        _log;
+        IotaLogRecord*  _record;
+        int32_t         _serial;            // Next serial to send
+        int32_t         _endSerial;         // Last serial to send
+};
+
+bool  sendFileRange(File& file, const String& dataType);
+void  handleLogExport();
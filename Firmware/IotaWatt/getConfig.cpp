@@ -25,11 +25,31 @@ bool configInputs(const char*);
 bool configOutputs(const char*);
 void hashFile(uint8_t* sha, File file);
 void buildPhaseTable(phaseTableEntry**);
+void phaseTableSection(phaseTableEntry**, File, JsonArray&);
 void phaseTableAdd(phaseTableEntry**, JsonArray&);
 int16_t* buildPtable(JsonArray& table, const char* model);
 int16_t* copyPtable(int16_t* Ptable);
 String old2newScript(JsonArray& script);
 
+      // Each section of the running configuration is remembered by the hash of its
+      // condensed text, so a reload only rebuilds the sections that changed.
+
+enum configSection {configSectDevice, configSectDST, configSectInputs, configSectOutputs, 
+                    configSectEmon, configSectInflux, configSectPVoutput, configSections};
+static uint32_t configHash[configSections] = {0};
+
+      // Returns true if the section text (nullptr if absent) differs from the
+      // running configuration, and records the new hash.
+
+static bool configChanged(configSection section, const char* str){
+  uint32_t hash = str ? hashFNV(2166136261UL, str, strlen(str)) : 0;
+  if(hash == configHash[section]){
+    return false;
+  }
+  configHash[section] = hash;
+  return true;
+}
+
 boolean getConfig(const char* configPath){
 
   DynamicJsonBuffer Json;              
@@ -68,21 +88,27 @@ boolean getConfig(const char* configPath){
   JsonArray& deviceArray = Config["device"];
   if(deviceArray.success()){
     char* deviceStr = JsonDetail(ConfigFile, deviceArray);
-    configDevice(deviceStr);
+    if(configChanged(configSectDevice, deviceStr)){
+      configDevice(deviceStr);
+      configHash[configSectInputs] = 0;           // Channels may have been added
+    }
     delete[] deviceStr;
   }  
 
         //************************************ Configure DST rule *********************************
 
   trace(T_CONFIG,6);
-  delete timezoneRule;
-  timezoneRule = nullptr;
   JsonArray& dstruleArray = Config["dstrule"];
-  if(dstruleArray.success()){
-    char* dstruleStr = JsonDetail(ConfigFile, dstruleArray);
-    configDST(dstruleStr);
-    delete[] dstruleStr;
-  }  
+  char* dstruleStr = dstruleArray.success() ? JsonDetail(ConfigFile, dstruleArray) : nullptr;
+  if(configChanged(configSectDST, dstruleStr)){
+    delete timezoneRule;
+    timezoneRule = nullptr;
+    if(dstruleStr){
+      configDST(dstruleStr);
+    }
+  }
+  delete[] dstruleStr;
+  DSTtableReset();
 
         //************************************ Configure input channels ***************************
 
@@ -90,10 +116,26 @@ boolean getConfig(const char* configPath){
   JsonArray& inputsArray = Config["inputs"];
   if(inputsArray.success()){
     char* inputsStr = JsonDetail(ConfigFile, inputsArray);
-    configInputs(inputsStr);
+    if(configChanged(configSectInputs, inputsStr)){
+      configInputs(inputsStr);
+    }
     delete[] inputsStr;
   }
 
+        // Compact log format applies when a new log is created.
+        // Compact logs put the channels that are active now in their columns.
+
+  uint16_t channels = 0;
+  for(int i=0; i<maxInputs; i++){
+    if(inputChannel[i]->isActive()) channels |= 1 << i;
+  }
+  currLog.setChannels(channels);
+  histLog.setChannels(channels);
+  if(Config.containsKey(F("logformat"))){
+    currLog.setFormat(Config[F("logformat")].as<int>(), channels);
+    histLog.setFormat(Config[F("logformat")].as<int>(), channels);
+  }
+
     // Print the inputs
 
   // for(int i=0; i<MAXINPUTS; i++){
@@ -126,8 +168,6 @@ boolean getConfig(const char* configPath){
 
   {      
     trace(T_CONFIG,8);
-    delete outputs;
-    outputs = nullptr;
     JsonArray& outputsArray = Config["outputs"];
     char* outputsStr;
     if(outputsArray.success()){
@@ -135,7 +175,11 @@ boolean getConfig(const char* configPath){
     } else {
       outputsStr = charstar("[]");
     }
-    configOutputs(outputsStr);
+    if(configChanged(configSectOutputs, outputsStr)){
+      delete outputs;
+      outputs = nullptr;
+      configOutputs(outputsStr);
+    }
     delete[] outputsStr;
   }
 
@@ -154,15 +198,17 @@ boolean getConfig(const char* configPath){
         EmonStr = JsonDetail(ConfigFile, serverArray);
       }
     }
-    if(EmonStr){
-      if( ! EmonConfig(EmonStr)){
-        log("EmonService: Invalid configuration.");
+    if(configChanged(configSectEmon, EmonStr)){
+      if(EmonStr){
+        if( ! EmonConfig(EmonStr)){
+          log("EmonService: Invalid configuration.");
+        }
+      }   
+      else {
+        EmonStop = true;
       }
-      delete[] EmonStr;
-    }   
-    else {
-      EmonStop = true;
     }
+    delete[] EmonStr;
   }
 
         // ************************************** configure influxDB **********************************
@@ -170,35 +216,39 @@ boolean getConfig(const char* configPath){
   {
     trace(T_CONFIG,10);
     JsonArray& influxArray = Config[F("influxdb")];
-    if(influxArray.success()){
-      char* influxStr = JsonDetail(ConfigFile, influxArray);
-      if( ! influxConfig(influxStr)){
-        log("influxService: Invalid configuration.");
+    char* influxStr = influxArray.success() ? JsonDetail(ConfigFile, influxArray) : nullptr;
+    if(configChanged(configSectInflux, influxStr)){
+      if(influxStr){
+        if( ! influxConfig(influxStr)){
+          log("influxService: Invalid configuration.");
+        }
+      }   
+      else {
+        influxStop = true;
       }
-      delete[] influxStr;
-    }   
-    else {
-      influxStop = true;
     }
+    delete[] influxStr;
   }
       // ************************************** configure PVoutput **********************************
 
   {
     trace(T_CONFIG,11);
     JsonArray& PVoutputArray = Config[F("pvoutput")];
-    if(PVoutputArray.success()){
-      char* PVoutputStr = JsonDetail(ConfigFile, PVoutputArray);
-      if(! pvoutput){
-        pvoutput = new PVoutput();
-      }
-      if( ! pvoutput->config(PVoutputStr)){
-        log("PVoutput: Invalid configuration."); 
+    char* PVoutputStr = PVoutputArray.success() ? JsonDetail(ConfigFile, PVoutputArray) : nullptr;
+    if(configChanged(configSectPVoutput, PVoutputStr)){
+      if(PVoutputStr){
+        if(! pvoutput){
+          pvoutput = new PVoutput();
+        }
+        if( ! pvoutput->config(PVoutputStr)){
+          log("PVoutput: Invalid configuration."); 
+        } 
+      }   
+      else if(pvoutput){
+        pvoutput->end();
       } 
-      delete[] PVoutputStr;
-    }   
-    else if(pvoutput){
-      pvoutput->end();
-    } 
+    }
+    delete[] PVoutputStr;
     
     ConfigFile.close();
     trace(T_CONFIG,12);
@@ -228,6 +278,35 @@ bool configDevice(const char* JsonStr){
   if(device.containsKey(F("refvolts"))){
     VrefVolts = device[F("refvolts")].as<float>();
   }  
+
+  samplePairs = device.containsKey(F("samplepairs")) && device[F("samplepairs")].as<bool>();
+  if(samplePairs && ! I2sample){
+    I2sample = new int16_t[MAX_SAMPLES];
+  }
+  if( ! samplePairs && I2sample){
+    delete[] I2sample;
+    I2sample = nullptr;
+  }
+
+  powerQuality = device.containsKey(F("powerquality")) && device[F("powerquality")].as<bool>();
+
+  uint16_t realtime = 0;
+  if(device[F("realtime")].is<JsonArray>()){
+    JsonArray& channelList = device[F("realtime")];
+    for(int i=0; i<channelList.size(); i++){
+      int channel = channelList[i].as<int>();
+      if(channel >= 0 && channel < MAXINPUTS) realtime |= 1 << channel;
+    }
+  }
+  else if(device[F("realtime")].as<bool>()){
+    realtime = (1 << MAXINPUTS) - 1;
+  }
+  realtimeBegin(realtime);
+
+  sampleMaxCycles = 1;
+  if(device.containsKey(F("samplecycles"))){
+    sampleMaxCycles = constrain(device[F("samplecycles")].as<unsigned int>(), 1, 8);
+  }
   
           // Build or update the input channels
           
@@ -455,21 +534,38 @@ String old2newScript(JsonArray& script){
 }
 
 //********************************** buildPhaseTable ***********************************************
+    // The tables file is summarized like the config, and the VT and CT
+    // tables parsed one at a time, so only one is in a JsonBuffer at once.
+
 void buildPhaseTable(phaseTableEntry** phaseTable){
   DynamicJsonBuffer Json;              
   File TableFile;
   String TableFileURL = "tables.txt";
   TableFile = SD.open(TableFileURL, FILE_READ);
   if(!TableFile) return;
-  JsonObject& Table = Json.parse(TableFile);
+  String tableSummary = JsonSummary(TableFile, 1);
+  JsonObject& Table = Json.parseObject(tableSummary);
+  if(Table.success()){
+    if(Table.containsKey("VT")) phaseTableSection(phaseTable, TableFile, Table["VT"]);
+    if(Table.containsKey("CT")) phaseTableSection(phaseTable, TableFile, Table["CT"]);
+  }
   TableFile.close();
-  if(!Table.success()) return;
-  if(Table.containsKey("VT")) phaseTableAdd(phaseTable, Table["VT"]);
-  if(Table.containsKey("CT")) phaseTableAdd(phaseTable, Table["CT"]);
   configFrequency = frequency;
   return;  
 }
 
+void phaseTableSection(phaseTableEntry** phaseTable, File TableFile, JsonArray& locator){
+  char* sectionStr = JsonDetail(TableFile, locator);
+  {
+    DynamicJsonBuffer Json;
+    JsonArray& table = Json.parseArray(sectionStr);
+    if(table.success()){
+      phaseTableAdd(phaseTable, table);
+    }
+  }
+  delete[] sectionStr;
+}
+
 void phaseTableAdd(phaseTableEntry** phaseTable, JsonArray& table){
   int size = table.size();
   char modelHash[9];
@@ -37,4 +37,96 @@ void getSamples(){ //(struct serviceBlock* _serviceBlock){
   sendChunk(buf, 6);
   trace(T_GFD,7);
   delete[] buf;
-}
\ No newline at end of file
+}
+
+/*****************************************************************************************
+ * getWaveform(channel, cycles)
+ * 
+ * Capture consecutive cycles of a channel and its voltage reference into RAM, then send
+ * them as packed binary.  Each cycle is a separate sampleCycle, so the next one begins at
+ * the following zero crossing (a half cycle later, opposite polarity).  The micros() 
+ * timestamps of the crossings place each cycle exactly in time.  Capture stops early 
+ * when the heap budget would be exceeded.
+ * 
+ * All fields little-endian, no padding.
+ * 
+ * Header:
+ *      char[4]     "IWWF"
+ *      uint8       version (1)
+ *      uint8       channel
+ *      uint8       voltage reference channel
+ *      uint8       number of cycles that follow
+ *      float32     channel calibration
+ *      float32     voltage reference calibration
+ *      float32     line frequency
+ * Cycles:
+ *      uint32      micros() at first crossing
+ *      uint32      microseconds first to last crossing
+ *      uint16      samples (n)
+ *      int16[n]    voltage samples (ADC counts, offset removed)
+ *      int16[n]    current samples
+ ****************************************************************************************/
+
+#define WAVEFORM_MAX_CYCLES 32
+#define WAVEFORM_HEAP_RESERVE 12000             // Leave this much heap
+
+void getWaveform(int channel, int cycles){
+  trace(T_GFD,8);
+  if(channel < 0 || channel >= maxInputs || ! inputChannel[channel]->isActive()){
+    server.send(400, txtPlain_P, F("Invalid channel"));
+    return;
+  }
+  IotaInputChannel* Ichannel = inputChannel[channel];
+  IotaInputChannel* Vchannel = Ichannel->_type == channelTypePower ? inputChannel[Ichannel->_vchannel] : Ichannel;
+  cycles = constrain(cycles, 1, WAVEFORM_MAX_CYCLES);
+
+      // Capture. 
+
+  xbuf wave;
+  uint8_t captured = 0;
+  int failures = 0;
+  while(captured < cycles && failures < 10){
+    size_t cycleBytes = 10 + (samples + 1) * 4;
+    if(ESP.getFreeHeap() < WAVEFORM_HEAP_RESERVE + cycleBytes){
+      break;
+    }
+    if(sampleCycle(Vchannel, Ichannel)){              // Low sample count (interrupted) or failure
+      failures++;
+      continue;
+    }
+    uint16_t count = samples;
+    wave.write((uint8_t*)&sampleCrossUs, 4);
+    wave.write((uint8_t*)&sampleCycleUs, 4);
+    wave.write((uint8_t*)&count, 2);
+    wave.write((uint8_t*)Vsample, count * 2);
+    wave.write((uint8_t*)Isample, count * 2);
+    captured++;
+  }
+  trace(T_GFD,9);
+
+      // Send header, then the capture, chunky style.
+
+  size_t chunkSize = 1400;
+  char* buf = new char[chunkSize+8];
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "application/octet-stream", "");
+  uint8_t hdr[8] = {'I','W','W','F',1, (uint8_t)Ichannel->_channel, (uint8_t)Vchannel->_channel, captured};
+  float cal[3] = {Ichannel->_calibration, Vchannel->_calibration, frequency};
+  memcpy(buf+6, hdr, 8);
+  memcpy(buf+14, cal, 12);
+  int bufPos = 26;
+  while(wave.available()){
+    size_t len = MIN(wave.available(), chunkSize + 6 - bufPos);
+    wave.read((uint8_t*)buf+bufPos, len);
+    bufPos += len;
+    if(bufPos >= chunkSize + 6){
+      sendChunk(buf, bufPos);
+      bufPos = 6;
+    }
+  }
+  if(bufPos > 6){
+    sendChunk(buf, bufPos);
+  }
+  sendChunk(buf, 6);
+  delete[] buf;
+}
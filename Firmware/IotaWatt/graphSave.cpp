@@ -54,7 +54,9 @@ void handleGraphGetall(){
     server.send(200, appJson_P, "[]");
     return;
   }
-  String response = "[";
+  jsonStream json;
+  json.begin(200, appJson_P);
+  json.beginArray();
   while(graphFile){
     uint32_t fileSize = graphFile.size();
     char* bufr = new char[fileSize];
@@ -63,11 +65,10 @@ void handleGraphGetall(){
     char* ptr = bufr;
     for(int i=0; i<fileSize-9; i++){
       if(memcmp(ptr++, "\"start\"", 7) == 0){
-        if( ! response.endsWith("[")) response += ',';
-        response += bufr;
-        response += ",\"id\":\"";
-        response += graphFile.name();
-        response += "\"}";
+        json.rawValue(bufr);
+        json.raw(",\"id\":\"");
+        json.raw(graphFile.name());
+        json.raw("\"}");
         break;
       }   
     }
@@ -75,8 +76,7 @@ void handleGraphGetall(){
     graphFile.close();
     graphFile = directory.openNextFile();
   }
-  response += ']';
-  server.send(200, appJson_P, response);
+  json.end();
   directory.close();
   return;
 }
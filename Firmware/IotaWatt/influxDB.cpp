@@ -12,6 +12,7 @@ uint32_t  influxLastPost = 0;                       // Last acknowledge post for
 uint16_t  influxBulkSend = 1;                       
 uint16_t  influxPort = 8086;
 int32_t   influxRevision = -1;                      // Revision control for dynamic config
+uint32_t  influxSignature = 0;                      // Hash of config, identifies checkpoint
 uint32_t  influxBeginPosting = 0;                   // Begin date specified in config
 char*     influxUser = nullptr;
 char*     influxPwd = nullptr; 
@@ -22,6 +23,8 @@ char*     influxURL = nullptr;
 char*     influxDataBase = nullptr;
 influxTag* influxTagSet = nullptr;  
 ScriptSet* influxOutputs;      
+char**    influxPrefix = nullptr;                   // Line protocol up to the value, per output
+size_t    influxPrefixCount = 0;
 
 uint32_t influxService(struct serviceBlock* _serviceBlock){
 
@@ -34,14 +37,20 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
                  getLastRecord,     // Read the logRec and prep the context for logging
                  post,              // Add a measurement to the reqData xbuf
                  sendPost,          // Send the accumulated measurements
-                 waitPost};         // Wait for the [async] post to complete
+                 waitPost};         // Check the result of the completed [async] post
+
+      // Posts are pipelined.  asyncHTTPrequest takes the contents of reqData when sent,
+      // so while a post is in flight, the post state builds the next batch in reqData.
+      // When the post completes, waitPost checks the result before another is sent.
+      // The batch size limit grows while posts succeed and heap allows, and is cut
+      // back on failure or when heap is short.
 
   static states state = initialize;
-  static IotaLogRecord* logRecord = nullptr;
-  static IotaLogRecord* oldRecord = nullptr;
   static uint32_t lastRequestTime = 0;          // Time of last measurement in last or current request
   static uint32_t lastBufferTime = 0;           // Time of last measurement reqData buffer
   static uint32_t UnixNextPost = UTCtime();    // Next measurement to be posted
+  static IotaLogCursor cursor(&currLog);       // Position in log of last measurement
+  static IotaLogRecord* logRecord = nullptr;    // Scratch record to position and skip gaps
   static xbuf reqData;                          // Current request buffer
   static uint32_t reqUnixtime = 0;              // First measurement in current reqData buffer
   static int  reqEntries = 0;                   // Number of measurement intervals in current reqData
@@ -49,9 +58,13 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
   static asyncHTTPrequest* request = nullptr;   // -> instance of asyncHTTPrequest
   static uint32_t postFirstTime = UTCtime();   // First measurement in outstanding post request
   static uint32_t postLastTime = UTCtime();    // Last measurement in outstanding post request
-  static size_t reqDataLimit = 3000;            // transaction yellow light size
+  static uploadControl control(INFLUX_REQDATA_MIN, INFLUX_REQDATA_MAX);  // Batch size, timeout and backoff
+  static bool postPending = false;              // A post is in flight
   static uint32_t HTTPtoken = 0;                // HTTP resource reservation token
   static Script* script = nullptr;              // current Script
+  static uint32_t queriedLast = 0;              // Latest time from LAST() queries
+  static uint32_t resumePost = 0;               // Checkpoint resumed from, zero when verified
+  static bool verifying = false;                // LAST() queries are verifying the checkpoint
 
 
   trace(T_influx,0);                            // Announce entry
@@ -75,6 +88,19 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
       }
       log("influxDB: started, url=%s:%d, db=%s, interval=%d", influxURL, influxPort,
               influxDataBase, influxDBInterval);
+
+          // If there's a checkpoint for this configuration, start from it
+          // and verify with the server later.
+
+      control.checkpoint(INFLUX_CHECKPOINT, influxSignature);
+      resumePost = control.resume();
+      verifying = false;
+      if(resumePost){
+        influxLastPost = resumePost - (resumePost % influxDBInterval);
+        log("influxDB: Resume posting at %s", localDateString(influxLastPost + influxDBInterval).c_str());
+        state = getLastRecord;
+        return 1;
+      }
       state = queryLastPostTime;
       trace(T_influx,2);
       return 1;
@@ -83,7 +109,7 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
  //********************************************************* queryLastPostTime *****************************
     case queryLastPostTime:{
       trace(T_influx,3);
-      influxLastPost = influxBeginPosting;
+      queriedLast = influxBeginPosting;
       script = influxOutputs->first();
       retryCount = 0;
       trace(T_influx,4);
@@ -138,6 +164,9 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
         reqData.printf_P(PSTR(" %s %s=\'%s\'"), tag == influxTagSet ? "WHERE" : "AND", tag->key, influxVarStr(tag->value, script).c_str());
         tag = tag->next;
       }
+      if(verifying){
+        reqData.printf_P(PSTR(" %s time <= %us"), influxTagSet ? "AND" : "WHERE", resumePost);
+      }
       
           // Send the request
 
@@ -216,8 +245,8 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
           if(columns.success() && values.success()){
             for(int i=0; i<columns.size(); i++){
               if(strcmp("time",columns[i].as<char*>()) == 0){
-                if(values[i].as<unsigned long>() > influxLastPost){
-                  influxLastPost = values[i].as<unsigned long>();
+                if(values[i].as<unsigned long>() > queriedLast){
+                  queriedLast = values[i].as<unsigned long>();
                 }
                 break;
               }
@@ -239,36 +268,55 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
         state = queryLast;
         return 1;
       }
+      delete request;
+      request = nullptr;
+
+          // Verifying a checkpoint, the server should have data up to about there.
+          // If it's well behind, back up and post from where the server left off.
+
+      if(verifying){
+        verifying = false;
+        if(queriedLast && (queriedLast + UPLOAD_CHECKPOINT_SEC + influxDBInterval) < resumePost){
+          influxLastPost = queriedLast - (queriedLast % influxDBInterval);
+          log("influxDB: Checkpoint ahead of server, resume posting at %s", localDateString(influxLastPost + influxDBInterval).c_str());
+          resumePost = 0;
+          state = getLastRecord;
+          return 1;
+        }
+        resumePost = 0;
+        state = post;
+        return 1;
+      }
 
+      influxLastPost = queriedLast;
       if(influxLastPost == 0){
         influxLastPost = UTCtime();
       }
       influxLastPost -= influxLastPost % influxDBInterval;
       log("influxDB: Start posting at %s", localDateString(influxLastPost + influxDBInterval).c_str());
-      delete request;
-      request = nullptr;
       state = getLastRecord;
       return 1;
     }
 
     case getLastRecord: {
       trace(T_influx,6);   
-      if( ! oldRecord){
-        oldRecord = new IotaLogRecord;
+      if( ! logRecord){
+        logRecord = new IotaLogRecord;
       }
-      oldRecord->UNIXtime = influxLastPost;      
-      currLog.readKey(oldRecord);
+      cursor.reset();
+      cursor.read(logRecord, influxLastPost);
       trace(T_influx,6);
 
           // Assume that record was posted (not important).
           // Plan to start posting one interval later
       
-      UnixNextPost = oldRecord->UNIXtime + influxDBInterval - (oldRecord->UNIXtime % influxDBInterval);
+      UnixNextPost = logRecord->UNIXtime + influxDBInterval - (logRecord->UNIXtime % influxDBInterval);
       
           // Advance state.
 
       reqData.flush();
       reqEntries = 0;
+      postPending = false;
       state = post;
       return UnixNextPost;
     }
@@ -277,6 +325,13 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
     case post: {
       trace(T_influx,7);
 
+          // If the post in flight has completed, check the result.
+
+      if(postPending && request && request->readyState() == 4){
+        state = waitPost;
+        return 1;
+      }
+
           // If stop requested, do it now.
 
       if(influxStop || influxRestart) {
@@ -290,8 +345,6 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
         } else {
           log("influxDB: Stopped. Last post %s", localDateString(influxLastPost).c_str());
           trace(T_influx,72);    
-          delete oldRecord;
-          oldRecord = nullptr;
           delete logRecord;
           logRecord = nullptr;
           delete request;
@@ -313,12 +366,21 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
           influxDataBase = nullptr;
           delete influxTagSet;
           influxTagSet = nullptr;  
-          delete influxTagSet;
-          influxOutputs;      
+          influxFreePrefixes();
+          delete influxOutputs;
+          influxOutputs = nullptr;      
           influxStarted = false;
           return 0;
         }
         
+      }
+
+          // Once caught up and idle, verify a resumed checkpoint with the server.
+
+      if(resumePost && ! postPending && reqEntries == 0 && UnixNextPost > currLog.lastKey()){
+        verifying = true;
+        state = queryLastPostTime;
+        return 1;
       }
 
           // If not enough entries for bulk-send, come back in one second;
@@ -330,23 +392,20 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
           // If buffer isn't full,
           // add another measurement.
 
-      if(reqData.available() < reqDataLimit && UnixNextPost <= currLog.lastKey()){  
+      if(reqData.available() < control.batchLimit() && UnixNextPost <= currLog.lastKey()){  
 
-            // Read the next log record.
+            // Get the shared frame for this interval.
 
-        if( ! logRecord){
-          logRecord = new IotaLogRecord;            
-        }
         trace(T_influx,7);
-        logRecord->UNIXtime = UnixNextPost;
-        currLog.readKey(logRecord);
+        intervalFrame* frame = getIntervalFrame(UnixNextPost, influxDBInterval, &cursor);
         trace(T_influx,7);
         
             // Compute the time difference between log entries.
             // If zero, don't bother.
             
-        double elapsedHours = logRecord->logHours - oldRecord->logHours;
+        double elapsedHours = frame->elapsedHours;
         if(elapsedHours == 0){
+          logRecord->serial = frame->newRec->serial;
           if(currLog.readNext(logRecord) == 0) {
             UnixNextPost = logRecord->UNIXtime - (logRecord->UNIXtime % influxDBInterval);
           }
@@ -360,28 +419,19 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
       
         script = influxOutputs->first();
         trace(T_influx,7);
-        while(script){
-          double value = script->run(oldRecord, logRecord, elapsedHours);
+        for(size_t ndx=0; script; ndx++){
+          double value = frame->run(script);
           if(value == value){
-            reqData.write(influxVarStr(influxMeasurement, script));
-            if(influxTagSet){
-              trace(T_influx,71);
-              influxTag* tag = influxTagSet;
-              while(tag){
-                reqData.printf_P(PSTR(",%s=%s"), tag->key, influxVarStr(tag->value, script).c_str());
-                tag = tag->next;
-              }
+            if(ndx < influxPrefixCount){
+              reqData.write(influxPrefix[ndx]);
+            }
+            else {
+              reqData.write(influxLinePrefix(script));
             }
-            reqData.printf_P(PSTR(" %s=%.*f"), influxVarStr(influxFieldKey, script).c_str(), script->precision(), value);
-            reqData.printf(" %d\n", UnixNextPost);
+            reqData.printf_P(PSTR("%.*f %d\n"), script->precision(), value, UnixNextPost);
           }
           script = script->next();
         }
-        trace(T_influx,7);
-        delete oldRecord;
-        oldRecord = logRecord;
-        logRecord = nullptr;
-        
         trace(T_influx,7);  
         reqEntries++;
         lastBufferTime = UnixNextPost;
@@ -391,8 +441,8 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
             // If there's no request pending and we have bulksend entries,
             // set to post.
 
-      if((( ! request || request->readyState() == 4) && HTTPrequestFree) && 
-          (reqEntries >= influxBulkSend || reqData.available() >= reqDataLimit)){
+      if((( ! postPending && ( ! request || request->readyState() == 4)) && HTTPrequestFree) && 
+          (reqEntries >= influxBulkSend || reqData.available() >= control.batchLimit())){
         state = sendPost;
         if(influxLogHeap && heapMsPeriod != 0){
           reqData.printf_P(PSTR("heap"));
@@ -421,7 +471,7 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
       if( ! request){
         request = new asyncHTTPrequest;
       }
-      request->setTimeout(3);
+      request->setTimeout(control.timeout());
       request->setDebug(false);
       if(request->debug()){
         Serial.println(ESP.getFreeHeap()); 
@@ -455,31 +505,40 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
         request->setReqHeader("Authorization", auth.c_str()); 
       }
       request->send(&reqData, reqData.available());
+      control.sent();
       reqEntries = 0;
       lastRequestTime = lastBufferTime;
-      state = waitPost;
-        1;
+      postPending = true;
+      state = post;
+      return 1;
     } 
 
     case waitPost: {
       trace(T_influx,9);
+      if( ! request || request->readyState() != 4){
+        state = post;
+        return 1;
+      }
       if(request && request->readyState() == 4){
+        postPending = false;
         HTTPrelease(HTTPtoken);
         trace(T_influx,9);
         if(request->responseHTTPcode() < 0){
-          if(++retryCount == 50){
+          uint32_t retryTime = control.failure();
+          if(control.failures() == 10){
             log("influxDB: Post Failed: %d", request->responseHTTPcode());
           }
           delete request;
           request = nullptr; 
           state = getLastRecord;
-          return UTCtime() + (retryCount < 30 ? 1 : retryCount / 10);
+          return retryTime;
         }
 
             // Check for unsuccessful post.
 
         if(request->responseHTTPcode() != 204){
-          if(++retryCount == 10){
+          uint32_t retryTime = control.failure();
+          if(control.failures() == 10){
             DynamicJsonBuffer Json;
             JsonObject& results = Json.parseObject(request->responseText().c_str());
             if(results.success()){ 
@@ -491,12 +550,16 @@ uint32_t influxService(struct serviceBlock* _serviceBlock){
           delete request;
           request = nullptr; 
           state = getLastRecord;
-          return UTCtime() + (retryCount < 10 ? 1 : 30);
+          return retryTime;
         }
 
         trace(T_influx,9);
-        retryCount = 0;
+        if(control.failures() >= 10){
+          log("influxDB: Retry successful after %d attempts.", control.failures());
+        }
+        control.success();
         influxLastPost = lastRequestTime; 
+        control.posted(influxLastPost);
         state = post;
         trace(T_influx,9);
       }
@@ -523,6 +586,7 @@ bool influxConfig(const char* configObj){
   }
   trace(T_influxConfig,0);
   influxRevision = revision;
+  influxSignature = hashFNV(2166136261UL, configObj, strlen(configObj));
   influxStop = config["stop"].as<bool>();
   influxLogHeap = config["heap"].as<bool>();
   String URL = config.get<String>("url");
@@ -582,12 +646,14 @@ bool influxConfig(const char* configObj){
     }
   }
 
+  influxFreePrefixes();
   delete influxOutputs;
   influxOutputs = nullptr;
   JsonVariant var = config["outputs"];
   if(var.success()){
     trace(T_influxConfig,9);
     influxOutputs = new ScriptSet(var.as<JsonArray>()); 
+    influxBuildPrefixes();
   }
   if( ! influxStarted) {
     trace(T_influxConfig,10);
@@ -621,3 +687,42 @@ String influxVarStr(const char* in, Script* script){
   return out;
 }
 
+
+    // The measurement, tags and field key don't change from one interval to the next,
+    // so the line protocol for each output up to the value is rendered once at config
+    // time and the post just appends value and timestamp.
+
+String influxLinePrefix(Script* script){
+  String line = influxVarStr(influxMeasurement, script);
+  influxTag* tag = influxTagSet;
+  while(tag){
+    line += ',';
+    line += tag->key;
+    line += '=';
+    line += influxVarStr(tag->value, script);
+    tag = tag->next;
+  }
+  line += ' ';
+  line += influxVarStr(influxFieldKey, script);
+  line += '=';
+  return line;
+}
+
+void influxBuildPrefixes(){
+  influxFreePrefixes();
+  influxPrefix = new char*[influxOutputs->count()];
+  Script* script = influxOutputs->first();
+  while(script){
+    influxPrefix[influxPrefixCount++] = charstar(influxLinePrefix(script).c_str());
+    script = script->next();
+  }
+}
+
+void influxFreePrefixes(){
+  for(size_t i=0; i<influxPrefixCount; i++){
+    delete[] influxPrefix[i];
+  }
+  delete[] influxPrefix;
+  influxPrefix = nullptr;
+  influxPrefixCount = 0;
+}
@@ -3,6 +3,10 @@
 #include "IotaWatt.h"
 #include "xbuf.h"
 
+#define INFLUX_REQDATA_MIN 3000             // Initial and minimum batch size
+#define INFLUX_REQDATA_MAX 12000            // Maximum batch size
+#define INFLUX_CHECKPOINT "/influx.ckp"     // SPIFFS upload checkpoint
+
 struct influxTag {
   influxTag* next;
   char*      key;
@@ -22,6 +26,9 @@ struct influxTag {
 uint32_t influxService(struct serviceBlock* _serviceBlock);
 bool influxConfig(const char*);
 String influxVarStr(const char*, Script*);
+String influxLinePrefix(Script*);
+void influxBuildPrefixes();
+void influxFreePrefixes();
 
 extern bool     influxStarted;                    // set true when Service started
 extern bool     influxStop;                       // set true to stop the Service
@@ -31,6 +38,7 @@ extern uint32_t influxLastPost;                   // Timestamp of last cuccessfu
 extern uint16_t influxBulkSend;
 extern uint16_t influxPort;
 extern int32_t  influxRevision;                   // Revision control for dynamic config
+extern uint32_t influxSignature;                  // Hash of config, identifies checkpoint
 extern uint32_t influxBeginPosting;               // time to begin posting new dataset
 extern char*    influxUser;
 extern char*    influxPwd;
@@ -40,4 +48,6 @@ extern char*    influxFieldKey;
 extern char*    influxURL;
 extern char*    influxDataBase;
 extern influxTag* influxTagSet;  
-extern ScriptSet* influxOutputs;
\ No newline at end of file
+extern ScriptSet* influxOutputs;
+extern char**   influxPrefix;                     // Line protocol up to the value, per output
+extern size_t   influxPrefixCount;
\ No newline at end of file
@@ -0,0 +1,80 @@
+/*******************************************************************************************************
+ * getIntervalFrame returns the shared frame for the interval ending at key, reading the records
+ * from the current log on a miss.  When the frame for the previous interval is cached, its new
+ * record is the old record of this one and isn't read again.
+ * Frames that extend beyond the end of the log are returned but not cached.
+ * A service stepping through the log passes its cursor, so records are read forward from
+ * its last position rather than looked up.
+ ******************************************************************************************************/
+#include "IotaWatt.h"
+
+intervalFrame* intervalFrames[INTERVAL_FRAMES] = {nullptr};
+uint32_t       intervalFrameSeq = 0;
+
+intervalFrame* getIntervalFrame(uint32_t key, uint32_t interval, IotaLogCursor* cursor){
+  intervalFrame* lru = nullptr;
+  intervalFrame* prior = nullptr;
+  for(int i=0; i<INTERVAL_FRAMES; i++){
+    if( ! intervalFrames[i]){
+      intervalFrames[i] = new intervalFrame;
+    }
+    intervalFrame* frame = intervalFrames[i];
+    if(frame->key == key && frame->interval == interval){
+      frame->used = ++intervalFrameSeq;
+      return frame;
+    }
+    if(frame->key && frame->key == (key - interval) && frame->interval == interval){
+      prior = frame;
+    }
+    if( ! lru || frame->used < lru->used){
+      lru = frame;
+    }
+  }
+  if(prior){
+    if(prior != lru){
+      memcpy(lru->oldRec, prior->newRec, sizeof(IotaLogRecord));
+    }
+    else {
+      IotaLogRecord* swap = lru->oldRec;
+      lru->oldRec = lru->newRec;
+      lru->newRec = swap;
+    }
+  }
+  else {
+    lru->oldRec->UNIXtime = key - interval;
+    if(cursor){
+      cursor->read(lru->oldRec, key - interval);
+    }
+    else {
+      currLog.readKey(lru->oldRec);
+    }
+  }
+  lru->newRec->UNIXtime = key;
+  if(cursor){
+    cursor->read(lru->newRec, key);
+  }
+  else {
+    currLog.readKey(lru->newRec);
+  }
+  lru->key = (key <= currLog.lastKey()) ? key : 0;
+  lru->interval = interval;
+  lru->elapsedHours = lru->newRec->logHours - lru->oldRec->logHours;
+  lru->values = 0;
+  lru->used = ++intervalFrameSeq;
+  return lru;
+}
+
+double intervalFrame::run(Script* script){
+  uint32_t signature = script->signature();
+  for(int i=0; i<values; i++){
+    if(value[i].signature == signature){
+      return value[i].value;
+    }
+  }
+  double result = script->run(oldRec, newRec, elapsedHours);
+  if(values < INTERVAL_FRAME_VALUES){
+    value[values].signature = signature;
+    value[values++].value = result;
+  }
+  return result;
+}
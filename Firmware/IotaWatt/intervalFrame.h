@@ -0,0 +1,43 @@
+#pragma once
+
+/*******************************************************************************************************
+ * An intervalFrame is the pair of current log records bounding one upload interval, with the
+ * values of the Scripts that have been run against them.  The uploaders post the same intervals
+ * of the same log, so the frame is read and each distinct Script evaluated once, then shared.
+ * Scripts are matched by signature (program, constants and units), so identical outputs
+ * configured separately in each service share the same value.
+ ******************************************************************************************************/
+
+#define INTERVAL_FRAMES 3                   // Frames cached, one each for two uploaders at different positions and one to fill
+#define INTERVAL_FRAME_VALUES 24            // Script values cached per frame
+
+struct intervalFrame {
+      uint32_t key;                         // UNIXtime of end of interval (0 = not cached)
+      uint32_t interval;                    // Length of interval in seconds
+      uint32_t used;                        // LRU sequence
+      IotaLogRecord* oldRec;                // Record at key - interval
+      IotaLogRecord* newRec;                // Record at key
+      double   elapsedHours;                // newRec->logHours - oldRec->logHours
+      uint8_t  values;                      // Script values cached
+      struct {
+        uint32_t signature;
+        double   value;
+      } value[INTERVAL_FRAME_VALUES];
+      intervalFrame()
+      :key(0)
+      ,interval(0)
+      ,used(0)
+      ,elapsedHours(0)
+      ,values(0)
+      {
+        oldRec = new IotaLogRecord;
+        newRec = new IotaLogRecord;
+      }
+      ~intervalFrame(){
+        delete oldRec;
+        delete newRec;
+      }
+      double   run(Script* script);         // Value of script for this interval
+    };
+
+intervalFrame*  getIntervalFrame(uint32_t key, uint32_t interval, IotaLogCursor* cursor = nullptr);
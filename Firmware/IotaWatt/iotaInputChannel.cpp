@@ -37,6 +37,7 @@ void IotaInputChannel::setVoltage(float volts){
     if(_type != channelTypeVoltage) return;
     dataBucket.volts = volts;
     ageBuckets(millis());
+    realtimeRecord(_channel, volts);
 }
 
 void IotaInputChannel::setHz(float Hz){
@@ -44,11 +45,31 @@ void IotaInputChannel::setHz(float Hz){
     dataBucket.Hz = Hz;
 }
 
-void IotaInputChannel::setPower(float watts, float VA){
+    // The damped statistics weigh a result by the cycles it averages,
+    // as though each cycle had been sampled separately.
+
+void IotaInputChannel::setPower(float watts, float VA, int cycles){
     if(_type != channelTypePower) return;
     dataBucket.watts = watts;
     dataBucket.VA = VA;
     ageBuckets(millis());
+    realtimeRecord(_channel, watts);
+    float alpha = (cycles > 1) ? 1.0 - pow(0.9, cycles) : 0.1;
+    float diff = watts - _wattsMean;
+    _wattsMean += alpha * diff;
+    _wattsVar = (1.0 - alpha) * (_wattsVar + alpha * diff * diff);
+}
+
+        // Cycles to sample per rotation, from 1 for a steady load up to maxCycles
+        // when the standard deviation of recent samples is 25% or more of the mean.
+
+uint8_t IotaInputChannel::sampleWeight(uint8_t maxCycles){
+    if(maxCycles <= 1 || _type != channelTypePower) return 1;
+    float mean = abs(_wattsMean);
+    if(mean < 10.0) mean = 10.0;
+    float cv = sqrt(_wattsVar) / mean;
+    if(cv >= 0.25) return maxCycles;
+    return 1 + int((maxCycles - 1) * cv / 0.25);
 }
 
 float IotaInputChannel::getPhase(const float var){
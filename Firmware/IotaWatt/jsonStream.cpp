@@ -0,0 +1,212 @@
+#include "IotaWatt.h"
+
+jsonStream::jsonStream()
+  :_chunk(nullptr)
+  ,_members(0)
+  ,_depth(0)
+  ,_named(false)
+  {}
+
+jsonStream::~jsonStream(){
+  delete[] _chunk;
+}
+
+void jsonStream::begin(int code, PGM_P contentType){
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(code, contentType, "");
+  if( ! _chunk){
+    _chunk = new char[JSON_STREAM_CHUNK + 8];
+  }
+}
+
+void jsonStream::end(){
+  while(_depth){
+    close();
+  }
+  send(true);
+  if(_chunk){
+    sendChunk(_chunk, 6);
+  }
+}
+
+void jsonStream::beginObject(){
+  open('{', '}');
+}
+
+void jsonStream::beginArray(){
+  open('[', ']');
+}
+
+void jsonStream::endObject(){
+  close();
+}
+
+void jsonStream::endArray(){
+  close();
+}
+
+void jsonStream::key(const __FlashStringHelper* name){
+  separator();
+  string_P((PGM_P)name);
+  _buf.write(':');
+  _named = true;
+}
+
+void jsonStream::key(const char* name){
+  separator();
+  string(name);
+  _buf.write(':');
+  _named = true;
+}
+
+void jsonStream::value(const char* str){
+  separator();
+  if(str){
+    string(str);
+  }
+  else {
+    _buf.write("null");
+  }
+  send(false);
+}
+
+void jsonStream::value(const __FlashStringHelper* str){
+  separator();
+  string_P((PGM_P)str);
+  send(false);
+}
+
+void jsonStream::value(bool val){
+  separator();
+  _buf.write(val ? "true" : "false");
+  send(false);
+}
+
+void jsonStream::value(long val){
+  separator();
+  _buf.printf_P(PSTR("%ld"), val);
+  send(false);
+}
+
+void jsonStream::value(unsigned long val){
+  separator();
+  _buf.printf_P(PSTR("%lu"), val);
+  send(false);
+}
+
+    // Doubles are printed with fixed decimals, then trailing zeros trimmed
+    // as ArduinoJson did.  NaN and infinity aren't valid JSON, so are null.
+    // Values too large to fit fixed are printed with an exponent.
+
+void jsonStream::value(double val, int decimals){
+  separator();
+  if(isnan(val) || isinf(val)){
+    _buf.write("null");
+  }
+  else {
+    char str[24];
+    if(snprintf_P(str, sizeof(str), PSTR("%.*f"), constrain(decimals, 0, 9), val) >= (int)sizeof(str)){
+      snprintf_P(str, sizeof(str), PSTR("%g"), val);
+    }
+    else if(strchr(str, '.')){
+      char* end = str + strlen(str) - 1;
+      while(*end == '0') *end-- = 0;
+      if(*end == '.') *end = 0;
+    }
+    _buf.write(str);
+  }
+  send(false);
+}
+
+void jsonStream::rawValue(const char* json){
+  separator();
+  _buf.write(json);
+  send(false);
+}
+
+void jsonStream::raw(const char* text){
+  _buf.write(text);
+  send(false);
+}
+
+    // Called before each key or value.  A value following its key needs no separator,
+    // anything else needs a comma unless it's the first at this level.
+
+void jsonStream::separator(){
+  if(_named){
+    _named = false;
+    return;
+  }
+  if(_depth){
+    uint32_t bit = 1 << _depth;
+    if(_members & bit){
+      _buf.write(',');
+    }
+    _members |= bit;
+  }
+}
+
+void jsonStream::open(char opener, char closer){
+  separator();
+  _buf.write(opener);
+  if(_depth < JSON_STREAM_DEPTH - 1){
+    _depth++;
+    _closer[_depth] = closer;
+    _members &= ~(1 << _depth);
+  }
+}
+
+void jsonStream::close(){
+  if(_depth){
+    _buf.write(_closer[_depth--]);
+    send(false);
+  }
+}
+
+void jsonStream::string(const char* str){
+  _buf.write('"');
+  while(*str){
+    escape(*str++);
+  }
+  _buf.write('"');
+}
+
+void jsonStream::string_P(PGM_P str){
+  _buf.write('"');
+  char c;
+  while((c = pgm_read_byte(str++))){
+    escape(c);
+  }
+  _buf.write('"');
+}
+
+void jsonStream::escape(char c){
+  switch(c){
+    case '"':  _buf.write("\\\""); break;
+    case '\\': _buf.write("\\\\"); break;
+    case '\n': _buf.write("\\n"); break;
+    case '\r': _buf.write("\\r"); break;
+    case '\t': _buf.write("\\t"); break;
+    default:
+      if((uint8_t)c < 0x20){
+        _buf.printf_P(PSTR("\\u%04x"), c);
+      }
+      else {
+        _buf.write(c);
+      }
+  }
+}
+
+    // Send full chunks, or everything when all is true.
+    // Without begin() the text just accumulates (nothing to send it to).
+
+void jsonStream::send(bool all){
+  if( ! _chunk){
+    return;
+  }
+  while(_buf.available() >= JSON_STREAM_CHUNK || (all && _buf.available())){
+    size_t len = MIN(_buf.available(), JSON_STREAM_CHUNK);
+    _buf.read((uint8_t*)_chunk + 6, len);
+    sendChunk(_chunk, len + 6);
+  }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "xbuf.h"
+
+/*******************************************************************************************************
+ * jsonStream writes a JSON response field by field as a chunked HTTP response, without building
+ * a DynamicJsonBuffer tree or a response String.  Text accumulates in an xbuf and is sent with
+ * sendChunk() whenever a chunk's worth is available, so heap use is about one chunk regardless
+ * of the size of the document.
+ *
+ * Separators are tracked per nesting level, so the caller just opens and closes objects
+ * and arrays and sets members (in objects) or adds values (in arrays):
+ *
+ *      jsonStream json;
+ *      json.begin(200, appJson_P);
+ *      json.beginObject();
+ *      json.set(F("name"), deviceName);
+ *      json.end();                       // closes open levels and sends the last chunk
+ ******************************************************************************************************/
+
+#define JSON_STREAM_CHUNK 1400              // Body bytes per chunk
+#define JSON_STREAM_DEPTH 16                // Max nesting
+
+class jsonStream {
+
+  public:
+    jsonStream();
+    ~jsonStream();
+
+    void    begin(int code, PGM_P contentType);   // Send headers, start chunked response
+    void    end();                                // Close open levels and send terminating chunk
+
+    void    beginObject();
+    void    beginArray();
+    void    endObject();
+    void    endArray();
+
+    void    key(const __FlashStringHelper* name);
+    void    key(const char* name);
+
+    void    value(const char* str);
+    void    value(const __FlashStringHelper* str);
+    void    value(const String& str){value(str.c_str());}
+    void    value(bool val);
+    void    value(int val){value((long)val);}
+    void    value(unsigned int val){value((unsigned long)val);}
+    void    value(long val);
+    void    value(unsigned long val);
+    void    value(double val, int decimals = 4);
+    void    rawValue(const char* json);           // Preformatted JSON value
+    void    raw(const char* text);                // Verbatim text, no separator
+
+    template<typename K>
+    void    beginObject(K name){key(name); beginObject();}
+    template<typename K>
+    void    beginArray(K name){key(name); beginArray();}
+    template<typename K, typename V>
+    void    set(K name, V val){key(name); value(val);}
+    template<typename K>
+    void    set(K name, double val, int decimals){key(name); value(val, decimals);}
+    template<typename V>
+    void    add(V val){value(val);}
+
+  private:
+    xbuf      _buf;                         // Text not yet sent
+    char*     _chunk;                       // Chunk buffer for sendChunk (nullptr until begin)
+    uint32_t  _members;                     // Bit per level, set when level has a member
+    int8_t    _depth;                       // Current nesting level
+    bool      _named;                       // Key written, value pending
+    char      _closer[JSON_STREAM_DEPTH];   // Closing character for each level
+
+    void      separator();
+    void      open(char opener, char closer);
+    void      close();
+    void      string(const char* str);
+    void      string_P(PGM_P str);
+    void      escape(char c);
+    void      send(bool all);
+};
@@ -0,0 +1,58 @@
+#include "IotaWatt.h"
+
+void* memPool::alloc(size_t size){
+  if(size > _blockSize){
+    _heapAllocs++;
+    return malloc(size);
+  }
+  if( ! _free && _slabCount < _maxSlabs){
+    slab* newSlab = (slab*)malloc(sizeof(slab) + _blockSize * _slabBlocks);
+    if(newSlab){
+      newSlab->next = _slabs;
+      _slabs = newSlab;
+      _slabCount++;
+      uint8_t* block = (uint8_t*)(newSlab + 1);
+      for(int i=0; i<_slabBlocks; i++){
+        freeBlock* fb = (freeBlock*)(block + i * _blockSize);
+        fb->next = _free;
+        _free = fb;
+      }
+    }
+  }
+  if( ! _free){
+    _heapAllocs++;
+    return malloc(size);
+  }
+  freeBlock* block = _free;
+  _free = block->next;
+  if(++_inUse > _highWater){
+    _highWater = _inUse;
+  }
+  return block;
+}
+
+void memPool::free(void* block){
+  if( ! block){
+    return;
+  }
+  if( ! owns(block)){
+    ::free(block);
+    return;
+  }
+  freeBlock* fb = (freeBlock*)block;
+  fb->next = _free;
+  _free = fb;
+  _inUse--;
+}
+
+bool memPool::owns(void* block){
+  slab* thisSlab = _slabs;
+  while(thisSlab){
+    uint8_t* first = (uint8_t*)(thisSlab + 1);
+    if((uint8_t*)block >= first && (uint8_t*)block < first + _blockSize * _slabBlocks){
+      return true;
+    }
+    thisSlab = thisSlab->next;
+  }
+  return false;
+}
@@ -0,0 +1,63 @@
+#ifndef memPool_h
+#define memPool_h
+#include <Arduino.h>
+
+/*******************************************************************************************************
+ * memPool is a fixed block size allocator for the objects the services allocate and free over
+ * and over (log records, message buffers).  Blocks are carved from slabs that are never returned 
+ * to the heap, and freed blocks go on a free list, so the same few KB are reused for the life 
+ * of the program instead of fragmenting the heap with each state transition.
+ *
+ * Slabs are added as needed up to maxSlabs.  Past that, or for a request of a different size, 
+ * blocks come from the heap and are counted as heapAllocs.
+ ******************************************************************************************************/
+
+class memPool {
+
+  public:
+    memPool(const char* name, size_t blockSize, uint8_t slabBlocks, uint8_t maxSlabs)
+    :_name(name)
+    ,_blockSize((blockSize + 3) & ~3)
+    ,_slabBlocks(slabBlocks)
+    ,_maxSlabs(maxSlabs)
+    ,_slabs(nullptr)
+    ,_free(nullptr)
+    ,_slabCount(0)
+    ,_inUse(0)
+    ,_highWater(0)
+    ,_heapAllocs(0)
+    {};
+
+    void*       alloc(size_t size);             // Get a block
+    void        free(void* block);              // Return a block
+
+    const char* name(){return _name;}
+    size_t      blockSize(){return _blockSize;}
+    uint16_t    blocks(){return _slabCount * _slabBlocks;}
+    uint16_t    inUse(){return _inUse;}
+    uint16_t    highWater(){return _highWater;}
+    uint32_t    heapAllocs(){return _heapAllocs;}
+
+  private:
+    struct slab {
+      slab*     next;
+    };
+    struct freeBlock {
+      freeBlock* next;
+    };
+
+    const char* _name;
+    size_t      _blockSize;                     // Rounded to word
+    uint8_t     _slabBlocks;                    // Blocks per slab
+    uint8_t     _maxSlabs;
+    slab*       _slabs;                         // Slab list, blocks follow each header
+    freeBlock*  _free;                          // Free list
+    uint8_t     _slabCount;
+    uint16_t    _inUse;                         // Pool blocks allocated
+    uint16_t    _highWater;                     // Max _inUse
+    uint32_t    _heapAllocs;                    // Requests satisfied from the heap
+
+    bool        owns(void* block);
+};
+
+#endif
@@ -5,17 +5,39 @@
                 ,bufLen(60)
                 ,newMsg(true)
                 ,restart(true)
+                ,fragmented(false)
+                ,msgStart(0)
+                ,ring(nullptr)
+                ,ringHead(0)
+                ,ringCount(0)
+                ,ringSince(0)
+                ,lastHash(0)
+                ,repeats(0)
+                ,repeatSince(0)
                 {}
 
 void        messageLog::endMsg(){
                 this->println();
                 Serial.write(buf, bufPos);
-                msgFile = SD.open(IotaMsgLog,FILE_WRITE);
-                if(msgFile) {
-                    msgFile.write(buf, bufPos);
-                    msgFile.close();
+
+                    // Unless the message was written in pieces, check for
+                    // a repeat of the last message.
+
+                uint32_t hash = 0;
+                if( ! fragmented){
+                    hash = hashFNV(2166136261, buf + msgStart, bufPos - msgStart);
+                }
+                if(hash && hash == lastHash){
+                    if(repeats++ == 0){
+                        repeatSince = UTCtime();
+                    }
+                }
+                else {
+                    logRepeats();
+                    ringWrite(buf, bufPos);
+                    lastHash = hash;
                 }
-                delete[] buf;
+                workBufPool.free(buf);
                 newMsg= true;
                 return;
             }
@@ -23,7 +45,8 @@ void        messageLog::endMsg(){
 size_t      messageLog::write(const uint8_t byte){
                 if(newMsg){
                     newMsg = false;
-                    buf = new uint8_t[bufLen];
+                    fragmented = false;
+                    buf = (uint8_t*)workBufPool.alloc(bufLen);
                     bufPos = 0;
                     if(restart){
                         restart = false;
@@ -36,21 +59,16 @@ size_t      messageLog::write(const uint8_t byte){
                             buf[bufPos++] = ' ';
                         }
                     }
+                    msgStart = bufPos;
                 }
                 if(bufPos >= bufLen) {
                     Serial.write(buf, bufPos);
-                    msgFile = SD.open(IotaMsgLog,FILE_WRITE);
-                    if(! msgFile){
-                        String msgDir = IotaMsgLog;
-                        msgDir.remove(msgDir.indexOf('/',1));
-                        SD.mkdir(msgDir.c_str());
-                        msgFile = SD.open(IotaMsgLog,FILE_WRITE);
-                    }
-                    if(msgFile) {
-                        msgFile.write(buf, bufPos);
-                        msgFile.close();
-                    }
+                    logRepeats();
+                    ringWrite(buf, bufPos);
+                    lastHash = 0;
+                    fragmented = true;
                     bufPos = 0;
+                    msgStart = 0;
                 }
                 buf[bufPos++] = byte;
                 return 1;
@@ -61,6 +79,88 @@ size_t      messageLog::write(const uint8_t* buf, const size_t len){
                 return len;
             }
 
+                // If the last message has been repeated, log the count.
+
+void        messageLog::logRepeats(){
+                if(repeats){
+                    char line[48];
+                    int len = snprintf_P(line, sizeof(line), PSTR("  (last message repeated %d times)\r\n"), repeats);
+                    Serial.write(line, len);
+                    ringWrite((uint8_t*)line, len);
+                    repeats = 0;
+                }
+            }
 
-  
-  
+void        messageLog::checkRepeat(){
+                if(repeats && (UTCtime() - repeatSince) >= MSGLOG_REPEAT_SEC){
+                    logRepeats();
+                    lastHash = 0;
+                }
+            }
+
+void        messageLog::ringWrite(const uint8_t* data, size_t len){
+                if( ! ring){
+                    ring = new char[MSGLOG_RING];
+                }
+                if(ringCount == 0){
+                    ringSince = millis();
+                }
+                while(len--){
+                    if(ringCount == MSGLOG_RING){
+                        flush();
+                    }
+                    ring[ringHead] = *data++;
+                    ringHead = (ringHead + 1) % MSGLOG_RING;
+                    ringCount++;
+                }
+            }
+
+bool        messageLog::flushDue(){
+                return ringCount && ((millis() - ringSince) >= MSGLOG_FLUSH_MS || ringCount >= MSGLOG_RING / 2);
+            }
+
+                // Write the ring contents to the message log.
+                // The file is kept open between flushes.
+                // If the SD isn't available, the text is discarded.
+
+void        messageLog::flush(){
+                if( ! ringCount){
+                    return;
+                }
+                if( ! msgFile){
+                    msgFile = SD.open(IotaMsgLog,FILE_WRITE);
+                    if(! msgFile){
+                        String msgDir = IotaMsgLog;
+                        msgDir.remove(msgDir.indexOf('/',1));
+                        SD.mkdir(msgDir.c_str());
+                        msgFile = SD.open(IotaMsgLog,FILE_WRITE);
+                    }
+                }
+                uint16_t tail = (ringHead + MSGLOG_RING - ringCount) % MSGLOG_RING;
+                if(msgFile){
+                    if(tail + ringCount > MSGLOG_RING){
+                        msgFile.write((uint8_t*)ring + tail, MSGLOG_RING - tail);
+                        msgFile.write((uint8_t*)ring, ringHead);
+                    }
+                    else {
+                        msgFile.write((uint8_t*)ring + tail, ringCount);
+                    }
+                    msgFile.flush();
+                }
+                ringCount = 0;
+            }
+
+/**************************************************************************************************
+ * messageLogService writes the buffered messages to SD at low priority.
+ *************************************************************************************************/
+
+uint32_t    messageLogService(struct serviceBlock* _serviceBlock){
+                trace(T_msglog,0);
+                _serviceBlock->priority = priorityLow;
+                msglog.checkRepeat();
+                if(msglog.flushDue()){
+                    trace(T_msglog,1);
+                    msglog.flush();
+                }
+                return UTCtime() + 1;
+            }
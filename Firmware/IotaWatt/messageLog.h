@@ -1,6 +1,20 @@
 #pragma once
 #include <Arduino.h>
 
+/*******************************************************************************************************
+ * messageLog formats messages a line at a time and copies them to Serial immediately, but the SD
+ * copy goes to a RAM ring buffer that messageLogService writes to the log file in batches through
+ * a file handle that is kept open.  The ring is written synchronously when it fills, and flush()
+ * should be called before a deliberate restart.
+ * 
+ * A message that is the same as the one before (ignoring the time stamp) isn't logged again,
+ * it is counted, and the count is logged when a different message arrives or a minute passes.
+ ******************************************************************************************************/
+
+#define MSGLOG_RING 1024                    // RAM buffered message text
+#define MSGLOG_FLUSH_MS 2000                // Max age of buffered text
+#define MSGLOG_REPEAT_SEC 60                // Max time to hold the repeat count
+
 class messageLog: public Print {
 
     public:
@@ -10,15 +24,32 @@ class messageLog: public Print {
         size_t      write(const uint8_t);
         size_t      write(const uint8_t*, const size_t);
         void        endMsg();
+        void        flush();                // Write the ring to SD now
+        bool        flushDue();             // True if ring text is old or ring is half full
+        void        checkRepeat();          // Log repeat count if held too long
 
     protected:
 
         File        msgFile;
         bool        newMsg;
         bool        restart;
+        bool        fragmented;             // Current message was too long for buf
         uint8_t*    buf;
         uint8_t     bufLen;
         uint8_t     bufPos;
+        uint8_t     msgStart;               // Position after time stamp in buf
+        char*       ring;                   // Ring buffer for SD
+        uint16_t    ringHead;               // Next position to write in ring
+        uint16_t    ringCount;              // Bytes in ring
+        uint32_t    ringSince;              // millis() of oldest text in ring
+        uint32_t    lastHash;               // Hash of last message (0 = none)
+        uint16_t    repeats;                // Times last message was repeated
+        uint32_t    repeatSince;            // UTCtime of first repeat
+
+        void        ringWrite(const uint8_t* data, size_t len);
+        void        logRepeats();
 };
 
+uint32_t messageLogService(struct serviceBlock* _serviceBlock);
+
 #define log(format,...)  msglog.printf_P(PSTR(format),##__VA_ARGS__); msglog.endMsg()
@@ -0,0 +1,173 @@
+/**********************************************************************************************
+ * handleMetrics serves /metrics in the Prometheus text exposition format, for central
+ * scraping without the cost of /status.  Values are printed straight from the globals
+ * into an xbuf and sent with sendChunk a chunk at a time, so there is no JSON document and
+ * no String per metric.
+ **********************************************************************************************/
+#include "IotaWatt.h"
+
+#define METRICS_CHUNK 1400                  // Body bytes per chunk
+
+static xbuf* metricsOut = nullptr;
+static char* metricsChunk = nullptr;
+
+    // Send full chunks, or everything when all is true.
+
+static void metricsSend(bool all){
+  while(metricsOut->available() >= METRICS_CHUNK || (all && metricsOut->available())){
+    size_t len = MIN(metricsOut->available(), METRICS_CHUNK);
+    metricsOut->read((uint8_t*)metricsChunk + 6, len);
+    sendChunk(metricsChunk, len + 6);
+  }
+}
+
+static void metricsType(PGM_P name, PGM_P type){
+  char nameStr[32];
+  char typeStr[12];
+  strncpy_P(nameStr, name, sizeof(nameStr) - 1);
+  nameStr[sizeof(nameStr) - 1] = 0;
+  strncpy_P(typeStr, type, sizeof(typeStr) - 1);
+  typeStr[sizeof(typeStr) - 1] = 0;
+  metricsOut->printf_P(PSTR("# TYPE iotawatt_%s %s\n"), nameStr, typeStr);
+}
+
+    // Label values are user names, so escape as the format requires.
+
+static void metricsLabel(const char* str){
+  metricsOut->write('"');
+  while(str && *str){
+    if(*str == '"' || *str == '\\'){
+      metricsOut->write('\\');
+    }
+    if(*str == '\n'){
+      metricsOut->write("\\n");
+    }
+    else {
+      metricsOut->write(*str);
+    }
+    str++;
+  }
+  metricsOut->write('"');
+}
+
+    // Samples of a family must be together, so the profiler stats are
+    // written once as the summary, then again for the max gauge.
+
+static void metricsPerf(perfStat* stat, const char* label, bool showMax){
+  if(showMax){
+    metricsOut->printf_P(PSTR("iotawatt_dispatch_max_us{%s} %u\n"), label, stat->maxUs);
+  }
+  else {
+    metricsOut->printf_P(PSTR("iotawatt_dispatch_us{%s,quantile=\"0.99\"} %u\n"), label, stat->percentile(99));
+    metricsOut->printf_P(PSTR("iotawatt_dispatch_us_sum{%s} %.0f\n"), label, (double)stat->totalUs);
+    metricsOut->printf_P(PSTR("iotawatt_dispatch_us_count{%s} %u\n"), label, stat->count);
+  }
+  metricsSend(false);
+}
+
+    // Inputs from statRecord, as /status?inputs, one family (watts, pf, volts, hz) at a time.
+
+static void metricsInputs(PGM_P family, bool power, bool first){
+  metricsType(family, PSTR("gauge"));
+  for(int i=0; i<maxInputs; i++){
+    IotaInputChannel* channel = inputChannel[i];
+    if( ! channel->isActive() || 
+        channel->_type != (power ? channelTypePower : channelTypeVoltage)){
+      continue;
+    }
+    double value = statRecord.accum1[i];
+    if( ! first){
+      value = statRecord.accum2[i];
+      if(power && value != 0){
+        value = statRecord.accum1[i] / value;
+      }
+    }
+    char name[20];
+    strncpy_P(name, family, sizeof(name) - 1);
+    name[sizeof(name) - 1] = 0;
+    metricsOut->printf_P(PSTR("iotawatt_%s{channel=\"%d\",name="), name, i);
+    metricsLabel(channel->_name);
+    metricsOut->printf_P(PSTR("} %.3f\n"), value);
+    metricsSend(false);
+  }
+}
+
+void handleMetrics(){
+  trace(T_WEB,75);
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/plain; version=0.0.4", "");
+  metricsOut = new xbuf;
+  metricsChunk = new char[METRICS_CHUNK + 8];
+  uint32_t now = UTCtime();
+
+  metricsType(PSTR("info"), PSTR("gauge"));
+  metricsOut->printf_P(PSTR("iotawatt_info{version=\"%s\",device="), IOTAWATT_VERSION);
+  metricsLabel(deviceName);
+  metricsOut->write("} 1\n");
+  metricsType(PSTR("uptime_seconds"), PSTR("gauge"));
+  metricsOut->printf_P(PSTR("iotawatt_uptime_seconds %u\n"), now - programStartTime);
+  metricsType(PSTR("heap_free_bytes"), PSTR("gauge"));
+  metricsOut->printf_P(PSTR("iotawatt_heap_free_bytes %u\n"), ESP.getFreeHeap());
+  metricsType(PSTR("frequency_hz"), PSTR("gauge"));
+  metricsOut->printf_P(PSTR("iotawatt_frequency_hz %.3f\n"), frequency);
+  metricsType(PSTR("samples_per_cycle"), PSTR("gauge"));
+  metricsOut->printf_P(PSTR("iotawatt_samples_per_cycle %.1f\n"), samplesPerCycle);
+  metricsType(PSTR("channel_sample_rate"), PSTR("gauge"));
+  metricsOut->printf_P(PSTR("iotawatt_channel_sample_rate %.2f\n"), cycleSampleRate);
+  metricsSend(false);
+
+  trace(T_WEB,76);
+  metricsInputs(PSTR("input_watts"), true, true);
+  metricsInputs(PSTR("input_pf"), true, false);
+  metricsInputs(PSTR("input_volts"), false, true);
+  metricsInputs(PSTR("input_hz"), false, false);
+
+      // Logs, uploaders and HTTP slots.
+
+  trace(T_WEB,77);
+  metricsType(PSTR("log_sector_reads_total"), PSTR("counter"));
+  metricsOut->printf_P(PSTR("iotawatt_log_sector_reads_total{log=\"current\"} %u\n"), currLog.readKeyIO());
+  metricsOut->printf_P(PSTR("iotawatt_log_sector_reads_total{log=\"history\"} %u\n"), histLog.readKeyIO());
+  metricsType(PSTR("log_last_key_seconds"), PSTR("gauge"));
+  metricsOut->printf_P(PSTR("iotawatt_log_last_key_seconds{log=\"current\"} %u\n"), currLog.lastKey());
+  metricsOut->printf_P(PSTR("iotawatt_log_last_key_seconds{log=\"history\"} %u\n"), histLog.lastKey());
+  metricsType(PSTR("upload_lag_seconds"), PSTR("gauge"));
+  if(influxStarted){
+    metricsOut->printf_P(PSTR("iotawatt_upload_lag_seconds{service=\"influxdb\"} %u\n"), now - influxLastPost);
+  }
+  if(EmonStarted){
+    metricsOut->printf_P(PSTR("iotawatt_upload_lag_seconds{service=\"emoncms\"} %u\n"), now - EmonLastPost);
+  }
+  metricsType(PSTR("http_slots"), PSTR("gauge"));
+  metricsOut->printf_P(PSTR("iotawatt_http_slots %d\n"), HTTPrequestMax);
+  metricsType(PSTR("http_slots_free"), PSTR("gauge"));
+  metricsOut->printf_P(PSTR("iotawatt_http_slots_free %d\n"), HTTPrequestFree);
+  metricsSend(false);
+
+      // Scheduler timings from the loop profiler.
+
+  trace(T_WEB,78);
+  char label[24];
+  for(int showMax=0; showMax<2; showMax++){
+    metricsType(showMax ? PSTR("dispatch_max_us") : PSTR("dispatch_us"), showMax ? PSTR("gauge") : PSTR("summary"));
+    for(int i=0; i<PERF_TASKS; i++){
+      if(perfService[i]){
+        snprintf_P(label, sizeof(label), PSTR("task=\"%d\""), i);
+        metricsPerf(perfService[i], label, showMax);
+      }
+    }
+    metricsPerf(&perfWeb, "task=\"web\"", showMax);
+    metricsPerf(&perfSampleLate, "task=\"samplelate\"", showMax);
+    metricsPerf(&perfQuery, "task=\"query\"", showMax);
+  }
+  metricsType(PSTR("sample_missed_cycles_total"), PSTR("counter"));
+  metricsOut->printf_P(PSTR("iotawatt_sample_missed_cycles_total %u\n"), perfMissedCycles);
+
+  metricsSend(true);
+  sendChunk(metricsChunk, 6);
+  delete metricsOut;
+  metricsOut = nullptr;
+  delete[] metricsChunk;
+  metricsChunk = nullptr;
+  trace(T_WEB,79);
+}
@@ -0,0 +1,178 @@
+/**********************************************************************************************
+ * queryService runs /query requests as resumable jobs, so a long query doesn't lock out
+ * the web server for the duration.
+ *
+ * handleQuery sets up the CSVquery, hands the connection to a queryJob and sends the
+ * response headers.  The web server is then free to take other requests while this service
+ * produces the response one chunk at a time into the job's buffer and drains it to the
+ * connection without blocking, writing only what the TCP stack will accept.
+ *
+ * Several jobs can run at once.  Each dispatch steps the jobs round-robin, one chunk each,
+ * for as long as there is time before the next AC crossing, so concurrent queries progress
+ * at about the same rate.  Each job holds an HTTPreserve token while active, so queries
+ * and the uploaders share the same limit on concurrent connections.  A job that can't get
+ * a token waits in the queue, and is started when one is released.  Up to QUERY_JOBS_MAX
+ * jobs can be queued in all; beyond that, or if a job waits more than QUERY_WAIT_MS, the
+ * request is refused or dropped rather than run synchronously.  A large download can
+ * run longer than WiFiService allows an HTTP request, so it doesn't expire these tokens;
+ * a job is instead abandoned when the client stops taking data for QUERY_STALL_MS.
+ *
+ * Jobs run any queryResult, so log exports and file ranges are served the same way.
+ **********************************************************************************************/
+#include "IotaWatt.h"
+
+#define QUERY_CHUNK 1460                    // Chunk buffer per job
+#define QUERY_STALL_MS 15000                // Abandon job when client doesn't take data
+#define QUERY_WAIT_MS 30000                 // Abandon job that can't get a token
+#define QUERY_JOBS_MAX 4                    // Jobs running or waiting for a token
+
+struct queryJob {
+      queryJob*   next;
+      queryResult* query;
+      WiFiClient  client;                   // Keeps the connection after the handler returns
+      uint32_t    HTTPtoken;                // 0 = waiting for a token
+      uint32_t    lastWrite;                // millis() of last progress (or queued)
+      char*       buf;                      // Framed chunk being sent
+      uint16_t    bufLen;                   // Length of framed chunk (0 = empty)
+      uint16_t    bufPos;                   // Bytes of chunk sent
+      bool        ended;                    // Terminating chunk has been framed
+      queryJob(queryResult* query, WiFiClient& client, uint32_t token)
+      :next(nullptr)
+      ,query(query)
+      ,client(client)
+      ,HTTPtoken(token)
+      ,lastWrite(millis())
+      ,bufLen(0)
+      ,bufPos(0)
+      ,ended(false)
+      {
+        buf = new char[QUERY_CHUNK];
+      }
+      ~queryJob(){
+        client.stop();
+        if(HTTPtoken){
+          HTTPrelease(HTTPtoken);
+        }
+        delete query;
+        delete[] buf;
+      }
+      bool step();                          // Returns true if progress made
+    };
+
+queryJob* queryJobs = nullptr;
+bool      queryServiceActive = false;
+
+    // Start a job for a query that has been setup, before its headers are sent.
+    // Without an HTTP reservation, the job is queued until one is released.
+    // Returns false if the queue is full; the job then still belongs to the 
+    // caller, which should answer with queryBusy.
+
+bool queryStart(queryResult* query){
+  trace(T_CSVquery,80);
+  int jobs = 0;
+  queryJob** link = &queryJobs;
+  while(*link){
+    link = &(*link)->next;
+    jobs++;
+  }
+  if(jobs >= QUERY_JOBS_MAX){
+    return false;
+  }
+  WiFiClient client = server.client();
+  *link = new queryJob(query, client, HTTPreserve(T_CSVquery));
+  if( ! queryServiceActive){
+    queryServiceActive = true;
+    NewService(queryService, T_CSVquery);
+  }
+  return true;
+}
+
+    // Refuse a request when no job can be queued, before any headers are sent.
+
+void queryBusy(){
+  trace(T_CSVquery,84);
+  server.sendHeader(F("Retry-After"), F("5"));
+  server.send(503, txtPlain_P, F("Busy, retry later."));
+}
+
+bool queryJob::step(){
+  bool progress = false;
+
+      // Wait for a token.
+
+  if( ! HTTPtoken){
+    HTTPtoken = HTTPreserve(T_CSVquery);
+    if( ! HTTPtoken){
+      return false;
+    }
+    trace(T_CSVquery,83);
+    lastWrite = millis();
+  }
+
+      // Produce the next chunk if the last one has been sent.
+
+  if(bufLen == 0 && ! ended){
+    trace(T_CSVquery,81);
+    size_t read = query->readResult((uint8_t*)buf+6, QUERY_CHUNK-8);
+    if( ! read){
+      ended = true;
+    }
+    bufLen = chunkFrame(buf, read+6);
+    bufPos = 0;
+    progress = true;
+  }
+
+      // Send what the connection will take.
+
+  size_t send = MIN(client.availableForWrite(), (size_t)(bufLen - bufPos));
+  if(send){
+    trace(T_CSVquery,82);
+    client.write((const uint8_t*)buf+bufPos, send);
+    bufPos += send;
+    lastWrite = millis();
+    if(bufPos == bufLen){
+      bufLen = 0;
+    }
+    progress = true;
+  }
+  return progress;
+}
+
+uint32_t queryService(struct serviceBlock* _serviceBlock){
+  trace(T_CSVquery,85);
+  bool progress = true;
+  while(queryJobs && progress){
+    progress = false;
+    queryJob** link = &queryJobs;
+    while(*link){
+      queryJob* job = *link;
+      if(job->step()){
+        progress = true;
+      }
+      if( ! job->client.connected() ||
+          (job->ended && job->bufLen == 0) ||
+          (millis() - job->lastWrite) > (job->HTTPtoken ? QUERY_STALL_MS : QUERY_WAIT_MS)){
+        trace(T_CSVquery,86);
+        *link = job->next;
+        delete job;
+        continue;
+      }
+      link = &job->next;
+    }
+    if(dispatchExpired()){
+      break;
+    }
+  }
+  if( ! queryJobs){
+    trace(T_CSVquery,87);
+    queryServiceActive = false;
+    return 0;
+  }
+
+      // If waiting on the client, check back shortly.
+
+  if( ! progress){
+    _serviceBlock->delayMs = 20;
+  }
+  return 1;
+}
@@ -0,0 +1,105 @@
+/**********************************************************************************************
+ * realtime keeps the most recent channel values in a RAM ring, at the resolution they are
+ * sampled, for clients that need to react faster than the five second log allows.
+ *
+ * setPower and setVoltage record each new value of the channels selected by the device
+ * "realtime" option (true for all channels, or an array of channel numbers) as a millis()
+ * timestamp and a half precision float.  The ring is shared by the selected channels, so
+ * selecting only the channels of interest extends the history.  With a few channels it
+ * holds the last couple of minutes.
+ *
+ * /realtime?channel=<n>[,<n>...]&since=<ms> returns the entries newer than since, which is
+ * the "now" from the previous response, without SD access:
+ *
+ *      {"now":12345678,"time":1546300800,"samples":[[12345100,3,1520],...]}
+ **********************************************************************************************/
+#include "IotaWatt.h"
+
+#define REALTIME_ENTRIES 512                // Ring size (8 bytes each)
+
+struct realtimeEntry {
+      uint32_t    ms;                       // millis() when set
+      uint16_t    value;                    // Watts or volts, half precision
+      uint8_t     channel;
+    };
+
+static realtimeEntry* realtimeRing = nullptr;
+static uint16_t       realtimeNext = 0;     // Next entry to write
+static uint16_t       realtimeCount = 0;    // Entries in use
+
+    // Allocate or free the ring to suit the selected channels.
+
+void realtimeBegin(uint16_t channels){
+  realtimeChannels = channels;
+  if(channels && ! realtimeRing){
+    realtimeRing = new realtimeEntry[REALTIME_ENTRIES];
+    realtimeNext = 0;
+    realtimeCount = 0;
+  }
+  else if( ! channels && realtimeRing){
+    delete[] realtimeRing;
+    realtimeRing = nullptr;
+  }
+}
+
+void realtimeRecord(uint8_t channel, float value){
+  if( ! realtimeRing || ! (realtimeChannels & (1 << channel))){
+    return;
+  }
+  realtimeEntry* entry = &realtimeRing[realtimeNext];
+  entry->ms = millis();
+  entry->value = floatToHalf(value);
+  entry->channel = channel;
+  realtimeNext = (realtimeNext + 1) % REALTIME_ENTRIES;
+  if(realtimeCount < REALTIME_ENTRIES){
+    realtimeCount++;
+  }
+}
+
+void handleRealtime(){
+  trace(T_WEB,70);
+  if( ! realtimeRing){
+    server.send(400, txtPlain_P, F("Realtime not enabled."));
+    return;
+  }
+  uint16_t channels = realtimeChannels;
+  if(server.hasArg(F("channel"))){
+    channels = 0;
+    String list = server.arg(F("channel"));
+    const char* ptr = list.c_str();
+    while(*ptr){
+      int channel = strtol(ptr, (char**)&ptr, 10);
+      if(channel >= 0 && channel < MAXINPUTS){
+        channels |= 1 << channel;
+      }
+      while(*ptr && ! isdigit(*ptr)) ptr++;
+    }
+  }
+  uint32_t now = millis();
+  uint32_t since = now - 120000UL;
+  if(server.hasArg(F("since"))){
+    since = strtoul(server.arg(F("since")).c_str(), nullptr, 10);
+  }
+
+  jsonStream json;
+  json.begin(200, appJson_P);
+  json.beginObject();
+  json.set(F("now"), now);
+  json.set(F("time"), UTCtime());
+  json.beginArray(F("samples"));
+  uint16_t index = (realtimeNext + REALTIME_ENTRIES - realtimeCount) % REALTIME_ENTRIES;
+  for(int i=0; i<realtimeCount; i++){
+    realtimeEntry* entry = &realtimeRing[index];
+    index = (index + 1) % REALTIME_ENTRIES;
+    if((int32_t)(entry->ms - since) <= 0 || ! (channels & (1 << entry->channel))){
+      continue;
+    }
+    json.beginArray();
+    json.add(entry->ms);
+    json.add(entry->channel);
+    json.value(halfToFloat(entry->value), 1);
+    json.endArray();
+  }
+  json.end();
+  trace(T_WEB,71);
+}
@@ -0,0 +1,90 @@
+/**********************************************************************************************
+ * rollupLog is a Service that maintains the coarse resolution rollup logs.
+ *
+ * Each rollup log in rollupTiers is built from the log before it, the first from the
+ * history log.  The records are simply an identical subset of the records in the source
+ * log at multiples of the rollup interval, just as the history log is a subset of the
+ * current log.  So, like the history log, they have no holes.
+ *
+ * Long period queries (days, months, years) are satisfied from the coarsest log that has
+ * the requested keys, by logReadKey, reading tens of records instead of tens of thousands.
+ *
+ * One record is added per dispatch, working from the finest tier to the coarsest, so a
+ * coarse tier never gets ahead of its source.  When a source log has been restarted
+ * after the rollup, the rollup skips ahead to the beginning of the source.
+ *
+ **********************************************************************************************/
+#include "IotaWatt.h"
+
+uint32_t rollupLog(struct serviceBlock* _serviceBlock){
+  enum states {initialize, logData};
+  static states state = initialize;
+  static IotaLogRecord* logRecord = nullptr;
+  trace(T_rollup,0);
+
+  switch(state){
+
+    case initialize: {
+      trace(T_rollup,1);
+
+        // If history log not open or empty, check back later.
+
+      if( ! histLog.isOpen() || histLog.fileSize() == 0){
+         return UTCtime() + 60;
+      }
+
+      for(int i=0; i<rollupTierCount; i++){
+        trace(T_rollup,2,i);
+        if(int rtc = rollupTiers[i].log->begin(rollupTiers[i].path)){
+          log("rollupLog: %s open failed: %d", rollupTiers[i].name, rtc);
+        }
+      }
+      log("rollupLog: service started.");
+      state = logData;
+      return 1;
+    }
+
+    case logData: {
+      trace(T_rollup,3);
+      for(int i=0; i<rollupTierCount; i++){
+        IotaLog* rollLog = rollupTiers[i].log;
+        IotaLog* source = rollupTiers[i].source;
+        if( ! rollLog->isOpen() || ! source->isOpen() || source->fileSize() == 0){
+          continue;
+        }
+        uint32_t key = rollLog->lastKey() + rollLog->interval();
+        if(rollLog->fileSize() == 0 || key < source->firstKey()){
+          key = source->firstKey();
+          if(key % rollLog->interval()){
+            key += rollLog->interval() - (key % rollLog->interval());
+          }
+        }
+        if(key > source->lastKey()){
+          continue;
+        }
+        trace(T_rollup,4,i);
+        if( ! logRecord){
+          logRecord = new IotaLogRecord;
+        }
+        logRecord->UNIXtime = key;
+        if(source->readKey(logRecord) > 1){
+          log("rollupLog: %s source read failure. Service suspended.", rollupTiers[i].name);
+          delete logRecord;
+          logRecord = nullptr;
+          return 0;
+        }
+        logRecord->UNIXtime = key;
+        rollLog->write(logRecord);
+        return 1;
+      }
+
+          // All tiers up to date, check back in a minute.
+
+      trace(T_rollup,5);
+      delete logRecord;
+      logRecord = nullptr;
+      return UTCtime() + 60;
+    }
+  }
+  return UTCtime() + 60;
+}
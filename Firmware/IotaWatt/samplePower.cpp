@@ -3,14 +3,20 @@
   /***************************************************************************************************
   *  samplePower()  Sample a channel.
   *  
+  *  Power channels can be sampled for several consecutive cycles in one capture.  The cycles
+  *  are limited to what fits in SAMPLE_BUDGET_MS, so a variable load doesn't hold off the
+  *  other channels and services for long.
+  *  When a pair channel is specified, it is a second power channel with the same voltage
+  *  channel, sampled at the same time as V, I, I2 triplets.
+  *  Returns the number of cycles successfully sampled.
   ****************************************************************************************************/
-void samplePower(int channel, int overSample){
+int samplePower(int channel, int cycles, int pair){
   static uint32_t trapTime = 0;
   uint32_t timeNow = millis();
 
   trace(T_POWER,0,channel);
   if( ! inputChannel[channel]->isActive()){
-    return;
+    return 0;
   }
   
       // If it's a voltage channel, use voltage only sample, update and return.
@@ -19,42 +25,85 @@ void samplePower(int channel, int overSample){
   if(inputChannel[channel]->_type == channelTypeVoltage){
     float VRMS = sampleVoltage(channel, inputChannel[channel]->_calibration);
     if(VRMS >= 0.0){
-      inputChannel[channel]->setVoltage(VRMS);                                                                        
+      inputChannel[channel]->setVoltage(VRMS);
+      return 1;                                                                        
     }
-    return;
+    return 0;
   }
 
          // Currently only voltage and power channels, so return if not one of those.
      
-  if(inputChannel[channel]->_type != channelTypePower) return;
+  if(inputChannel[channel]->_type != channelTypePower) return 0;
+
+  if(pair >= 0 && ( ! I2sample || inputChannel[pair]->_type != channelTypePower ||
+                   inputChannel[pair]->_vchannel != inputChannel[channel]->_vchannel)){
+    pair = -1;
+  }
+  cycles = constrain(cycles, 1, max(1, int(SAMPLE_BUDGET_MS * frequency / 1000)));
+  double watts = 0;
+  double VA = 0;
+  double pairWatts = 0;
+  double pairVA = 0;
+  if( ! samplePowerCycle(channel, cycles, &watts, &VA, pair, &pairWatts, &pairVA)){
+    return 0;
+  }
+  trace(T_POWER,5);
+  inputChannel[channel]->setPower(watts, VA, cycles);
+  if(pair >= 0){
+    inputChannel[pair]->setPower(pairWatts, pairVA, cycles);
+  }
+  trace(T_POWER,9);
+  return cycles;
+}
+
+  /***************************************************************************************************
+  *  samplePowerCycle()  Sample consecutive cycles of a power channel (and pair) and add the results 
+  *  to the sums.  Returns false if the sample could not be used.
+  ****************************************************************************************************/
+bool samplePowerCycle(int channel, int cycles, double* sumWatts, double* sumVA, int pair, double* pairWatts, double* pairVA){
 
          // From here on, dealing with a power channel and associated voltage channel.
 
   trace(T_POWER,1);
   IotaInputChannel* Ichannel = inputChannel[channel];
   IotaInputChannel* Vchannel = inputChannel[Ichannel->_vchannel]; 
-          
-  byte Ichan = Ichannel->_channel;
-  byte Vchan = Vchannel->_channel;
-  
-  double _Irms = 0;
-  double _watts = 0;
-  double _Vrms = 0;
-  double _VA = 0;
-
-  int16_t* VsamplePtr = Vsample;
-  int16_t* IsamplePtr = Isample;
+  IotaInputChannel* I2channel = (pair >= 0) ? inputChannel[pair] : nullptr;
    
         // Invoke high speed sample collection.
         // If it fails, return.
  
-  if(int rtc = sampleCycle(Vchannel, Ichannel)) {
+  if(int rtc = sampleCycle(Vchannel, Ichannel, cycles, I2channel)) {
     trace(T_POWER,2);
     if(rtc == 2){
       Ichannel->setPower(0.0, 0.0);
+      if(I2channel) I2channel->setPower(0.0, 0.0);
     }
-    return;
+    return false;
   }          
+
+  powerFromSamples(Vchannel, Ichannel, Isample, sumIsq, cycles, sumWatts, sumVA);
+  if(I2channel){
+    powerFromSamples(Vchannel, I2channel, I2sample, sumI2sq, cycles, pairWatts, pairVA);
+  }
+  return true;
+}
+
+  /***************************************************************************************************
+  *  powerFromSamples()  Compute power from the V samples and one set of I samples, 
+  *  and add the results to the sums.  The samples span a whole number of cycles.
+  ****************************************************************************************************/
+void powerFromSamples(IotaInputChannel* Vchannel, IotaInputChannel* Ichannel, int16_t* Isamples, uint32_t rawSumIsq,
+                      int cycles, double* sumWatts, double* sumVA){
+  byte Ichan = Ichannel->_channel;
+  byte Vchan = Vchannel->_channel;
+  
+  double _Irms = 0;
+  double _watts = 0;
+  double _Vrms = 0;
+  double _VA = 0;
+
+  int16_t* VsamplePtr = Vsample;
+  int16_t* IsamplePtr = Isamples;
       
         // Voltage calibration is the ratio of line voltage to voltage presented at the input.
         // Input voltage is further attenuated with voltage dividing resistors (Vadj_3).
@@ -72,7 +121,7 @@ void samplePower(int channel, int overSample){
 
         // Compute Irms from raw samples
 
-  _Irms = Iratio * sqrt((double)sumIsq / samples);
+  _Irms = Iratio * sqrt((double)rawSumIsq / samples);
   
       // Determine phase correction components.
       // stepCorrection is the number of V samples to add or subtract.
@@ -81,7 +130,7 @@ void samplePower(int channel, int overSample){
       // (CT lead - VT lead) - any gross phase correction for 3 phase measurement.
       // Note that a reversed CT can be corrected by introducing a 180deg gross correction.
 
-  float _phaseCorrection =  (Ichannel->getPhase(_Irms) - Vchannel->getPhase(_Vrms) - Ichannel->_vphase) * samples / 360.0;  // fractional Isamples correction
+  float _phaseCorrection =  (Ichannel->getPhase(_Irms) - Vchannel->getPhase(_Vrms) - Ichannel->_vphase) * samples / (360.0 * cycles);  // fractional Isamples correction
   int stepCorrection = int(_phaseCorrection);                                        // whole steps to correct 
   float stepFraction = _phaseCorrection - stepCorrection;                            // fractional step correction
   if(stepFraction < 0){                                                              // if current lead
@@ -93,25 +142,76 @@ void samplePower(int channel, int overSample){
   trace(T_POWER,3);
 
         // Recompute sums and squares with phase corrected samples.
-
-  int16_t rawV;
-  int16_t rawI;  
-  double _sumVI = 0;
-  double _sumVsq = 0;
-  double _sumIsq = 0;
+        // This is done in fixed point: the interpolation weight is Q15 and the sums are int64.
+        // The V index wraps once, so the loop is split at the wrap rather than using modulo.
+        //
+        // In powerquality mode, the same pass runs Goertzel filters over the current for the
+        // 1st, 3rd, 5th and 7th harmonics.  The samples are exactly cycles long, so the bin
+        // h * cycles falls exactly on harmonic h.  Coefficients (2cos(2pi h cycles/N), Q14)
+        // are recomputed only when the samples or cycles change.
+
+  int64_t _sumVI = 0;
+  int64_t _sumVsq = 0;
+  int64_t _sumIsq = 0;
+
+  static const uint8_t harmonics[4] = {1, 3, 5, 7};
+  static int16_t goertzelSamples = 0;
+  static int16_t goertzelCycles = 0;
+  static int32_t goertzelCoeff[4];
+  int32_t s1[4] = {0, 0, 0, 0};
+  int32_t s2[4] = {0, 0, 0, 0};
+  bool goertzel = powerQuality;
+  if(goertzel && (goertzelSamples != samples || goertzelCycles != cycles)){
+    for(int h=0; h<4; h++){
+      goertzelCoeff[h] = lround(2.0 * cos(2.0 * PI * harmonics[h] * cycles / samples) * 16384.0);
+    }
+    goertzelSamples = samples;
+    goertzelCycles = cycles;
+  }
             
-  Isample[samples] = Isample[0];
+  Isamples[samples] = Isamples[0];
   Vsample[samples] = Vsample[0];      
   int Vindex = (samples + stepCorrection) % samples;
-  for(int i=0; i<samples; i++){  
-    rawI = *IsamplePtr;
-    rawV = Vsample[Vindex]; 
-    rawV += int(stepFraction * (Vsample[Vindex + 1] - Vsample[Vindex]));
-    _sumVsq += rawV * rawV;
-    _sumIsq += rawI * rawI;
-    _sumVI += rawV * rawI;      
-    IsamplePtr++;
-    Vindex = ++Vindex % samples;
+  int32_t fraction = int32_t(stepFraction * 32768.0);                              // Q15 interpolation weight
+  VsamplePtr = Vsample + Vindex;
+  int count = samples - Vindex;                                                     // Samples before V wraps
+  for(int segment=0; segment<2; segment++){
+    for(int i=0; i<count; i++){  
+      int32_t rawI = *IsamplePtr++;
+      int32_t rawV = VsamplePtr[0] + (((VsamplePtr[1] - VsamplePtr[0]) * fraction) >> 15);
+      VsamplePtr++;
+      _sumVsq += rawV * rawV;
+      _sumIsq += rawI * rawI;
+      _sumVI += rawV * rawI;      
+      if(goertzel){
+        for(int h=0; h<4; h++){
+          int32_t s = rawI + (int32_t)(((int64_t)goertzelCoeff[h] * s1[h]) >> 14) - s2[h];
+          s2[h] = s1[h];
+          s1[h] = s;
+        }
+      }
+    }
+    VsamplePtr = Vsample;
+    count = Vindex;
+  }
+
+        // Harmonic magnitudes relative to the fundamental, damped like the watts statistics.
+        // Skip when current is negligible, as the ratios are then just noise.
+
+  if(goertzel && _sumIsq > (int64_t)samples * 16){
+    double mag[4];
+    for(int h=0; h<4; h++){
+      mag[h] = (double)s1[h] * s1[h] + (double)s2[h] * s2[h] - (double)s1[h] * s2[h] * goertzelCoeff[h] / 16384.0;
+    }
+    if(mag[0] > 0){
+      double sumSq = 0;
+      for(int h=1; h<4; h++){
+        double pct = 100.0 * sqrt(MAX(mag[h], 0.0) / mag[0]);
+        sumSq += pct * pct;
+        Ichannel->_harmonic[h-1] += (pct - Ichannel->_harmonic[h-1]) * 0.1;
+      }
+      Ichannel->_thd += (sqrt(sumSq) - Ichannel->_thd) * 0.1;
+    }
   }
 
         // Compute Vrms, Irms, Power, etc.
@@ -141,12 +241,10 @@ void samplePower(int channel, int overSample){
       }
     }
   }
-      // Update with the new power and voltage values.
+      // Add to the sums for this sampling.
 
-  trace(T_POWER,5);
-  Ichannel->setPower(_watts, _VA);
-  trace(T_POWER,9);                                                                               
-  return;
+  *sumWatts += _watts;
+  *sumVA += _VA;
 }
 
   /**********************************************************************************************
@@ -159,6 +257,8 @@ void samplePower(int channel, int overSample){
   *  The approach is to start sampling voltage/current pairs in a tight loop.
   *  When voltage crosses zero, we start recording the pairs.
   *  When we  cross zero 2 more times we stop and return to compute the results.
+  *  Several consecutive cycles can be sampled from the one crossing.  To fit them in
+  *  MAX_SAMPLES, only every stride-th pair is recorded.
   *  
   *  Note:  If ever there was a time for low-level hardware manipulation, this is it.
   *  the tighter and faster the samples can be taken, the more accurate the results can be.
@@ -181,10 +281,12 @@ void samplePower(int channel, int overSample){
   *   
   ****************************************************************************************************/
   
-  int sampleCycle(IotaInputChannel* Vchannel, IotaInputChannel* Ichannel, int cycles){
+  int sampleCycle(IotaInputChannel* Vchannel, IotaInputChannel* Ichannel, int cycles, IotaInputChannel* I2channel){
 
   int Vchan = Vchannel->_channel;
   int Ichan = Ichannel->_channel;
+  if( ! I2sample) I2channel = nullptr;
+  int I2chan = I2channel ? I2channel->_channel : Ichan;
 
   uint32_t dataMask = ((ADC_BITS + 6) << SPILMOSI) | ((ADC_BITS + 6) << SPILMISO);
   const uint32_t mask = ~((SPIMMOSI << SPILMOSI) | (SPIMMISO << SPILMISO));
@@ -192,18 +294,26 @@ void samplePower(int channel, int overSample){
   
   uint8_t  Iport = inputChannel[Ichan]->_addr % 8;       // Port on ADC
   uint8_t  Vport = inputChannel[Vchan]->_addr % 8;
+  uint8_t  I2port = inputChannel[I2chan]->_addr % 8;
     
   int16_t offsetV = Vchannel->_offset;        // Bias offset
   int16_t offsetI = Ichannel->_offset;
+  int16_t offsetI2 = inputChannel[I2chan]->_offset;
   
   int16_t rawV;                               // Raw ADC readings
   int16_t lastV = 0;
   int16_t avgV;
   int16_t rawI = 0;
+  int16_t rawI2 = 0;
         
   int16_t * VsamplePtr = Vsample;             // -> to sample storage arrays
   int16_t * IsamplePtr = Isample;
+  int16_t * I2samplePtr = I2channel ? I2sample : Isample;
     
+        // samplesPerCycle is damped over single and paired sampling, so allow 60% over it.
+
+  int16_t stride = (cycles > 1) ? 1 + int(cycles * samplesPerCycle * 1.6) / MAX_SAMPLES : 1;  // Pairs per recorded sample
+  int16_t strideCount = stride;
   int16_t crossLimit = cycles * 2 + 1;        // number of crossings in total
   int16_t crossCount = 0;                     // number of crossings encountered
   int16_t crossGuard = 3;                     // Guard against faux crossings (must be >= 2 initially)  
@@ -220,9 +330,11 @@ void samplePower(int channel, int overSample){
   byte ADC_VselectPin = ADC_selectPin[inputChannel[Vchan]->_addr >> 3];
   uint32_t ADC_IselectMask = 1 << ADC_IselectPin;             // Mask for hardware chip select (pins 0-15)
   uint32_t ADC_VselectMask = 1 << ADC_VselectPin;
+  uint32_t ADC_I2selectMask = 1 << ADC_selectPin[inputChannel[I2chan]->_addr >> 3];
 
   bool Vreverse = inputChannel[Vchan]->_reverse;
   bool Ireverse = inputChannel[Ichan]->_reverse;
+  bool I2reverse = inputChannel[I2chan]->_reverse;
   
   SPI.beginTransaction(SPISettings(2000000,MSBFIRST,SPI_MODE0));
  
@@ -251,9 +363,12 @@ void samplePower(int channel, int overSample){
           *IsamplePtr = rawI;
           *VsamplePtr = avgV = (rawV + lastV)  >> 1;
           lastV = rawV;
-          if(crossCount) {                                // If past first crossing 
+          if(I2channel) *I2samplePtr = rawI2;
+          if(crossCount && --strideCount == 0) {          // If past first crossing and recording this one
+            strideCount = stride;
             VsamplePtr++;                                 // Accumulate samples
             IsamplePtr++;                                 
+            if(I2channel) I2samplePtr++;
             samples++;                                    // Count samples
             if(samples >= MAX_SAMPLES){                   // If over the legal limit
               trace(T_SAMP,0);                            // shut down and return
@@ -310,6 +425,21 @@ void samplePower(int channel, int overSample){
               // extract the rawI from the SPI hardware buffer and adjust with offset.
  
         rawV = (word(*fifoPtr8 & 0x01, *(fifoPtr8+1)) << 3) + (*(fifoPtr8+2) >> 5) - offsetV;
+
+                      /************************************
+                       *  Sample the second I channel     *
+                       ************************************/
+
+        if(I2channel){
+          GPOC = ADC_I2selectMask;
+          SPI1U1 = (SPI1U1 & mask) | dataMask;
+          SPI1W0 = (0x18 | I2port) << 3;
+          SPI1CMD |= SPIBUSY;
+          while(SPI1CMD & SPIBUSY) {}
+          GPOS = ADC_I2selectMask;
+          rawI2 = (word(*fifoPtr8 & 0x01, *(fifoPtr8+1)) << 3) + (*(fifoPtr8+2) >> 5) - offsetI2;
+          if(rawI2 >= -1 && rawI2 <= 1) rawI2 = 0;
+        }
                
         // Finish up loop cycle by checking for zero crossing.
         // Crossing is defined by voltage changing signs  (Xor) and crossGuard negative.
@@ -328,6 +458,7 @@ void samplePower(int channel, int overSample){
             lastCrossMs = millis();
             *VsamplePtr = (lastV + rawV) >> 1;                                       
             *IsamplePtr = rawI;                           // For main loop dispatcher to estimate when next crossing is imminent
+            if(I2channel) *I2samplePtr = rawI2;
             lastCrossSamples = samples;
             crossGuard = 0;                               // No more crosses for awhile
           }
@@ -339,6 +470,8 @@ void samplePower(int channel, int overSample){
   } while(crossCount < crossLimit || crossGuard > 0); 
 
   trace(T_SAMP,8);
+  sampleCrossUs = firstCrossUs;
+  sampleCycleUs = lastCrossUs - firstCrossUs;
 
           // Process raw samples.
           // Add them to check the offset.
@@ -364,6 +497,17 @@ void samplePower(int channel, int overSample){
     sumVI  += *IsamplePtr * *VsamplePtr;VsamplePtr++;
     IsamplePtr++;
   }
+  int32_t sumI2 = 0;
+  sumI2sq = 0;
+  if(I2channel){
+    I2samplePtr = I2sample;
+    for(int i=0; i<samples; i++){
+      sumI2 += *I2samplePtr;
+      if(I2reverse) *I2samplePtr = - *I2samplePtr;
+      sumI2sq += *I2samplePtr * *I2samplePtr;
+      I2samplePtr++;
+    }
+  }
 
         // Adjust the offset values assuming symmetric waves but within limits otherwise.
  
@@ -385,8 +529,19 @@ void samplePower(int channel, int overSample){
   if(offsetI < minOffset) offsetI = minOffset;
   if(offsetI > maxOffset) offsetI = maxOffset;
   Ichannel->_offset = offsetI; 
+
+  if(I2channel){
+    if(sumI2 >= 0) sumI2 += samples / 2;
+    else sumI2 -= samples / 2;
+    offsetI2 = I2channel->_offset + sumI2 / samples;
+    if(offsetI2 < minOffset) offsetI2 = minOffset;
+    if(offsetI2 > maxOffset) offsetI2 = maxOffset;
+    I2channel->_offset = offsetI2;
+  }
   
-  if(samples < ((lastCrossUs - firstCrossUs) * 380 / 10000)){
+        // Triplets take three ADC reads to the pairs' two, so expect 2/3 the rate.
+
+  if(samples * stride * (I2channel ? 3 : 2) < ((lastCrossUs - firstCrossUs) * 380 * 2 / 10000)){
     Serial.print(F("Low sample count "));
     Serial.println(samples);
     return 1;
@@ -399,7 +554,7 @@ void samplePower(int channel, int overSample){
   }
             // Update damped frequency.
 
-  float Hz = 1000000.0  / float((uint32_t)(lastCrossUs - firstCrossUs));
+  float Hz = 1000000.0 * cycles / float((uint32_t)(lastCrossUs - firstCrossUs));
   Vchannel->setHz(Hz);
   frequency = (0.9 * frequency) + (0.1 * Hz);
 
@@ -408,7 +563,7 @@ void samplePower(int channel, int overSample){
           // It can be a little off per cycle, but by damping the 
           // saved value we can get a pretty accurate average.
 
-  samplesPerCycle = samplesPerCycle * .9 + (samples / cycles) * .1;
+  samplesPerCycle = samplesPerCycle * .9 + (samples * stride / cycles) * .1;
   cycleSamples++;
   
   return 0;
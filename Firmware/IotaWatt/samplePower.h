@@ -1,8 +1,11 @@
 #ifndef samplePower_h
 #define samplePower_h
 
-void    samplePower(int channel, int overSample);
-int     sampleCycle(IotaInputChannel* Vchannel, IotaInputChannel* Ichannel, int cycles = 1);
+int     samplePower(int channel, int cycles = 1, int pair = -1);
+bool    samplePowerCycle(int channel, int cycles, double* sumWatts, double* sumVA, int pair = -1, double* pairWatts = nullptr, double* pairVA = nullptr);
+void    powerFromSamples(IotaInputChannel* Vchannel, IotaInputChannel* Ichannel, int16_t* Isamples, uint32_t rawSumIsq,
+                         int cycles, double* sumWatts, double* sumVA);
+int     sampleCycle(IotaInputChannel* Vchannel, IotaInputChannel* Ichannel, int cycles = 1, IotaInputChannel* I2channel = nullptr);
 float   getAref(int channel);
 int     readADC(uint8_t channel);
 float   sampleVoltage(uint8_t Vchan, float Vcal);
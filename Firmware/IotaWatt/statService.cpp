@@ -44,6 +44,8 @@ uint32_t statService(struct serviceBlock* _serviceBlock) {
     trace(T_stats, 3);
     accum1Then[i] = inputChannel[i]->dataBucket.accum1;
     accum2Then[i] = inputChannel[i]->dataBucket.accum2;
+    sampleCoverage[i] = .75 * sampleCoverage[i] + (1.0 - .75) * float(sampleCycles[i] * 60000) / float((uint32_t)(timeNow - timeThen));
+    sampleCycles[i] = 0;
   }
   trace(T_stats, 4);
   cycleSampleRate = .25 * cycleSampleRate + (1.0 - .25) * float(cycleSamples * 1000) / float((uint32_t)(timeNow - timeThen));
@@ -56,6 +58,8 @@ uint32_t statService(struct serviceBlock* _serviceBlock) {
   heapMsPeriod += timeNow - timeThen;
   timeThen = timeNow;
   trace(T_stats, 5);
+  queryCacheTrim();
+  eventPublish();
   return UTCtime() + statServiceInterval;
 }
 
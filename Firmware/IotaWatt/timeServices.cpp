@@ -72,6 +72,7 @@ uint32_t timeSync(struct serviceBlock* _serviceBlock) {
   trace(T_timeSync, 1);
   if(millis() > 3628800000UL) {
     log("timeSync: Six week routine restart.");
+    msglog.flush();
     ESP.restart();
   }
 
@@ -308,7 +309,7 @@ uint32_t millisAtUTCTime(uint32_t UnixTime){
   return (uint32_t)timeRefMs + 1000 * (UnixTime + SEVENTY_YEAR_SECONDS - timeRefNTP);
  }
 
-uint32_t UTC2Local(uint32_t UTCtime){
+static uint32_t UTC2LocalRule(uint32_t UTCtime){
     uint32_t result = UTCtime + localTimeDiff * 60;
     if( ! timezoneRule) return result;
 
@@ -330,6 +331,86 @@ uint32_t UTC2Local(uint32_t UTCtime){
     return result;
 }
 
+      // Local time offsets are kept in a table of the UTC instants when the offset changes,
+      // built from the timezone rule for DST_TABLE_YEARS around the time being converted.
+      // The segment (between transitions) of the last conversion is remembered, so most 
+      // conversions are a compare with it.  The table is rebuilt when a conversion falls 
+      // outside it, and reset (DSTtableReset) when the configuration changes.
+
+#define DST_TABLE_YEARS 4                     // Years of transitions in the table
+#define DST_TABLE_MAX (DST_TABLE_YEARS * 2 + 1)
+#define DST_TABLE_STEP (7 * 86400)            // Scan step, less than the shortest DST period
+
+static uint32_t dstTableBeg = 0;              // UTC range covered by the table
+static uint32_t dstTableEnd = 0;
+static uint8_t  dstTableCount = 0;
+static uint32_t dstTableTime[DST_TABLE_MAX];  // UTC when each offset begins (first is dstTableBeg)
+static int32_t  dstTableOffset[DST_TABLE_MAX];// Local - UTC seconds
+static uint32_t dstSegBeg = 1;                // Segment of last conversion (empty)
+static uint32_t dstSegEnd = 0;
+static int32_t  dstSegOffset = 0;
+
+void DSTtableReset(){
+  dstTableBeg = 0;
+  dstTableEnd = 0;
+  dstSegBeg = 1;
+  dstSegEnd = 0;
+}
+
+static void DSTbuildTable(uint32_t UTCtime){
+  int year = DateTime(UTCtime).year();
+  dstTableBeg = Unixtime(MAX(year - 1, 1970), 1, 1);
+  dstTableEnd = Unixtime(MAX(year - 1, 1970) + DST_TABLE_YEARS, 1, 1);
+  int32_t offset = UTC2LocalRule(dstTableBeg) - dstTableBeg;
+  dstTableTime[0] = dstTableBeg;
+  dstTableOffset[0] = offset;
+  dstTableCount = 1;
+  uint32_t time = dstTableBeg;
+  while(time < dstTableEnd && dstTableCount < DST_TABLE_MAX){
+    uint32_t next = MIN(time + DST_TABLE_STEP, dstTableEnd);
+    int32_t nextOffset = UTC2LocalRule(next) - next;
+    if(nextOffset != offset){
+
+          // Offset changed in this step, binary search for the second it did.
+
+      uint32_t low = time;
+      uint32_t high = next;
+      while((high - low) > 1){
+        uint32_t mid = low + (high - low) / 2;
+        if((int32_t)(UTC2LocalRule(mid) - mid) == offset){
+          low = mid;
+        } else {
+          high = mid;
+        }
+      }
+      dstTableTime[dstTableCount] = high;
+      dstTableOffset[dstTableCount++] = nextOffset;
+      offset = nextOffset;
+    }
+    time = next;
+  }
+}
+
+uint32_t UTC2Local(uint32_t UTCtime){
+  if( ! timezoneRule){
+    return UTCtime + localTimeDiff * 60;
+  }
+  if(UTCtime >= dstSegBeg && UTCtime < dstSegEnd){
+    return UTCtime + dstSegOffset;
+  }
+  if(UTCtime < dstTableBeg || UTCtime >= dstTableEnd){
+    DSTbuildTable(UTCtime);
+  }
+  int i = dstTableCount - 1;
+  while(i > 0 && dstTableTime[i] > UTCtime){
+    i--;
+  }
+  dstSegBeg = dstTableTime[i];
+  dstSegEnd = (i + 1 < dstTableCount) ? dstTableTime[i + 1] : dstTableEnd;
+  dstSegOffset = dstTableOffset[i];
+  return UTCtime + dstSegOffset;
+}
+
 uint32_t  local2UTC(uint32_t localTime){
   uint32_t trialUTC = localTime - localTimeDiff * 60;
   uint32_t testLocal = UTC2Local(trialUTC);
@@ -60,6 +60,7 @@ uint32_t  millisAtUTCTime(uint32_t);
 void      dateTime(uint16_t* date, uint16_t* time);
 uint32_t  littleEndian(uint32_t);
 uint32_t  UTC2Local(uint32_t UTCtime);
+void      DSTtableReset();
 uint32_t  local2UTC(uint32_t localTime);
 bool      testRule(uint32_t standardTime, dateTimeRule);
 
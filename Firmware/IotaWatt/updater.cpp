@@ -12,7 +12,7 @@ uint32_t updater(struct serviceBlock* _serviceBlock) {
   static states state = initialize;
   static asyncHTTPrequest* request = nullptr;
   static String updateVersion;
-  static File releaseFile;
+  static updateUnpacker* unpacker = nullptr;
   static bool upToDate = false;
   static bool parseError = false;
   static int checkResponse = 0;
@@ -169,20 +169,8 @@ uint32_t updater(struct serviceBlock* _serviceBlock) {
     case createFile: {
       trace(T_UPDATE,5); 
       log("Updater: download %s", updateVersion.c_str());
-      deleteRecursive("download");
-      if( ! SD.mkdir("download")){
-        log("Cannot create download directory");
-        state = checkAutoUpdate;
-        break;
-      }
-      String filePath = "download/" + updateVersion + ".bin";
-      releaseFile = SD.open(filePath.c_str(), FILE_WRITE);
-      if(! releaseFile){
-        log("Updater: Cannot create download file.");
-        deleteRecursive("download");
-        state = checkAutoUpdate;
-        break;
-      }
+      delete unpacker;
+      unpacker = new updateUnpacker(updateVersion);
       state = download;
       return 1;
     }
@@ -204,10 +192,10 @@ uint32_t updater(struct serviceBlock* _serviceBlock) {
       request->open("GET", URL.c_str());
       request->setTimeout(5);
       request->onData([](void* arg, asyncHTTPrequest* request, size_t available){
-        uint8_t *buf = new uint8_t[500];
+        uint8_t *buf = new uint8_t[512];
         while(request->available()){
-          size_t read = request->responseRead(buf, 500);
-          releaseFile.write(buf, read);
+          size_t read = request->responseRead(buf, 512);
+          unpacker->write(buf, read);
         }
         delete[] buf;
         });
@@ -216,7 +204,7 @@ uint32_t updater(struct serviceBlock* _serviceBlock) {
           // Writing to the SD in async handler can cause problems. If we return
           // and keep sampling, the onData handler could interupt another service
           // in the middle of SDcard work.  So we will go synchronous here and wait
-          // for the entire update blob to be transfered and written to SD.
+          // for the entire update blob to be transfered and unpacked to SD.
           // Takes about 5-10 seconds.
 
       setLedCycle(LED_UPDATING);
@@ -225,17 +213,17 @@ uint32_t updater(struct serviceBlock* _serviceBlock) {
       }
       endLedCycle();
       HTTPrelease(HTTPtoken);
-      size_t fileSize = releaseFile.size();
-      releaseFile.close();
       if(request->responseHTTPcode() != 200){
-        log("Updater: Download failed HTTPcode %s", request->responseHTTPcode());
+        log("Updater: Download failed HTTPcode %d", request->responseHTTPcode());
         delete request;
         request = nullptr;
-        deleteRecursive("download");
+        delete unpacker;
+        unpacker = nullptr;
+        deleteRecursive(updateVersion);
         state = getVersion;
         break;
       }
-      log("Updater: Release downloaded %dms, size %d", request->elapsedTime(), fileSize);
+      log("Updater: Release downloaded %dms", request->elapsedTime());
       delete request;
       request = nullptr;
       state = install;
@@ -244,10 +232,14 @@ uint32_t updater(struct serviceBlock* _serviceBlock) {
 
     case install: {
       trace(T_UPDATE,7); 
-      if(unpackUpdate(updateVersion)){
+      bool valid = unpacker->finish();
+      delete unpacker;
+      unpacker = nullptr;
+      if(valid){
         if(installUpdate(updateVersion)){
           log ("Updater: Firmware updated, restarting.");
           delay(500);
+          msglog.flush();
           ESP.restart();
         }
       }
@@ -260,141 +252,225 @@ uint32_t updater(struct serviceBlock* _serviceBlock) {
 /**************************************************************************************************
  * bool unpackUpdate(String version)
  * 
- * unpack the release blob to create a directory of support files to be
- * installed during the next restart, as well as the firmware binary
- * file with md-5 appendage to be installed before restart.
- * 
- * After unpacking, the signature on the file is verified using the IoTaWatt public key.
- * Only release files from IotaWatt.com can be verified because the private-key is needed to
- * sign with the digital signature.
+ * unpack a release blob that has been placed in the download directory (download/version.bin)
+ * to create a directory of support files to be installed during the next restart, as well as
+ * the firmware binary file with md-5 appendage to be installed before restart.  The automatic
+ * updater doesn't stage the blob; it feeds the download directly to an updateUnpacker.
  * 
  *************************************************************************************************/
 
 bool unpackUpdate(String version){
-
-  union {
-    struct {
-      char file[4];
-      uint32_t len;
-      char name[24];
-    } fileHeader;
-    struct { 
-      char IotaWatt[8];
-      char release[8];
-    } updtHeader;
-    uint8_t header[32];
-  } headers;
-
-  bool binaryFound = false;
-  SHA256 sha256;
-  MD5Builder md5;
-
-        // open the release file and setup to sha256
-
   String filePath = "download/" + version + ".bin";
   File releaseFile = SD.open((char*)filePath.c_str(), FILE_READ);
   if(! releaseFile){
     log("Updater: %s not found", filePath.c_str());
     return false;
   }
-  int signatureSize = 64;
-  uint32_t binarySize = releaseFile.size() - signatureSize;
-  sha256.reset();
-
-        // Read and verify the header
-
-  if(true){
-    releaseFile.read(headers.header,sizeof(headers.updtHeader));
-    sha256.update(headers.header,sizeof(headers.updtHeader));
-    binarySize -= sizeof(headers.updtHeader);
-    if((memcmp(headers.updtHeader.IotaWatt, "IotaWatt", 8) != 0) ||
-       (memcmp(headers.updtHeader.release, version.c_str(), 8) != 0)) {
-      log("Updater: release file header invalid. %s %s",headers.updtHeader.IotaWatt,headers.updtHeader.release);
-      releaseFile.close();
-      return false;
+  updateUnpacker unpacker(version);
+  int buffSize = 512;
+  uint8_t* buff = new uint8_t [buffSize];
+  while(releaseFile.available() && ! unpacker.failed()){
+    int read = releaseFile.read(buff, buffSize);
+    if(read <= 0) break;
+    unpacker.write(buff, read);
+  }
+  delete[] buff;
+  releaseFile.close();
+  return unpacker.finish();
+}
+
+/**************************************************************************************************
+ * updateUnpacker
+ * 
+ * The release blob is a 16 byte header ("IotaWatt" and the version), then for each file a 
+ * 32 byte header ("FILE", length, name) followed by the file padded to a multiple of 8 bytes.
+ * The last 64 bytes are the Ed25519 signature of the SHA256 of everything before it.
+ * 
+ * Files in the release named xxx.gz are precompressed web assets.  They are placed in the 
+ * gzip subdirectory with the .gz removed, to keep to 8.3 names, and are installed to the 
+ * gzip directory in the SD root, where loadFromSdCard serves them to clients that accept gzip.
+ * 
+ * The signature on the file is verified using the IoTaWatt public key when the blob is complete.
+ * Only release files from IotaWatt.com can be verified because the private-key is needed to
+ * sign with the digital signature.  If the release doesn't verify, the update directory is 
+ * deleted.
+ * 
+ *************************************************************************************************/
+
+updateUnpacker::updateUnpacker(const String& version)
+  :_version(version)
+  ,_dataLen(0)
+  ,_fileLen(0)
+  ,_holdLen(0)
+  ,_headerLen(0)
+  ,_started(false)
+  ,_iotawattBin(false)
+  ,_binaryFound(false)
+  ,_failed(false)
+  {
+    _sha256.reset();
+  }
+
+updateUnpacker::~updateUnpacker(){
+  if(_outFile){
+    _outFile.close();
+  }
+}
+
+void updateUnpacker::write(const uint8_t* data, size_t len){
+  if(_failed){
+    return;
+  }
+  size_t release = (_holdLen + len > sizeof(_hold)) ? _holdLen + len - sizeof(_hold) : 0;
+  size_t fromHold = MIN(release, (size_t)_holdLen);
+  if(fromHold){
+    unpack(_hold, fromHold);
+    memmove(_hold, _hold + fromHold, _holdLen - fromHold);
+    _holdLen -= fromHold;
+  }
+  unpack(data, release - fromHold);
+  data += release - fromHold;
+  len -= release - fromHold;
+  memcpy(_hold + _holdLen, data, len);
+  _holdLen += len;
+}
+
+void updateUnpacker::unpack(const uint8_t* data, size_t len){
+  while(len && ! _failed){
+
+        // Accumulate a header, release header first then file headers.
+
+    if(_dataLen == 0){
+      size_t headerSize = _started ? 32 : 16;
+      size_t chunk = MIN(len, headerSize - _headerLen);
+      memcpy(_header + _headerLen, data, chunk);
+      _headerLen += chunk;
+      data += chunk;
+      len -= chunk;
+      if(_headerLen == headerSize){
+        _sha256.update(_header, headerSize);
+        _headerLen = 0;
+        _failed = ! (_started ? fileHeader() : releaseHeader());
+      }
+      continue;
+    }
+
+        // File data.  The padding is hashed but not written.
+
+    size_t chunk = MIN(len, _dataLen);
+    _sha256.update(data, chunk);
+    size_t write = MIN(chunk, _fileLen);
+    if(write){
+      _outFile.write(data, write);
+      if(_iotawattBin) _md5.add((uint8_t*)data, write);
+      _fileLen -= write;
+    }
+    _dataLen -= chunk;
+    data += chunk;
+    len -= chunk;
+    if(_dataLen == 0){
+      endFile();
     }
   }
+}
+
+bool updateUnpacker::releaseHeader(){
+  if((memcmp(_header, "IotaWatt", 8) != 0) || (memcmp(_header + 8, _version.c_str(), 8) != 0)) {
+    log("Updater: release file header invalid.");
+    return false;
+  }
+
         // Create the local update directory.
 
-  deleteRecursive(String(version));
-  if( ! SD.mkdir(version.c_str())){
+  deleteRecursive(_version);
+  if( ! SD.mkdir(_version.c_str())){
     log("Updater: Cannot create update directory");
-    releaseFile.close();
     return false;
   }
-        // Read the update blob and create the various files.
-
-  while(binarySize){
-    releaseFile.read(headers.header,sizeof(headers.fileHeader));
-    sha256.update(headers.header,sizeof(headers.fileHeader));
-    binarySize -= sizeof(headers.fileHeader);
-    if(memcmp(headers.fileHeader.file,"FILE",4) != 0) {
-      log("Updater: Release file format error.");
-      releaseFile.close();
-      return false;
-    }
-    String filename = String(headers.fileHeader.name);
-    bool iotawattBin = filename.equalsIgnoreCase("iotawatt.bin");
-    if(iotawattBin){
-      binaryFound = true;
-      md5.begin();
-    }
-    String filePath = version + "/" + headers.fileHeader.name;
-    uint32_t fileSize = headers.fileHeader.len;
-    File outFile = SD.open((char*)filePath.c_str(), FILE_WRITE);
-    if( ! outFile){
-      log("Updater: unable to create file: %s", filePath.c_str());
-      releaseFile.close();
-      return false;
-    }
-    int buffSize = 512;
-    uint8_t* buff = new uint8_t [buffSize];
-    while(fileSize){
-      int chunk = MIN(fileSize, buffSize);
-      if(chunk % 8) chunk += 8 - chunk % 8;
-      releaseFile.read(buff, chunk);
-      sha256.update(buff, chunk);
-      binarySize -= chunk;
-      outFile.write(buff, MIN(fileSize, buffSize));
-      if(iotawattBin) md5.add(buff, MIN(fileSize, buffSize));
-      fileSize -= MIN(fileSize, buffSize);
-    }
-    delete[] buff;
-    if(iotawattBin) {
-      md5.calculate();
-      uint8_t md5Char[32];
-      md5.getChars((char*)md5Char);
-      outFile.write(md5Char, 32);
+  _started = true;
+  return true;
+}
+
+bool updateUnpacker::fileHeader(){
+  if(memcmp(_header, "FILE", 4) != 0) {
+    log("Updater: Release file format error.");
+    return false;
+  }
+  char name[25];
+  memcpy(name, _header + 8, 24);
+  name[24] = 0;
+  String filename = String(name);
+  _iotawattBin = filename.equalsIgnoreCase("iotawatt.bin");
+  if(_iotawattBin){
+    _binaryFound = true;
+    _md5.begin();
+  }
+  String filePath = _version + "/" + filename;
+  if(filename.endsWith(".gz")){
+    filePath = _version + GZIP_DIR;
+    if( ! SD.exists((char*)filePath.c_str())){
+      SD.mkdir((char*)filePath.c_str());
     }
-    outFile.close();
-    if(fileSize){
-      return false;
-    } 
+    filePath += "/" + filename.substring(0, filename.length() - 3);
+  }
+  _outFile = SD.open((char*)filePath.c_str(), FILE_WRITE);
+  if( ! _outFile){
+    log("Updater: unable to create file: %s", filePath.c_str());
+    return false;
+  }
+  memcpy(&_fileLen, _header + 4, 4);
+  _dataLen = _fileLen;
+  if(_dataLen % 8) _dataLen += 8 - _dataLen % 8;
+  if(_dataLen == 0){
+    endFile();
+  }
+  return true;
+}
+
+void updateUnpacker::endFile(){
+  if(_iotawattBin) {
+    _md5.calculate();
+    uint8_t md5Char[32];
+    _md5.getChars((char*)md5Char);
+    _outFile.write(md5Char, 32);
+    _iotawattBin = false;
   }
+  _outFile.close();
+}
+
         // verify the signature
 
-  
-  uint8_t signature[64];
-  uint8_t sha[32];
-  sha256.finalize(sha,32);
-  if(releaseFile.available() != 64){
+bool updateUnpacker::finish(){
+  if(_outFile){
+    _outFile.close();
+  }
+  if( ! _failed && (_dataLen || _headerLen || ! _started)){
+    log("Updater: Release file incomplete.");
+    _failed = true;
+  }
+  if( ! _failed && _holdLen != 64){
     log("Updater: Update rejected, no signature.");
-    releaseFile.close();
-    return false;
+    _failed = true;
   }
-  releaseFile.read(signature, 64);
-  releaseFile.close();
-  
-  uint8_t* key = new uint8_t[32];
-  memcpy_P(key, publicKey, 32);
-  if(! Ed25519::verify(signature, key, sha, 32)){
-    log("Updater: Signature does not verify.");
+  if( ! _failed){
+    uint8_t sha[32];
+    _sha256.finalize(sha,32);
+    uint8_t* key = new uint8_t[32];
+    memcpy_P(key, publicKey, 32);
+    if(! Ed25519::verify(_hold, key, sha, 32)){
+      log("Updater: Signature does not verify.");
+      _failed = true;
+    }
     delete[] key;
+  }
+  if(_failed){
+    if(_started){
+      deleteRecursive(_version);
+    }
     return false;
   }
-  delete[] key;
   log("Updater: signature verified");
-  return binaryFound;
+  return _binaryFound;
 }
 
 /***********************************************************************************************************
@@ -446,6 +522,9 @@ bool installUpdate(String version){
  * Copy release files staged in the update directory to the SD root.
  * Delete the files as they are copied and delete the directory when complete.
  * 
+ * Installing a file removes any compressed copy, then the compressed copies 
+ * in the release (staged gzip directory) are installed.
+ * 
  ***********************************************************************************************************/
 
 bool copyUpdate(String version){
@@ -461,22 +540,32 @@ bool copyUpdate(String version){
   uint8_t* buff = new uint8_t [buffSize];
   File inFile;
   while(inFile = updtDir.openNextFile()){
-    if(strcmp_ci(inFile.name(),"config.txt") == 0 && SD.exists(inFile.name())){
+    if(inFile.isDirectory() ||
+      (strcmp_ci(inFile.name(),"config.txt") == 0 && SD.exists(inFile.name()))){
       inFile.close();
       continue;
     }
     log("Updater: Installing %s", inFile.name());
     SD.remove(inFile.name());
-    File outFile = SD.open(inFile.name(), FILE_WRITE);
-    uint32_t fileSize = inFile.size();
-    while(fileSize){
-      int chunk = MIN(fileSize, buffSize);
-      inFile.read(buff, chunk);
-      outFile.write(buff, chunk);
-      fileSize -= chunk;
+    SD.remove((String(GZIP_DIR) + "/" + inFile.name()).c_str());
+    copyUpdateFile(inFile, inFile.name(), buff, buffSize);
+  }
+  updtDir.close();
+
+  File gzipDir = SD.open((char*)(version + GZIP_DIR).c_str());
+  if(gzipDir && gzipDir.isDirectory()){
+    if( ! SD.exists(GZIP_DIR)){
+      SD.mkdir(GZIP_DIR);
+    }
+    while(inFile = gzipDir.openNextFile()){
+      String outPath = String(GZIP_DIR) + "/" + inFile.name();
+      log("Updater: Installing %s", outPath.c_str());
+      SD.remove((char*)outPath.c_str());
+      copyUpdateFile(inFile, outPath.c_str(), buff, buffSize);
     }
-    inFile.close();
-    outFile.close();
+  }
+  if(gzipDir){
+    gzipDir.close();
   }
   delete[] buff;
   log("Updater: Installation complete.");
@@ -484,6 +573,19 @@ bool copyUpdate(String version){
   return true;
 }
 
+void copyUpdateFile(File& inFile, const char* outPath, uint8_t* buff, int buffSize){
+  File outFile = SD.open(outPath, FILE_WRITE);
+  uint32_t fileSize = inFile.size();
+  while(fileSize){
+    int chunk = MIN(fileSize, buffSize);
+    inFile.read(buff, chunk);
+    outFile.write(buff, chunk);
+    fileSize -= chunk;
+  }
+  inFile.close();
+  outFile.close();
+}
+
 void printHex(uint8_t* data, size_t len){
   const char* hexchars = "0123456789abcdef";
   for(int i=0; i<len; i+=16){
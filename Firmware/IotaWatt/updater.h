@@ -5,6 +5,44 @@ bool      checkUpdate();
 bool      downloadUpdate(String version);
 bool      installUpdate(String version);
 bool      copyUpdate(String version);
+void      copyUpdateFile(File& inFile, const char* outPath, uint8_t* buff, int buffSize);
 bool      unpackUpdate(String version);
 
+/*************************************************************************************************
+ * updateUnpacker unpacks a release blob as it is received.  Bytes are hashed and the files
+ * written to the update directory as they arrive, and the signature checked by finish(),
+ * so the release is never staged whole on the SD.  The last 64 bytes are held back, as they
+ * are the signature when the blob is complete.
+ *************************************************************************************************/
+
+class updateUnpacker {
+  public:
+    updateUnpacker(const String& version);
+    ~updateUnpacker();
+    void      write(const uint8_t* data, size_t len);   // Unpack more of the blob
+    bool      finish();                                 // Verify, true if release is valid
+    bool      failed(){return _failed;}
+
+  private:
+    String      _version;
+    SHA256      _sha256;
+    MD5Builder  _md5;
+    File        _outFile;
+    uint32_t    _dataLen;             // Remaining (padded) data bytes of current file
+    uint32_t    _fileLen;             // Remaining bytes of current file to write
+    uint8_t     _hold[64];            // Most recent bytes, not yet unpacked
+    uint8_t     _holdLen;
+    uint8_t     _header[32];          // Header being accumulated
+    uint8_t     _headerLen;
+    bool        _started;             // Release header verified, directory created
+    bool        _iotawattBin;         // Current file is the firmware binary
+    bool        _binaryFound;
+    bool        _failed;
+
+    void        unpack(const uint8_t* data, size_t len);
+    bool        releaseHeader();
+    bool        fileHeader();
+    void        endFile();
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,79 @@
+#include "IotaWatt.h"
+
+void uploadControl::sent(){
+  _sentMs = millis();
+}
+
+    // Round trip is smoothed 1/4 new, 3/4 old (the first sample is taken as is)
+    // and batch size adjusted additively up, multiplicatively down.
+
+void uploadControl::success(){
+  uint32_t rtt = millis() - _sentMs;
+  _rttMs = _rttMs ? (rtt + _rttMs * 3) / 4 : rtt;
+  _failures = 0;
+  uint32_t heap = ESP.getFreeHeap();
+  if(heap < UPLOAD_HEAP_LOW || _rttMs > UPLOAD_RTT_SLOW){
+    _batch = MAX(_minBatch, _batch / 2);
+  }
+  else if(heap > UPLOAD_HEAP_HIGH && _rttMs < UPLOAD_RTT_FAST){
+    _batch = MIN(_maxBatch, _batch + _minBatch);
+  }
+}
+
+    // Delay is 1, 2, 4... seconds up to UPLOAD_BACKOFF_MAX, plus up to half again at random.
+    // The round trip estimate is raised to at least the time this request took, and doubled,
+    // so a server slower than the current timeout gets a longer one on the retry.
+
+uint32_t uploadControl::failure(){
+  if(_failures < 0xFFFF){
+    _failures++;
+  }
+  if(_rttMs){
+    _rttMs = MIN(MAX(_rttMs * 2, millis() - _sentMs), UPLOAD_TIMEOUT_MAX * 1000UL);
+  }
+  _batch = _minBatch;
+  uint32_t delay = 1UL << MIN(_failures - 1, 9);
+  delay = MIN(delay, UPLOAD_BACKOFF_MAX);
+  delay += random(delay / 2 + 1);
+  return UTCtime() + delay;
+}
+
+    // Until there is a round trip sample, allow the longest timeout.
+
+uint8_t uploadControl::timeout(){
+  if( ! _rttMs){
+    return UPLOAD_TIMEOUT_MAX;
+  }
+  return constrain((_rttMs * 4) / 1000 + UPLOAD_TIMEOUT_MIN, UPLOAD_TIMEOUT_MIN, UPLOAD_TIMEOUT_MAX);
+}
+
+    // Checkpoint file is "signature,lastPost".
+
+void uploadControl::checkpoint(const char* path, uint32_t signature){
+  _ckpPath = path;
+  _ckpSignature = signature;
+  _ckpSaved = 0;
+}
+
+uint32_t uploadControl::resume(){
+  if( ! _ckpPath || ! spiffsFileExists(_ckpPath)){
+    return 0;
+  }
+  String contents = spiffsRead(_ckpPath);
+  char* next;
+  uint32_t signature = strtoul(contents.c_str(), &next, 10);
+  if(signature != _ckpSignature || *next != ','){
+    return 0;
+  }
+  return strtoul(next + 1, nullptr, 10);
+}
+
+void uploadControl::posted(uint32_t lastPost){
+  if( ! _ckpPath || (UTCtime() - _ckpSaved) < UPLOAD_CHECKPOINT_SEC){
+    return;
+  }
+  char contents[24];
+  sprintf_P(contents, PSTR("%u,%u"), _ckpSignature, lastPost);
+  spiffsWrite(_ckpPath, String(contents));
+  _ckpSaved = UTCtime();
+}
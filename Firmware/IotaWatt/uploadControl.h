@@ -0,0 +1,76 @@
+#ifndef uploadControl_h
+#define uploadControl_h
+#include <Arduino.h>
+
+/*******************************************************************************************************
+ * uploadControl is the flow control shared by the uploaders (influxDB, Emoncms, PVoutput).
+ * Each service keeps one, marks each request sent() and reports the outcome as success()
+ * or failure().  From that it keeps a smoothed round-trip time and a consecutive failure count
+ * and derives:
+ *
+ *    batchLimit()  Request size to build.  Grows while the server responds quickly and heap is 
+ *                  plentiful, shrinks when responses slow or heap gets low, and drops back to 
+ *                  the minimum after a failure.
+ *    timeout()     Request timeout in seconds, a few round trips, so a slow server doesn't hold 
+ *                  an HTTP reservation much longer than it needs to.  It starts at the maximum
+ *                  and grows back after failures.
+ *    failure()     Returns the UTCtime to retry, backing off exponentially with random jitter
+ *                  so several units (or services) don't retry in lockstep against a server 
+ *                  that is struggling.
+ *
+ * It also keeps a checkpoint of the last acknowledged post in SPIFFS, tagged with a signature
+ * of the service configuration, so a restart with the same configuration can resume posting
+ * at once instead of asking the server where it left off.  The checkpoint is written at most 
+ * every UPLOAD_CHECKPOINT_SEC to spare the flash, so a resume may repost a few intervals.
+ ******************************************************************************************************/
+
+#define UPLOAD_RTT_FAST 500                 // Grow batch when RTT (ms) below
+#define UPLOAD_RTT_SLOW 2000                // Shrink batch when RTT (ms) above
+#define UPLOAD_HEAP_LOW 12000               // Shrink batch when heap below
+#define UPLOAD_HEAP_HIGH 20000              // Grow batch when heap above
+#define UPLOAD_BACKOFF_MAX 300              // Max retry delay (sec)
+#define UPLOAD_TIMEOUT_MIN 2                // Request timeout bounds (sec)
+#define UPLOAD_TIMEOUT_MAX 10
+#define UPLOAD_CHECKPOINT_SEC 600           // Min interval between checkpoint writes
+
+class uploadControl {
+
+  public:
+    uploadControl(size_t minBatch, size_t maxBatch)
+    :_minBatch(minBatch)
+    ,_maxBatch(maxBatch)
+    ,_batch(minBatch)
+    ,_sentMs(0)
+    ,_rttMs(0)
+    ,_failures(0)
+    ,_ckpPath(nullptr)
+    ,_ckpSignature(0)
+    ,_ckpSaved(0)
+    {};
+
+    void        sent();                     // Request sent, start round trip timer
+    void        success();                  // Request completed successfully
+    uint32_t    failure();                  // Request failed, returns UTCtime to retry
+
+    size_t      batchLimit(){return _batch;}
+    uint8_t     timeout();
+    uint32_t    rttMs(){return _rttMs;}
+    uint16_t    failures(){return _failures;}
+
+    void        checkpoint(const char* path, uint32_t signature);   // Set checkpoint file and config signature
+    uint32_t    resume();                   // Checkpointed last post for this config, or zero
+    void        posted(uint32_t lastPost);  // Last post acknowledged, checkpoint if due
+
+  private:
+    size_t      _minBatch;
+    size_t      _maxBatch;
+    size_t      _batch;                     // Current batch limit
+    uint32_t    _sentMs;                    // millis() when last request sent
+    uint32_t    _rttMs;                     // Smoothed round trip (ms)
+    uint16_t    _failures;                  // Consecutive failures
+    const char* _ckpPath;                   // SPIFFS checkpoint file
+    uint32_t    _ckpSignature;              // Signature of configuration checkpointed
+    uint32_t    _ckpSaved;                  // UTCtime checkpoint last written
+};
+
+#endif
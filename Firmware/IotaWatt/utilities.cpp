@@ -87,56 +87,49 @@ void   hex2bin(uint8_t* out, const char* in, size_t len){
     }
 }
 
+/**************************************************************************************************
+ * base64 encode len bytes and append to an xbuf, padding the last group.
+ * Callers streaming a larger payload pass multiples of 3 until the end.
+ * ************************************************************************************************/
+void base64encode(const uint8_t* in, size_t len, xbuf* out){
+  uint8_t group[4];
+  while(len){
+    uint8_t in0 = in[0];
+    uint8_t in1 = len > 1 ? in[1] : 0;
+    uint8_t in2 = len > 2 ? in[2] : 0;
+    group[0] = pgm_read_byte(base64codes_P + (in0 >> 2));
+    group[1] = pgm_read_byte(base64codes_P + ((in0 << 4 | in1 >> 4) & 0x3f));
+    group[2] = len > 1 ? pgm_read_byte(base64codes_P + ((in1 << 2 | in2 >> 6) & 0x3f)) : '=';
+    group[3] = len > 2 ? pgm_read_byte(base64codes_P + (in2 & 0x3f)) : '=';
+    out->write(group, 4);
+    if(len < 3) break;
+    in += 3;
+    len -= 3;
+  }
+}
+
 /**************************************************************************************************
  * Convert the contents of an xbuf to base64
  * ************************************************************************************************/
 void base64encode(xbuf* buf){
-  char* base64codes = new char[65];
-  strcpy_P(base64codes, base64codes_P);
+  uint8_t in[48];
   size_t supply = buf->available();
-  uint8_t in[3];
-  uint8_t out[4];
   trace(T_base64,2,supply);
-  while(supply >= 3){
-    buf->read(in,3);
-    out[0] = (uint8_t) base64codes[in[0]>>2];
-    out[1] = (uint8_t) base64codes[(in[0]<<4 | in[1]>>4) & 0x3f];
-    out[2] = (uint8_t) base64codes[(in[1]<<2 | in[2]>>6) & 0x3f];
-    out[3] = (uint8_t) base64codes[in[2] & 0x3f];
-    buf->write(out, 4);
-    supply -= 3;
+  while(supply){
+    size_t len = MIN(supply, sizeof(in));
+    buf->read(in, len);
+    base64encode(in, len, buf);
+    supply -= len;
   }
   trace(T_base64,3,supply);
-  if(supply > 0){
-    in[0] = in[1] = in[2] = 0;
-    buf->read(in,supply);
-    out[0] = (uint8_t) base64codes[in[0]>>2];
-    out[1] = (uint8_t) base64codes[(in[0]<<4 | in[1]>>4) & 0x3f];
-    out[2] = (uint8_t) base64codes[(in[1]<<2 | in[2]>>6) & 0x3f];
-    out[3] = (uint8_t) base64codes[in[2] & 0x3f];
-    if(supply == 1) {
-      out[2] = out[3] = (uint8_t) '=';
-    }
-    else if(supply == 2){
-      out[3] = (uint8_t) '=';
-    }
-    buf->write(out, 4);
-  }
-  delete[] base64codes;
 }
 
 String base64encode(const uint8_t* in, size_t len){
   trace(T_base64,0,len);
-  if(len <= 0){
-     trace(T_base64,2);
-     return String("");
-  }
-  size_t _len = len * 2 + len;
   xbuf work;
-  work.write(in, len);
-  base64encode(&work);
-  return work.readString(work.available());
+  base64encode(in, len, &work);
   trace(T_base64,1);
+  return work.readString(work.available());
 }
 
 /**************************************************************************************************
@@ -352,6 +345,59 @@ void hashFile(uint8_t* sha, File file){
   file.seek(pos);
 }
 
+uint32_t hashFNV(uint32_t hash, const void* data, size_t len){
+  const uint8_t* ptr = (const uint8_t*)data;
+  while(len--){
+    hash = (hash ^ *ptr++) * 16777619;
+  }
+  return hash;
+}
+
+/**************************************************************************************************
+ *     floatToHalf, halfToFloat - IEEE 754 half precision (rounded to nearest)                    *
+ * ************************************************************************************************/
+uint16_t floatToHalf(float value){
+  uint32_t bits;
+  memcpy(&bits, &value, 4);
+  uint16_t sign = (bits >> 16) & 0x8000;
+  int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = bits & 0x7fffff;
+  if(((bits >> 23) & 0xff) == 0xff){
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);          // Infinity or NaN
+  }
+  if(exponent >= 31){
+    return sign | 0x7c00;                                   // Overflow to infinity
+  }
+  if(exponent <= 0){                                        // Subnormal or zero
+    if(exponent < -10){
+      return sign;
+    }
+    mantissa |= 0x800000;
+    int shift = 14 - exponent;
+    uint16_t half = mantissa >> shift;
+    if((mantissa >> (shift - 1)) & 1) half++;
+    return sign | half;
+  }
+  uint16_t half = sign | (exponent << 10) | (mantissa >> 13);
+  if(mantissa & 0x1000) half++;                             // Carry into exponent is correct
+  return half;
+}
+
+float halfToFloat(uint16_t half){
+  uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+  uint32_t exponent = (half >> 10) & 0x1f;
+  uint32_t mantissa = half & 0x3ff;
+  if(exponent == 0){
+    float value = mantissa * 5.9604645e-8f;                 // 2^-24
+    return sign ? -value : value;
+  }
+  uint32_t bits = sign | (mantissa << 13);
+  bits |= (exponent == 31) ? 0x7f800000 : (exponent - 15 + 127) << 23;
+  float value;
+  memcpy(&value, &bits, 4);
+  return value;
+}
+
 /**************************************************************************************************
  *     copyFile(dest, source) Make a copy of a file                                               *  
  * ***********************************************************************************************/
@@ -18,6 +18,7 @@ String formatHex(uint32_t data);                    // Convert the input to a St
 String bin2hex(const uint8_t* in, size_t len);
 void   hex2bin(uint8_t* out, const char* in, size_t len); 
 
+void   base64encode(const uint8_t* in, size_t len, xbuf* out); // Append base64 of the input to an xbuf
 void   base64encode(xbuf* buf);                     // Convert the contents of an xbuf to base64
 String base64encode(const uint8_t* in, size_t len); // Convert the input buffer to a base64 String
 
@@ -32,4 +33,7 @@ int32_t HHMMSS2daytime(const char* HHMMSS, const char* format = "%2d:%2d:%2d");
 
 bool    copyFile(const char* dest, const char* source);  // Copy a file
 
-void hashFile(uint8_t* sha, File file);             // Get SHA256 hash of a file    
\ No newline at end of file
+void hashFile(uint8_t* sha, File file);             // Get SHA256 hash of a file
+uint32_t hashFNV(uint32_t hash, const void* data, size_t len); // Continue FNV-1a hash (start with 2166136261)    
+uint16_t floatToHalf(float value);                  // Convert to IEEE half precision
+float    halfToFloat(uint16_t half);                // Convert from IEEE half precision
\ No newline at end of file
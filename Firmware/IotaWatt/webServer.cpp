@@ -83,6 +83,10 @@ void handleRequest(){
   if(serverOn(authAdmin, F("/auth"), HTTP_POST, handlePasswords)) return;
   if(serverOn(authUser,  F("/nullreq"), HTTP_GET, returnOK)) return;
   if(serverOn(authUser,  F("/query"), HTTP_GET, handleQuery)) return;
+  if(serverOn(authUser,  F("/events"), HTTP_GET, handleEvents)) return;
+  if(serverOn(authUser,  F("/realtime"), HTTP_GET, handleRealtime)) return;
+  if(serverOn(authUser,  F("/metrics"), HTTP_GET, handleMetrics)) return;
+  if(serverOn(authUser,  F("/logexport"), HTTP_GET, handleLogExport)) return;
   if(serverOn(authUser,  F("/DSTtest"), HTTP_GET, handleDSTtest)) return;
   if(serverOn(authAdmin, F("/update"), HTTP_GET, handleUpdate)) return;
 
@@ -102,7 +106,9 @@ void handleRequest(){
 bool serverOn(authLevel level, const __FlashStringHelper *uri, HTTPMethod method, genericHandler fn){
   if(strcmp_P(server.uri().c_str(),(PGM_P)uri) == 0 && server.method() == method){
     if( ! authenticate(level)) return true;
+    uint32_t startUs = micros();
     fn();
+    perfWeb.record(micros() - startUs);
     return true;
   }
   return false;
@@ -177,10 +183,48 @@ bool loadFromSdCard(String path){
     sendMsgFile(dataFile, server.arg(F("textpos")).toInt());
   }
 
+        // Static web assets can be cached by the browser.
+        // There are no modified times on the SD card, so the ETag is the size
+        // and the count of changes made through the web server since startup.
+        // If the client accepts gzip and there is a compressed copy of the file 
+        // in the gzip directory, send that instead.
+
+  else if(dataType.startsWith(F("text/html")) || dataType.startsWith(F("text/css")) ||
+          dataType.startsWith(F("application/javascript")) || dataType.startsWith(F("image/"))){
+    bool gzip = false;
+    if(server.hasHeader(F("Accept-Encoding")) && server.header(F("Accept-Encoding")).indexOf(F("gzip")) >= 0){
+      File gzipFile = SD.open((String(F(GZIP_DIR)) + path).c_str());
+      if(gzipFile && ! gzipFile.isDirectory()){
+        dataFile.close();
+        dataFile = gzipFile;
+        gzip = true;
+      }
+      else if(gzipFile){
+        gzipFile.close();
+      }
+    }
+    char etag[32];
+    snprintf_P(etag, sizeof(etag), PSTR("\"%x-%x-%x%s\""), dataFile.size(), programStartTime, SDfileEpoch, gzip ? "g" : "");
+    server.sendHeader(F("Vary"), F("Accept-Encoding"));
+    if(notModified(etag)){
+      dataFile.close();
+      return true;
+    }
+    server.sendHeader(F("Cache-Control"), F("no-cache"));
+    if(gzip){
+      server.sendHeader(F("Content-Encoding"), F("gzip"));
+    }
+    server.streamFile(dataFile, dataType);
+  }
+
   else {
     if(path.equalsIgnoreCase(F("/config.txt"))){
       server.sendHeader(F("X-configSHA256"), base64encode(configSHA256, 32));
     }
+    else if(sendFileRange(dataFile, dataType)){
+      return true;
+    }
+    server.sendHeader(F("Accept-Ranges"), F("bytes"));
     size_t sent = server.streamFile(dataFile, dataType);
     if ( sent != dataFile.size()) {
       Serial.printf_P(PSTR("Server: sent less data than expected. file %s, sent %d, expected %d\r\n"), dataFile.name(), sent, dataFile.size());
@@ -190,6 +234,20 @@ bool loadFromSdCard(String path){
   return true;
 }
 
+    // If the request's If-None-Match is the current ETag, send 304 and return true.
+    // Otherwise add the ETag header to the response to follow.
+
+bool notModified(const char* etag){
+  if(server.hasHeader(F("If-None-Match")) && server.header(F("If-None-Match")) == etag){
+    trace(T_WEB,26);
+    server.sendHeader(F("ETag"), etag);
+    server.send(304, txtPlain_P, "");
+    return true;
+  }
+  server.sendHeader(F("ETag"), etag);
+  return false;
+}
+
 bool loadFromSpiffs(String path, String dataType){
   if( ! spiffsFileExists(path.c_str())){
     server.send(404, txtPlain_P, "Not Found");
@@ -222,6 +280,7 @@ void handleFileUpload(){
       }
     }
     if(SD.exists((char *)upload.filename.c_str())) SD.remove((char *)upload.filename.c_str());
+    SD.remove((String(F(GZIP_DIR)) + upload.filename).c_str());           // Compressed copy is stale
     if(uploadFile = SD.open(upload.filename.c_str(), FILE_WRITE)){
       DBG_OUTPUT_PORT.printf_P(PSTR("Upload: START, filename: %s\r\n"), upload.filename.c_str());
     }
@@ -234,6 +293,7 @@ void handleFileUpload(){
   } else if(upload.status == UPLOAD_FILE_END){
     if(uploadFile){
       uploadFile.close();
+      SDfileEpoch++;
       DBG_OUTPUT_PORT.printf_P(PSTR("Upload: END, Size: %d\r\n"), upload.totalSize);
       if(upload.filename.equals("/config.txt")){
         uploadFile = SD.open(upload.filename.c_str(), FILE_READ);
@@ -309,6 +369,8 @@ void handleDelete(){
     return;
   }
   deleteRecursive(path);
+  SD.remove((String(F(GZIP_DIR)) + path).c_str());
+  SDfileEpoch++;
   returnOK();
 }
 
@@ -338,6 +400,7 @@ void handleCreate(){
   } else {
     SD.mkdir((char *)path.c_str());
   }
+  SDfileEpoch++;
   returnOK();
 }
 
@@ -465,152 +528,217 @@ void handlePasswords(){
   return;
 }
 
+void perfObject(jsonStream& json, perfStat* stat){
+  json.set(F("count"), stat->count);
+  json.set(F("min"), stat->count ? stat->minUs : 0);
+  json.set(F("avg"), stat->count ? (uint32_t)(stat->totalUs / stat->count) : 0);
+  json.set(F("max"), stat->maxUs);
+  json.set(F("p99"), stat->percentile(99));
+}
+
+void poolObject(jsonStream& json, memPool* pool){
+  json.beginObject();
+  json.set(F("name"), pool->name());
+  json.set(F("size"), pool->blockSize());
+  json.set(F("blocks"), pool->blocks());
+  json.set(F("inuse"), pool->inUse());
+  json.set(F("highwater"), pool->highWater());
+  json.set(F("heapallocs"), pool->heapAllocs());
+  json.endObject();
+}
+
 void handleStatus(){
   trace(T_WEB,0);
-  uint32_t heapEntry = ESP.getFreeHeap();
-  String response = "";
-  {
-    DynamicJsonBuffer jsonBuffer;
-    JsonObject& root = jsonBuffer.createObject();
-
-    if(server.hasArg(F("device"))){
-      JsonObject& device = jsonBuffer.createObject();
-      device.set(F("name"), deviceName);
-      device.set(F("timediff"), localTimeDiff);
-      device.set(F("allowdst"), timezoneRule?true:false);
-      device.set(F("update"), updateClass);
-      root.set(F("device"),device);
-    }
-    
-    if(server.hasArg(F("stats"))){
-      trace(T_WEB,14);
-      JsonObject& stats = jsonBuffer.createObject();
-      stats.set(F("cyclerate"), samplesPerCycle);
-      trace(T_WEB,14);
-      stats.set(F("chanrate"),cycleSampleRate);
-      trace(T_WEB,14);
-      stats.set(F("runseconds"), UTCtime()-programStartTime);
-      trace(T_WEB,14);
-      stats.set(F("stack"),ESP.getFreeHeap());
-      trace(T_WEB,14);
-      stats.set(F("version"),IOTAWATT_VERSION);
-      trace(T_WEB,14);
-      stats.set(F("frequency"),frequency);
-      trace(T_WEB,14);
-      stats.set(F("lowbat"), RTClowBat);
-      root.set(F("stats"),stats);
-    }
-    
-    if(server.hasArg(F("inputs"))){
-      trace(T_WEB,15);
-      JsonArray& channelArray = jsonBuffer.createArray();
-      for(int i=0; i<maxInputs; i++){
-        if(inputChannel[i]->isActive()){
-          JsonObject& channelObject = jsonBuffer.createObject();
-          channelObject.set(F("channel"),inputChannel[i]->_channel);
-          if(inputChannel[i]->_type == channelTypeVoltage){
-            channelObject.set(F("Vrms"),statRecord.accum1[i]);
-            channelObject.set(F("Hz"),statRecord.accum2[i]);
-            channelObject.set("phase", inputChannel[i]->getPhase(inputChannel[i]->dataBucket.volts));
+  jsonStream json;
+  json.begin(200, txtJson_P);
+  json.beginObject();
+
+  if(server.hasArg(F("device"))){
+    json.beginObject(F("device"));
+    json.set(F("name"), deviceName);
+    json.set(F("timediff"), localTimeDiff);
+    json.set(F("allowdst"), timezoneRule?true:false);
+    json.set(F("update"), updateClass);
+    json.endObject();
+  }
+  
+  if(server.hasArg(F("stats"))){
+    trace(T_WEB,14);
+    json.beginObject(F("stats"));
+    json.set(F("cyclerate"), samplesPerCycle);
+    json.set(F("chanrate"),cycleSampleRate);
+    json.set(F("runseconds"), UTCtime()-programStartTime);
+    json.set(F("stack"),ESP.getFreeHeap());
+    json.set(F("version"),IOTAWATT_VERSION);
+    json.set(F("frequency"),frequency);
+    json.set(F("lowbat"), RTClowBat);
+    json.beginArray(F("pools"));
+    poolObject(json, &logRecordPool);
+    poolObject(json, &workBufPool);
+    json.endArray();
+    json.endObject();
+  }
+  
+  if(server.hasArg(F("inputs"))){
+    trace(T_WEB,15);
+    json.beginArray(F("inputs"));
+    for(int i=0; i<maxInputs; i++){
+      if(inputChannel[i]->isActive()){
+        json.beginObject();
+        json.set(F("channel"),inputChannel[i]->_channel);
+        json.set(F("coverage"),sampleCoverage[i]);
+        if(inputChannel[i]->_type == channelTypeVoltage){
+          json.set(F("Vrms"),statRecord.accum1[i]);
+          json.set(F("Hz"),statRecord.accum2[i]);
+          json.set(F("phase"), inputChannel[i]->getPhase(inputChannel[i]->dataBucket.volts));
+        }
+        else if(inputChannel[i]->_type == channelTypePower){
+          if(statRecord.accum1[i] > -2 && statRecord.accum1[i] < 2) statRecord.accum1[i] = 0;
+          json.set(F("Watts"),String(statRecord.accum1[i],0));
+          double pf = statRecord.accum2[i];
+          if(pf != 0){
+            pf = statRecord.accum1[i] / pf;
           }
-          else if(inputChannel[i]->_type == channelTypePower){
-            if(statRecord.accum1[i] > -2 && statRecord.accum1[i] < 2) statRecord.accum1[i] = 0;
-            channelObject.set(F("Watts"),String(statRecord.accum1[i],0));
-            double pf = statRecord.accum2[i];
-            if(pf != 0){
-              pf = statRecord.accum1[i] / pf;
-            }
-            channelObject.set("Pf",pf);
-            if(inputChannel[i]->_reversed){
-              channelObject.set(F("reversed"),true);
+          json.set(F("Pf"),pf);
+          if(inputChannel[i]->_reversed){
+            json.set(F("reversed"),true);
+          }
+          double volts = inputChannel[inputChannel[i]->_vchannel]->dataBucket.volts;
+          double amps = (volts < 50) ? 0 : inputChannel[i]->dataBucket.VA / volts;
+          json.set(F("phase"), inputChannel[i]->getPhase(amps));
+          json.set(F("lastphase"), inputChannel[i]->_lastPhase);
+          if(powerQuality){
+            json.set(F("thd"), inputChannel[i]->_thd, 1);
+            json.beginArray(F("harmonics"));
+            for(int h=0; h<3; h++){
+              json.value(inputChannel[i]->_harmonic[h], 1);
             }
-            double volts = inputChannel[inputChannel[i]->_vchannel]->dataBucket.volts;
-            double amps = (volts < 50) ? 0 : inputChannel[i]->dataBucket.VA / volts;
-            channelObject.set("phase", inputChannel[i]->getPhase(amps));
-            channelObject.set("lastphase", inputChannel[i]->_lastPhase);
+            json.endArray();
           }
-          channelArray.add(channelObject);
         }
+        json.endObject();
       }
-      root["inputs"] = channelArray;
     }
+    json.endArray();
+  }
 
   if(server.hasArg(F("outputs"))){
     trace(T_WEB,16);
-    JsonArray& outputArray = jsonBuffer.createArray();
+    json.beginArray(F("outputs"));
     Script* script = outputs->first();
     while(script){
       trace(T_WEB,16,1);
-      JsonObject& channelObject = jsonBuffer.createObject();
-      channelObject.set(F("name"),script->name());
-      channelObject.set(F("units"),script->getUnits());
-      double value = script->run((IotaLogRecord*)nullptr, &statRecord, 1.0);
-      channelObject.set(F("value"),value);
-      outputArray.add(channelObject);
+      json.beginObject();
+      json.set(F("name"),script->name());
+      json.set(F("units"),script->getUnits());
+      json.set(F("value"),script->run((IotaLogRecord*)nullptr, &statRecord, 1.0));
+      json.endObject();
       script = script->next();
     }
     trace(T_WEB,16,2);
-    root["outputs"] = outputArray;
+    json.endArray();
   }
 
-
-    if(server.hasArg(F("influx"))){
-      trace(T_WEB,17);
-      JsonObject& influx = jsonBuffer.createObject();
-      influx.set(F("running"),influxStarted);
-      influx.set(F("lastpost"),influxLastPost);  
-      root["influx"] = influx;
+  if(server.hasArg(F("perf"))){
+    trace(T_WEB,25);
+    json.beginObject(F("perf"));
+    json.beginArray(F("services"));
+    for(int i=0; i<PERF_TASKS; i++){
+      if(perfService[i]){
+        json.beginObject();
+        json.set(F("task"), i);
+        perfObject(json, perfService[i]);
+        json.endObject();
+      }
     }
+    json.endArray();
+    json.beginObject(F("web"));
+    perfObject(json, &perfWeb);
+    json.endObject();
+    json.beginObject(F("samplelate"));
+    perfObject(json, &perfSampleLate);
+    json.set(F("missed"), perfMissedCycles);
+    json.endObject();
+    json.beginObject(F("query"));
+    perfObject(json, &perfQuery);
+    json.set(F("groups"), perfQueryGroups);
+    json.set(F("cached"), perfQueryCached);
+    json.set(F("runs"), perfQueryRuns);
+    json.set(F("reads"), perfQueryReads);
+    json.endObject();
+    json.endObject();
+  }
 
-    if(server.hasArg(F("emon"))){
-      trace(T_WEB,22);
-      JsonObject& emon = jsonBuffer.createObject();
-      emon.set(F("running"),EmonStarted);
-      emon.set(F("lastpost"),EmonLastPost);  
-      root["emon"] = emon;
+  if(server.hasArg(F("influx"))){
+    trace(T_WEB,17);
+    json.beginObject(F("influx"));
+    json.set(F("running"),influxStarted);
+    json.set(F("lastpost"),influxLastPost);  
+    json.endObject();
+  }
+
+  if(server.hasArg(F("emon"))){
+    trace(T_WEB,22);
+    json.beginObject(F("emon"));
+    json.set(F("running"),EmonStarted);
+    json.set(F("lastpost"),EmonLastPost);  
+    json.endObject();
+  }
+
+  if(server.hasArg(F("pvoutput"))){
+    trace(T_WEB,23);
+    json.beginObject(F("pvoutput"));
+    if(!pvoutput){
+      json.set(F("state"),F("stopped"));
+    } else {
+      pvoutput->getStatusJson(json);
     }
+    json.endObject();
+  }
 
-    if(server.hasArg(F("pvoutput"))){
-      trace(T_WEB,23);
-      JsonObject& status = jsonBuffer.createObject();
-      if(!pvoutput){
-        status.set(F("state"),"stopped");
-      } else {
-        pvoutput->getStatusJson(status);
+  if(server.hasArg(F("datalogs"))){
+    trace(T_WEB,17);
+    json.beginObject(F("datalogs"));
+    json.beginObject(F("currlog"));
+    json.set(F("firstkey"),currLog.firstKey());
+    json.set(F("lastkey"),currLog.lastKey());
+    json.set(F("size"),currLog.fileSize());
+    json.set(F("interval"),currLog.interval());
+    json.set(F("format"),currLog.version());
+    json.set(F("readio"),currLog.readKeyIO());
+    json.set(F("readhits"),currLog.readKeyHits());
+    json.endObject();
+    json.beginObject(F("histlog"));
+    json.set(F("firstkey"),histLog.firstKey());
+    json.set(F("lastkey"),histLog.lastKey());
+    json.set(F("size"),histLog.fileSize());
+    json.set(F("interval"),histLog.interval());
+    json.set(F("format"),histLog.version());
+    json.set(F("readio"),histLog.readKeyIO());
+    json.set(F("readhits"),histLog.readKeyHits());
+    json.endObject();
+    for(int i=0; i<rollupTierCount; i++){
+      IotaLog* rollLog = rollupTiers[i].log;
+      if(rollLog->isOpen()){
+        json.beginObject(rollupTiers[i].name);
+        json.set(F("firstkey"),rollLog->firstKey());
+        json.set(F("lastkey"),rollLog->lastKey());
+        json.set(F("size"),rollLog->fileSize());
+        json.set(F("interval"),rollLog->interval());
+        json.endObject();
       }
-      root["pvoutput"] = status;
-    }
-
-    if(server.hasArg(F("datalogs"))){
-      trace(T_WEB,17);
-      JsonObject& datalogs = jsonBuffer.createObject();
-      JsonObject& currlog = jsonBuffer.createObject();
-      currlog.set(F("firstkey"),currLog.firstKey());
-      currlog.set(F("lastkey"),currLog.lastKey());
-      currlog.set(F("size"),currLog.fileSize());
-      currlog.set(F("interval"),currLog.interval());
-      //currlog.set("wrap",currLog._wrap ? true : false);
-      datalogs.set(F("currlog"),currlog);
-      JsonObject& histlog = jsonBuffer.createObject();
-      histlog.set(F("firstkey"),histLog.firstKey());
-      histlog.set(F("lastkey"),histLog.lastKey());
-      histlog.set(F("size"),histLog.fileSize());
-      histlog.set(F("interval"),histLog.interval());
-      //histlog.set("wrap",histLog._wrap ? true : false);
-      datalogs.set(F("histlog"),histlog);
-      root.set(F("datalogs"),datalogs);
-    }
-
-    if(server.hasArg(F("passwords"))){
-      trace(T_WEB,18);
-      JsonObject& passwords = jsonBuffer.createObject();
-      passwords.set(F("admin"),adminH1 != nullptr);
-      passwords.set(F("user"),userH1 != nullptr);  
-      root[F("passwords")] = passwords;
-    }
-    root.printTo(response);
-  }
-  server.send(200, txtJson_P, response);
+    }
+    json.endObject();
+  }
+
+  if(server.hasArg(F("passwords"))){
+    trace(T_WEB,18);
+    json.beginObject(F("passwords"));
+    json.set(F("admin"),adminH1 != nullptr);
+    json.set(F("user"),userH1 != nullptr);  
+    json.endObject();
+  }
+  json.end();
 }
 
 void handleVcal(){
@@ -636,6 +764,7 @@ void handleCommand(){
     server.send(200, "text/plain", "ok");
     log("Restart command received.");
     delay(500);
+    msglog.flush();
     ESP.restart();
   }
   if(server.hasArg(F("vtphase"))){
@@ -654,6 +783,15 @@ void handleCommand(){
     server.send(200, txtPlain_P, response);
     return; 
   }
+  if(server.hasArg(F("waveform"))){
+    trace(T_WEB,5); 
+    int cycles = 4;
+    if(server.hasArg(F("cycles"))){
+      cycles = server.arg(F("cycles")).toInt();
+    }
+    getWaveform(server.arg(F("waveform")).toInt(), cycles);
+    return; 
+  }
   if(server.hasArg(F("sample"))){
     trace(T_WEB,5); 
     uint16_t chan = server.arg(F("sample")).toInt();
@@ -677,28 +815,47 @@ void handleCommand(){
       currLog.end();
       deleteRecursive(String(IotaLogFile) + ".log");
       deleteRecursive(String(IotaLogFile) + ".ndx");
+      deleteRecursive(String(IotaLogFile) + ".kfr");
+      deleteRecursive(String(IotaLogFile) + ".mta");
     } 
     else if(arg == "history"){
       trace(T_WEB,22); 
       histLog.end();
       deleteRecursive(String(historyLogFile) + ".log");
       deleteRecursive(String(historyLogFile) + ".ndx");
+      deleteRecursive(String(historyLogFile) + ".kfr");
+      deleteRecursive(String(historyLogFile) + ".mta");
+    }
+    else if(arg == "rollup"){
+      trace(T_WEB,24);
+      for(int i=0; i<rollupTierCount; i++){
+        rollupTiers[i].log->end();
+        deleteRecursive(String(rollupTiers[i].path) + ".log");
+        deleteRecursive(String(rollupTiers[i].path) + ".ndx");
+        deleteRecursive(String(rollupTiers[i].path) + ".kfr");
+        deleteRecursive(String(rollupTiers[i].path) + ".mta");
+      }
     }
     else if(arg == "both"){
       trace(T_WEB,23);
       currLog.end();
       deleteRecursive(String(IotaLogFile) + ".log");
       deleteRecursive(String(IotaLogFile) + ".ndx");
+      deleteRecursive(String(IotaLogFile) + ".kfr");
+      deleteRecursive(String(IotaLogFile) + ".mta");
       histLog.end();
       deleteRecursive(String(historyLogFile) + ".log");
       deleteRecursive(String(historyLogFile) + ".ndx");
+      deleteRecursive(String(historyLogFile) + ".kfr");
+      deleteRecursive(String(historyLogFile) + ".mta");
     }
     else {
-      server.send(400, txtPlain_P, F("Specify current, history, or both."));
+      server.send(400, txtPlain_P, F("Specify current, history, rollup, or both."));
       return;
     }
     server.send(200, txtPlain_P, "ok");
     delay(1000);
+    msglog.flush();
     ESP.restart();
   }
   server.send(400, txtPlain_P, F("Unrecognized request"));
@@ -706,74 +863,49 @@ void handleCommand(){
 
 void handleGetFeedList(){ 
   trace(T_WEB,18);
-  String response;
-  {
-    DynamicJsonBuffer jsonBuffer;
-    JsonArray& array = jsonBuffer.createArray();
-    for(int i=0; i<maxInputs; i++){
-      if(inputChannel[i]->isActive()){
-        if(inputChannel[i]->_type == channelTypeVoltage){
-          JsonObject& voltage = jsonBuffer.createObject();
-          voltage["id"] = String("IV") + String(inputChannel[i]->_name);
-          voltage["tag"] = F("Voltage");
-          voltage["name"] = inputChannel[i]->_name;
-          array.add(voltage);
-        } 
-        else
-          if(inputChannel[i]->_type == channelTypePower){
-          JsonObject& power = jsonBuffer.createObject();
-          power["id"] = String("IP") + String(inputChannel[i]->_name);
-          power["tag"] = F("Power");
-          power["name"] = inputChannel[i]->_name;
-          array.add(power);
-          JsonObject& energy = jsonBuffer.createObject();
-          energy["id"] = String("IE") + String(inputChannel[i]->_name);
-          energy["tag"] = F("Energy");
-          energy["name"] = inputChannel[i]->_name;
-          array.add(energy);
-        }
+  jsonStream json;
+  json.begin(200, appJson_P);
+  json.beginArray();
+  for(int i=0; i<maxInputs; i++){
+    if(inputChannel[i]->isActive()){
+      if(inputChannel[i]->_type == channelTypeVoltage){
+        feedListEntry(json, "IV", F("Voltage"), inputChannel[i]->_name);
+      } 
+      else if(inputChannel[i]->_type == channelTypePower){
+        feedListEntry(json, "IP", F("Power"), inputChannel[i]->_name);
+        feedListEntry(json, "IE", F("Energy"), inputChannel[i]->_name);
       }
     }
-    trace(T_WEB,18);
-    if(outputs){
-      Script* script = outputs->first();
-      int outndx = 100;
-      while(script){
-        if(String(script->name()).indexOf(' ') == -1){
-          String units = script->getUnits();
-          if(units.equalsIgnoreCase("volts")){
-            JsonObject& voltage = jsonBuffer.createObject();
-            voltage["id"] = String("OV") + String(script->name());
-            voltage["tag"] = F("Voltage");
-            voltage["name"] = script->name();
-            array.add(voltage);
-          } 
-          else if(units.equalsIgnoreCase("watts")) {
-            JsonObject& power = jsonBuffer.createObject();
-            power["id"] = String("OP") + String(script->name());
-            power["tag"] = F("Power");
-            power["name"] = script->name();
-            array.add(power);
-            JsonObject& energy = jsonBuffer.createObject();
-            energy["id"] = String("OE") + String(script->name());
-            energy["tag"] = F("Energy");
-            energy["name"] = script->name();
-            array.add(energy);
-          }
-          else {
-            JsonObject& other = jsonBuffer.createObject();
-            other["id"] = String("OO") + String(script->name());
-            other["tag"] = F("Outputs");
-            other["name"] = script->name();
-            array.add(other);
-          }
+  }
+  trace(T_WEB,18);
+  if(outputs){
+    Script* script = outputs->first();
+    while(script){
+      if( ! strchr(script->name(), ' ')){
+        String units = script->getUnits();
+        if(units.equalsIgnoreCase("volts")){
+          feedListEntry(json, "OV", F("Voltage"), script->name());
+        } 
+        else if(units.equalsIgnoreCase("watts")) {
+          feedListEntry(json, "OP", F("Power"), script->name());
+          feedListEntry(json, "OE", F("Energy"), script->name());
+        }
+        else {
+          feedListEntry(json, "OO", F("Outputs"), script->name());
         }
-        script = script->next();
       }
+      script = script->next();
     }
-    array.printTo(response);
   }
-  server.send(200, appJson_P,response);
+  json.end();
+}
+
+void feedListEntry(jsonStream& json, const char* prefix, const __FlashStringHelper* tag, const char* name){
+  json.beginObject();
+  json.set(F("id"), String(prefix) + String(name));
+  json.set(F("tag"), tag);
+  json.set(F("name"), name);
+  json.endObject();
 }
 
 void handleGetFeedData(){
@@ -809,6 +941,7 @@ void handleGetConfig(){
       server.send(200, F("text/plain"), "OK");
       log("Restart command received.");
       delay(500);
+      msglog.flush();
       ESP.restart();
     }
     else if(server.arg(F("update")) == "reload"){
@@ -833,8 +966,25 @@ void handleQuery(){
     server.send(400, txtPlain_P, response);
   } else {
     trace(T_WEB,52);
+    String etag = query->etag();
+    if(etag.length() && notModified(etag.c_str())){
+      delete query;
+      return;
+    }
+
+        // Run as a job by queryService.
+        // If too many are already queued, refuse it.
+
+    if( ! queryStart(query)){
+      delete query;
+      queryBusy();
+      return;
+    }
+    if(etag.length()){
+      server.sendHeader(F("Cache-Control"), F("no-cache"));
+    }
     server.setContentLength(CONTENT_LENGTH_UNKNOWN);
-    if(server.hasArg(F("download"))){
+    if(server.hasArg(F("download")) || query->isBinary()){
       trace(T_WEB,53);
       server.send(200,"application/octet-stream","");
     }
@@ -846,21 +996,8 @@ void handleQuery(){
       trace(T_WEB,55);
       server.send(200, txtPlain_P, "");
     }
-      
-    uint8_t* buf = new uint8_t[1460];
-    int read = 0;
-    size_t size = 0;
-    trace(T_WEB,56);
-    while((read = query->readResult(buf+6, 1460-8)) && size < 100000){
-      trace(T_WEB,57);
-      sendChunk((char*)buf, read+6);
-      size += read;
-      trace(T_WEB,58);
-      yield();
-    }
-    trace(T_WEB,56);
-    sendChunk((char*)buf, 6);
-    delete buf;
+    trace(T_WEB,59);
+    return;
   }
   delete query;
   trace(T_WEB,59);
@@ -877,6 +1014,7 @@ void handleUpdate(){
       log ("Updater: Firmware updated, restarting.");
       server.send(200, txtPlain_P, F("Firmware updated, restarting."));
       delay(1000);
+      msglog.flush();
       ESP.restart();
     }
     else {
@@ -918,10 +1056,15 @@ void handleDSTtest(){
         // Buffer must have 6 bytes free at start for header and
         // must be long enough to add two byte footer.
         // bufPos is end of body (chunksize+6).
+        // chunkFrame just adds the header and footer, returning the framed length.
 
-size_t sendChunk(char* buf, size_t bufPos){
+size_t chunkFrame(char* buf, size_t bufPos){
   sprintf(buf,"%04x\r",bufPos-6);
   *(buf+5) = '\n';
   memcpy(buf+bufPos,"\r\n",2);
-  return server.client().write(buf,bufPos+2);
+  return bufPos+2;
+}
+
+size_t sendChunk(char* buf, size_t bufPos){
+  return server.client().write(buf,chunkFrame(buf, bufPos));
 }
\ No newline at end of file
@@ -17,6 +17,7 @@ void returnOK();
 void returnFail(String msg);
 bool loadFromSdCard(String path);
 bool loadFromSpiffs(String path, String dataType);
+bool notModified(const char* etag);
 void handleFileUpload();
 void handleSpiffsUpload();
 void deleteRecursive(String path);
@@ -26,9 +27,12 @@ void printDirectory();
 void printSpiffsDirectory(String path);
 void handleNotFound();
 void handleStatus();
+void perfObject(jsonStream& json, perfStat* stat);
+void poolObject(jsonStream& json, memPool* pool);
 void handleVcal();
 void handleCommand();
 void handleGetFeedList();
+void feedListEntry(jsonStream& json, const char* prefix, const __FlashStringHelper* tag, const char* name);
 void handleGetFeedData();
 void handleGraphCreate();
 void handleGraphUpdate();
@@ -39,6 +43,9 @@ void sendMsgFile(File &dataFile, int32_t relPos);
 void handleGetConfig();
 void handlePasswords();
 void handleQuery();
+void handleEvents();
+void handleRealtime();
+void handleMetrics();
 void handleUpdate();
 void handleDSTtest();
 